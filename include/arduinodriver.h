@@ -23,11 +23,15 @@
 #ifndef __FE_ARDUINODRIVER_H__
 #define __FE_ARDUINODRIVER_H__
 #include <sstream>
+#include <atomic>
 
 #include "ks/utils.h"
 #include "ks/timing.h"
+#include "ks/thread.h"
 #include "driver.h"
 #include "serial.h"
+#include "ring.h"
+#include "wait.h"
 
 // ASSERT if you want latency profile at the end of the session
 // COMMENT-OUT if you don't need latency profile
@@ -49,40 +53,143 @@ namespace fastevent {
                 try {
                     std::string path = json::get<std::string>(cfg, "port");
                     std::cerr << "port=" << path << std::endl;
+                    unsigned int outstanding = json::get<unsigned int>(cfg, "outstanding", 0);
                     ks::Result<serial_t> portsetup = serial::open(path);
                     if (portsetup.failed()) {
                         std::stringstream ss;
                         ss << "error setting up serial port: " << portsetup.what();
                         return ks::Result<OutputDriver *>::failure(ss.str());
                     }
-                    return ks::Result<OutputDriver *>::success(new T(portsetup.get()));
+                    T *driver = new T(portsetup.get());
+                    if (outstanding > 0) {
+                        driver->start_pipeline(outstanding);
+                    }
+                    return ks::Result<OutputDriver *>::success(driver);
 
                 } catch (const std::runtime_error& e) {
                     std::stringstream ss;
-                    ss << "parse error in 'options/port': " << e.what() << ".";
+                    ss << "parse error in 'options': " << e.what() << ".";
                     ss << " (set the path to your Arduino in 'options/port' key of 'service.cfg')";
                     return ks::Result<OutputDriver *>::failure(ss.str());
                 }
             }
         }
 
+        class EchoReader;
+
+        /**
+        *   each command is sent to the Arduino as a byte, which is echoed back.
+        *
+        *   by default, update() waits for the echo of a byte before the next
+        *   one is sent. after start_pipeline(), the bytes are sent as soon as
+        *   they are submitted, with up to `depth` of them waiting for their echoes,
+        *   and the echoes are taken by a separate thread (EchoReader) that
+        *   reports the completions.
+        */
         class ArduinoDriver: public OutputDriver
         {
         public:
+            /**
+             * how long (in milliseconds) EchoReader waits for an echo
+             * before it checks whether it is to stop
+             */
+            static const int      ECHO_POLL_MS = 100;
+            /**
+             * how long (in nanoseconds) submit() waits for a room among
+             * the outstanding bytes, shutdown() waits for their echoes,
+             * and EchoReader waits for an echo before it gives up on them all
+             */
+            static const uint64_t ECHO_TIMEOUT_NS = 1000000000ULL;
+
             ArduinoDriver(const serial_t& port);
             ~ArduinoDriver();
             void update(const char& out);
             void shutdown();
+            int  descriptor() const;
+
+            /**
+             * starts sending the commands ahead of the echoes,
+             * with up to `depth` bytes outstanding.
+             */
+            void start_pipeline(const size_t& depth);
+
+            size_t async_depth() const { return depth_; }
+            bool   submit(const Command *commands, const size_t& count, const uint64_t& tag);
 
         protected:
             void waitForLine();
             void clear();
 
         private:
+            friend class EchoReader;
+
+            /**
+             * a byte waiting for its echo
+             */
+            struct Echo
+            {
+                char     sent;
+                /**
+                 * whether it is the last byte of the submission of `tag`
+                 */
+                bool     last;
+                uint64_t tag;
+                uint64_t sent_at;
+            };
+
+            /**
+             * the byte to be sent for the command
+             */
+            static char encode(const char& cmd);
+
+            /**
+             * (pipelined) sends a byte once there is a room for it.
+             * returns false if it could not be sent.
+             */
+            bool send(const char& out, const bool& last, const uint64_t& tag);
+
+            /**
+             * (EchoReader) takes the echoes until stop_pipeline()
+             */
+            void read_echoes();
+
+            /**
+             * (EchoReader) reports the failure of all the submissions outstanding,
+             * and returns the number of the bytes given up on.
+             * `lost` counts them among the bytes whose echoes never arrived.
+             */
+            size_t fail_outstanding(const bool& lost = false);
+
+            void stop_pipeline();
+
+            /**
+             * (EchoReader) records the round-trip latency of a byte
+             */
+            void add_latency(const uint64_t& start);
+
             serial_t    port_;
             bool        closed_;
             char        prev_;
 
+            /**
+             * the pipeline: the bytes sent and not yet echoed, in order
+             */
+            size_t                  depth_;
+            Ring<Echo>             *echoes_;
+            EchoReader             *reader_;
+            std::atomic<size_t>     inflight_;
+            std::atomic<bool>       stopping_;
+            std::atomic<bool>       failed_;
+
+            /**
+             * the echoes that did not match the bytes sent (or that matched none of them)
+             */
+            std::atomic<uint64_t>   mismatched_;
+            /**
+             * the bytes whose echoes never arrived
+             */
+            std::atomic<uint64_t>   lost_;
+
 #ifdef __FE_PROFILE_IO__
             ks::nanostamp  clock_;
             // placeholder for IO profiling info
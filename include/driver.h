@@ -25,6 +25,9 @@
 
 #include <map>
 #include <string>
+#include <type_traits>
+#include <stddef.h>
+#include <stdint.h>
 #include "ks/utils.h"
 #include "config.h"
 
@@ -46,25 +49,78 @@ namespace fastevent {
         return ((out & MASK_QUIT) != 0);
     }
 
+    /**
+    *   a command to the driver (the bits of MASK_COMMANDS, without the newlines)
+    */
+    typedef char Command;
+
+    class OutputDriver;
+
+    template <typename T>
+    struct Pipeline;
+
+    /**
+    *   where an asynchronous driver reports the completion of the commands
+    *   submitted to it (see OutputDriver::submit()). it may be called from
+    *   any single thread of the driver, but not from two threads at a time.
+    */
+    class Completion
+    {
+    public:
+        virtual ~Completion() {}
+
+        /**
+         * the commands submitted with `tag` have reached the output
+         * (or have failed to, if `ok` is false).
+         */
+        virtual void completed(const uint64_t& tag, const bool& ok)=0;
+    };
+
+    /**
+    *   passes `count` commands (as received, possibly with the newlines)
+    *   to `driver`, and returns the number of them that were passed.
+    *   `state` is set to the last of them.
+    */
+    typedef size_t (*CommandLoop)(OutputDriver *driver, const char *commands, const size_t& count, char *state);
+
     /**
     *   OutputDriver class is the base interface for output generator driver.
     *
     *   in addition to sync(), event() and update() methods, the subclasses
-    *   must implement the following public static members:
+    *   may implement update_batch() to take the commands of a request at once,
+    *   and submit() (with async_depth()) to take them without waiting
+    *   for the output; the defaults fall back to update().
+    *
+    *   the subclasses must implement the following public static members:
     *
     *   + static std::string identifier()
     *   + static Result<Output*> setup(Config&)
     *
     *   when you implement a new driver, you also have to
-    *   call `registerOutputDriver(SubClassSignature)` in the initialization code
+    *   call `registerOutputDriver(SubClassSignature)` in the initialization code.
+    *   this also compiles the command loop of DriverThread for the driver
+    *   (see Pipeline), which is attached to the driver when it is set up.
     */
     class OutputDriver
     {
         typedef std::map<std::string, ks::Result<OutputDriver *>(*)(Config&)> Registry;
     private:
         static Registry _registry;
+        /**
+         * the command loop for the concrete type of the driver
+         */
+        CommandLoop loop_;
+
+    protected:
+        /**
+         * (asynchronous drivers) where to report the completions
+         */
+        Completion *completion_;
+
     public:
 
+        OutputDriver();
+
         virtual ~OutputDriver() {}
 
         /**
@@ -72,19 +128,178 @@ namespace fastevent {
          */
         virtual void update(const char& out)=0;
 
+        /**
+         * updates the output of the driver to each of the `count` commands in turn.
+         * the default calls update() for each of them.
+         */
+        virtual void update_batch(const Command *commands, const size_t& count)
+        {
+            for (size_t i=0; i<count; i++) {
+                update(commands[i]);
+            }
+        }
+
+        /**
+         * the maximal number of submit() calls that may be waiting for their
+         * completions at a time, or 0 if the driver is synchronous (the default),
+         * i.e. the commands are passed to update() or update_batch() instead.
+         * an asynchronous driver must still take the commands through update().
+         */
+        virtual size_t async_depth() const { return 0; }
+
+        /**
+         * (asynchronous drivers) starts updating the output to the `count`
+         * commands in turn, and returns without waiting for them to complete.
+         * their completion is reported with `tag` to the Completion set by
+         * set_completion(). returns false if they could not be submitted at all
+         * (no completion is reported then).
+         * the default calls update_batch() and reports the completion right away.
+         */
+        virtual bool submit(const Command *commands, const size_t& count, const uint64_t& tag)
+        {
+            update_batch(commands, count);
+            completion_->completed(tag, true);
+            return true;
+        }
+
+        /**
+         * sets where to report the completions of submit()
+         */
+        void set_completion(Completion *completion) { completion_ = completion; }
+
         /**
          * shuts down the driver
          */
         virtual void shutdown()=0;
 
+        /**
+         * a descriptor of the underlying device that can be watched
+         * for hang-ups (e.g. the serial port being unplugged), or -1 if none.
+         */
+        virtual int descriptor() const { return -1; }
+
+        /**
+         * the command loop to be used with the driver
+         */
+        CommandLoop command_loop() const { return loop_; }
+
+        /**
+         * attaches the command loop for `T` to `driver` (of the type `T`)
+         */
+        template <typename T>
+        static T *specialize(T *driver)
+        {
+            driver->loop_ = &Pipeline<T>::run;
+            return driver;
+        }
+
+        /**
+         * sets up a `T` driver, with its own command loop
+         */
+        template <typename T>
+        static ks::Result<OutputDriver *> setup_as(Config& cfg)
+        {
+            ks::Result<OutputDriver *> result = T::setup(cfg);
+            if (result.successful()) {
+                specialize<T>(static_cast<T *>(result.get()));
+            }
+            return result;
+        }
+
         template <typename T>
         static void register_output_driver()
         {
-            _registry[T::identifier()] = &T::setup;
+            _registry[T::identifier()] = &setup_as<T>;
         }
 
         static ks::Result<OutputDriver *> setup(const std::string &name, Config& cfg, const bool& verbose=true);
     };
+
+    /**
+    *   decodes `count` commands as received into `out`, skipping the newlines,
+    *   and returns the number of the commands left.
+    */
+    inline size_t decode_commands(const char *commands, const size_t& count, Command *out)
+    {
+        size_t n = 0;
+        for (size_t i=0; i<count; i++) {
+            if ((commands[i] == '\r') || (commands[i] == '\n')) {
+                // newline characters: do nothing
+                continue;
+            }
+            out[n++] = commands[i] & MASK_COMMANDS;
+        }
+        return n;
+    }
+
+    /**
+    *   the command loop of DriverThread, compiled for the driver type `T`:
+    *   T::update() (or T::update_batch(), if `T` has its own) is called directly,
+    *   and is inlined if it is defined in the header, rather than through
+    *   the vtable for every command.
+    *   Pipeline<OutputDriver> is the generic one that goes through the vtable.
+    */
+    template <typename T>
+    struct Pipeline
+    {
+        /**
+         * the number of commands passed to update_batch() at most at once
+         */
+        static const size_t BATCH = 16;
+
+        /**
+         * whether or not `T` (or a base class of it) overrides update_batch()
+         */
+        static const bool BATCHED = !std::is_same<decltype(&T::update_batch),
+                                                  void (OutputDriver::*)(const Command *, const size_t&)>::value;
+
+        static void update(T *driver, const Command& state)
+        {
+            driver->T::update(state);
+        }
+
+        static void update_batch(T *driver, const Command *commands, const size_t& count)
+        {
+            if (BATCHED) {
+                driver->T::update_batch(commands, count);
+            } else {
+                for (size_t i=0; i<count; i++) {
+                    update(driver, commands[i]);
+                }
+            }
+        }
+
+        static size_t run(OutputDriver *driver, const char *commands, const size_t& count, char *state)
+        {
+            T *concrete = static_cast<T *>(driver);
+            Command batch[BATCH];
+            size_t passed = 0;
+            for (size_t i=0; i<count; i+=BATCH) {
+                const size_t n = decode_commands(commands + i, (count - i < BATCH)? (count - i) : BATCH, batch);
+                if (n == 0) {
+                    continue;
+                }
+                update_batch(concrete, batch, n);
+                *state  = batch[n-1];
+                passed += n;
+            }
+            return passed;
+        }
+    };
+
+    template <>
+    inline void Pipeline<OutputDriver>::update(OutputDriver *driver, const Command& state)
+    {
+        driver->update(state);
+    }
+
+    template <>
+    inline void Pipeline<OutputDriver>::update_batch(OutputDriver *driver, const Command *commands, const size_t& count)
+    {
+        driver->update_batch(commands, count);
+    }
+
+    inline OutputDriver::OutputDriver(): loop_(&Pipeline<OutputDriver>::run), completion_(0) {}
 }
 
 #define registerOutputDriver(CLS) (fastevent::OutputDriver::register_output_driver<CLS>())
@@ -91,12 +91,34 @@ namespace fastevent {
       return get_converted<uint16_t, double>(dict, key);
     }
 
+    template <> inline
+    unsigned int get(picojson::object &dict, const std::string &key)
+    {
+      return get_converted<unsigned int, double>(dict, key);
+    }
+
     template <> inline
     float get(picojson::object &dict, const std::string &key)
     {
       return get_converted<float, double>(dict, key);
     }
 
+    inline
+    bool has(picojson::object &dict, const std::string &key)
+    {
+      return dict.find(key) != dict.end();
+    }
+
+    /**
+    *   same as get(), except that `fallback` is returned when `key` is absent.
+    *   a malformed value still throws.
+    */
+    template <typename T> inline
+    T get(picojson::object &dict, const std::string &key, const T &fallback)
+    {
+      return has(dict, key)? get<T>(dict, key) : fallback;
+    }
+
   }
 }
 
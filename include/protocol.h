@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   protocol.h -- the wire format of the requests and the responses
+*
+*   1. the legacy format: a 2-byte datagram (the index byte and the command
+*      byte), echoed back as it is.
+*
+*   2. the version 2 format: a datagram carrying up to V2_COMMANDS_MAX commands,
+*      numbered consecutively from a 16-bit sequence number:
+*
+*      ```
+*      request: [V2_MARKER][V2_VERSION][count][flags][seq (hi)][seq (lo)][command] x count
+*      ack:     [V2_MARKER][V2_VERSION][count][flags][seq (hi)][seq (lo)][command]
+*      ```
+*
+*      the commands are passed to the driver in order, and a single ack is
+*      returned for the datagram once all of them have been processed.
+*      the ack carries the sequence number of the last command (i.e. it
+*      acknowledges the `count` commands up to and including it), and the last
+*      command itself.
+*
+*      with V2_FLAG_SCHEDULED, the header is followed by the target time
+*      (8 bytes, big-endian), in nanoseconds on the monotonic clock of the server
+*      (CLOCK_MONOTONIC on Linux). the commands are issued to the driver at the
+*      target time, less the time the driver takes to get them out, and the ack
+*      is followed by the time they were actually issued (on the same clock):
+*
+*      ```
+*      request: [header][target (8 bytes)][command] x count
+*      ack:     [header][command][issued (8 bytes)]
+*      ```
+*
+*      the commands whose target time has already passed are issued right away,
+*      with V2_FLAG_LATE in the ack. a client on another host can learn the clock
+*      of the server from the ack of a scheduled no-op (e.g. '\n') with the target time of 0.
+*
+*      with V2_FLAG_MAX_AGE, the header (and the target time, if any) is followed
+*      by the maximal age of the commands (4 bytes, big-endian, in microseconds),
+*      overriding the `max_age_us` setting of the server (0 for no limit):
+*
+*      ```
+*      request: [header]([target (8 bytes)])[max age (4 bytes)][command] x count
+*      ```
+*
+*      the commands that are older than that by the time they would reach the driver
+*      (counting from their arrival, or from their target time if scheduled)
+*      are dropped, and the ack has V2_FLAG_EXPIRED.
+*
+*      a request may choose when it is acknowledged, overriding the setting
+*      of the client (see `clients` in README.md): with V2_FLAG_ACK_RECEIVE,
+*      the ack is returned as soon as the server has received the request
+*      (before the commands are issued; `issued` is then 0), and with
+*      V2_FLAG_NO_ACK, no ack is returned at all.
+*
+*      the flags of a request are echoed in its ack. the other bits of the flags
+*      are reserved (leave them 0) in the requests.
+*
+*   the clients may use all the bits of the legacy command byte, so that there
+*   is no room for a mark in its echo. therefore, when the server coalesces
+*   the pending commands (see DriverThread), only the version 2 requests are
+*   coalesced, and the acks to the ones that were superseded by the later ones
+*   are marked with V2_FLAG_COALESCED; a legacy request is always passed to
+*   the driver on its own. likewise, the acks to the expired requests are marked
+*   with V2_FLAG_EXPIRED, whereas an expired legacy request is not echoed at all
+*   (the client times out, as it would for a lost datagram).
+*
+*   a datagram is taken as a version 2 one if it starts with V2_MARKER and
+*   V2_VERSION, and is longer than 2 bytes; otherwise, it is a legacy one.
+*
+*   this header is self-contained, so that it can be copied into the client code.
+*/
+
+#ifndef __FE_PROTOCOL_H__
+#define __FE_PROTOCOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace fastevent {
+    namespace protocol {
+        const int       MSG_SIZE        = 2;
+        const uint8_t   INDEX_BYTE      = 0;
+        const uint8_t   STATUS_BYTE     = 1;
+
+        const uint8_t   V2_MARKER       = 0xFE;
+        const uint8_t   V2_VERSION      = 2;
+        const uint8_t   V2_COUNT_BYTE   = 2;
+        const uint8_t   V2_FLAGS_BYTE   = 3;
+        const uint8_t   V2_SEQ_BYTE     = 4;
+        const size_t    V2_HEADER_SIZE  = 6;
+        const size_t    V2_TIME_SIZE    = 8;
+        const size_t    V2_AGE_SIZE     = 4;
+
+        /**
+        *   (request/ack) the commands carry a target time
+        */
+        const uint8_t   V2_FLAG_SCHEDULED   = 0x01;
+        /**
+        *   (ack) the target time had passed when the commands reached the driver
+        */
+        const uint8_t   V2_FLAG_LATE        = 0x02;
+        /**
+        *   (ack) the commands were folded into the later ones, rather than
+        *   being passed to the driver as they were
+        */
+        const uint8_t   V2_FLAG_COALESCED   = 0x04;
+        /**
+        *   (request/ack) the ack is returned once the request is received,
+        *   rather than once the commands have been issued
+        */
+        const uint8_t   V2_FLAG_ACK_RECEIVE = 0x08;
+        /**
+        *   (request) no ack is returned
+        */
+        const uint8_t   V2_FLAG_NO_ACK      = 0x10;
+        /**
+        *   (request/ack) the commands carry their maximal age
+        */
+        const uint8_t   V2_FLAG_MAX_AGE     = 0x20;
+        /**
+        *   (ack) the commands were dropped, having been older than their maximal age
+        */
+        const uint8_t   V2_FLAG_EXPIRED     = 0x40;
+
+        /**
+        *   the maximal number of commands in a datagram
+        */
+        const size_t    V2_COMMANDS_MAX = 16;
+
+        const size_t    V2_REQUEST_MAX  = V2_HEADER_SIZE + V2_TIME_SIZE + V2_AGE_SIZE + V2_COMMANDS_MAX;
+        const size_t    V2_ACK_SIZE     = V2_HEADER_SIZE + 1;
+        const size_t    V2_RESPONSE_MAX = V2_ACK_SIZE + V2_TIME_SIZE;
+
+        inline bool is_v2(const char *buf, const size_t& len)
+        {
+            return (len > static_cast<size_t>(MSG_SIZE))
+                    && (static_cast<uint8_t>(buf[0]) == V2_MARKER)
+                    && (static_cast<uint8_t>(buf[1]) == V2_VERSION);
+        }
+
+        /**
+        *   writes the header of a version 2 datagram (a request or an ack)
+        *   into `buf`, with the sequence number `seq`.
+        */
+        inline void put_v2_header(char *buf, const uint8_t& count, const uint8_t& flags, const uint16_t& seq)
+        {
+            buf[0]              = static_cast<char>(V2_MARKER);
+            buf[1]              = static_cast<char>(V2_VERSION);
+            buf[V2_COUNT_BYTE]  = static_cast<char>(count);
+            buf[V2_FLAGS_BYTE]  = static_cast<char>(flags);
+            buf[V2_SEQ_BYTE]    = static_cast<char>(seq >> 8);
+            buf[V2_SEQ_BYTE+1]  = static_cast<char>(seq & 0xFF);
+        }
+
+        inline uint16_t get_v2_sequence(const char *buf)
+        {
+            return static_cast<uint16_t>((static_cast<uint8_t>(buf[V2_SEQ_BYTE]) << 8)
+                                         | static_cast<uint8_t>(buf[V2_SEQ_BYTE+1]));
+        }
+
+        inline void put_v2_time(char *buf, const uint64_t& time)
+        {
+            for (size_t i=0; i<V2_TIME_SIZE; i++) {
+                buf[i] = static_cast<char>((time >> (8 * (V2_TIME_SIZE - 1 - i))) & 0xFF);
+            }
+        }
+
+        inline uint64_t get_v2_time(const char *buf)
+        {
+            uint64_t time = 0;
+            for (size_t i=0; i<V2_TIME_SIZE; i++) {
+                time = (time << 8) | static_cast<uint8_t>(buf[i]);
+            }
+            return time;
+        }
+
+        inline void put_v2_age(char *buf, const uint32_t& age)
+        {
+            for (size_t i=0; i<V2_AGE_SIZE; i++) {
+                buf[i] = static_cast<char>((age >> (8 * (V2_AGE_SIZE - 1 - i))) & 0xFF);
+            }
+        }
+
+        inline uint32_t get_v2_age(const char *buf)
+        {
+            uint32_t age = 0;
+            for (size_t i=0; i<V2_AGE_SIZE; i++) {
+                age = (age << 8) | static_cast<uint8_t>(buf[i]);
+            }
+            return age;
+        }
+
+        /**
+        *   the offset of the commands in a request with `flags`
+        */
+        inline size_t v2_commands_offset(const uint8_t& flags)
+        {
+            return V2_HEADER_SIZE + ((flags & V2_FLAG_SCHEDULED)? V2_TIME_SIZE : 0)
+                                  + ((flags & V2_FLAG_MAX_AGE)? V2_AGE_SIZE : 0);
+        }
+
+        /**
+        *   (client) writes a request of `count` commands (up to V2_COMMANDS_MAX),
+        *   the first of them being numbered `seq`, into `buf` (of V2_REQUEST_MAX bytes).
+        *   returns the size of the datagram.
+        */
+        inline size_t encode_v2_request(char *buf, const uint16_t& seq, const char *commands, const size_t& count)
+        {
+            put_v2_header(buf, static_cast<uint8_t>(count), 0, seq);
+            memcpy(buf + V2_HEADER_SIZE, commands, count);
+            return V2_HEADER_SIZE + count;
+        }
+
+        /**
+        *   (client) the same as encode_v2_request(), with the commands
+        *   to be issued at `target` on the monotonic clock of the server.
+        */
+        inline size_t encode_v2_scheduled(char *buf, const uint16_t& seq, const uint64_t& target,
+                                          const char *commands, const size_t& count)
+        {
+            put_v2_header(buf, static_cast<uint8_t>(count), V2_FLAG_SCHEDULED, seq);
+            put_v2_time(buf + V2_HEADER_SIZE, target);
+            memcpy(buf + V2_HEADER_SIZE + V2_TIME_SIZE, commands, count);
+            return V2_HEADER_SIZE + V2_TIME_SIZE + count;
+        }
+
+        /**
+        *   (client) the general form of the above: `target` is written with V2_FLAG_SCHEDULED
+        *   in `flags`, and `max_age` (in microseconds) with V2_FLAG_MAX_AGE.
+        */
+        inline size_t encode_v2(char *buf, const uint16_t& seq, const uint8_t& flags,
+                                const uint64_t& target, const uint32_t& max_age,
+                                const char *commands, const size_t& count)
+        {
+            put_v2_header(buf, static_cast<uint8_t>(count), flags, seq);
+            size_t offset = V2_HEADER_SIZE;
+            if (flags & V2_FLAG_SCHEDULED) {
+                put_v2_time(buf + offset, target);
+                offset += V2_TIME_SIZE;
+            }
+            if (flags & V2_FLAG_MAX_AGE) {
+                put_v2_age(buf + offset, max_age);
+                offset += V2_AGE_SIZE;
+            }
+            memcpy(buf + offset, commands, count);
+            return offset + count;
+        }
+
+        /**
+        *   (client) reads an ack. `issued` (if any) is set to the time the commands
+        *   were issued for a scheduled request, or to 0 otherwise.
+        *   returns false if `buf` is not an ack.
+        */
+        inline bool decode_v2_ack(const char *buf, const size_t& len,
+                                  uint16_t *last, uint8_t *count, uint8_t *flags,
+                                  uint64_t *issued=0)
+        {
+            if ((len < V2_ACK_SIZE) || (!is_v2(buf, len))) {
+                return false;
+            }
+            *last  = get_v2_sequence(buf);
+            *count = static_cast<uint8_t>(buf[V2_COUNT_BYTE]);
+            *flags = static_cast<uint8_t>(buf[V2_FLAGS_BYTE]);
+            const bool scheduled = ((*flags & V2_FLAG_SCHEDULED) != 0);
+            if (scheduled && (len < V2_RESPONSE_MAX)) {
+                return false;
+            }
+            if (issued != 0) {
+                *issued = scheduled? get_v2_time(buf + V2_ACK_SIZE) : 0;
+            }
+            return true;
+        }
+    }
+}
+
+#endif
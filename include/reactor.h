@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   reactor.h -- a single-threaded event loop over descriptors
+*
+*   on Linux, Reactor is built on epoll(7), and timers and wakeups are
+*   timerfd(2) and eventfd(2) descriptors in the same epoll set.
+*   elsewhere, it falls back to select(2), emulating timers by the timeout
+*   and wakeups by a self-pipe (the latter is not available on Windows).
+*/
+
+#ifndef __FE_REACTOR_H__
+#define __FE_REACTOR_H__
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+  #include <sys/select.h>
+#endif
+
+#include <stdint.h>
+#include <vector>
+
+namespace fastevent {
+
+    /**
+    *   let `fastevent::socket_t` be the correct type for native sockets
+    */
+#ifdef _WIN32
+    typedef SOCKET        socket_t;
+#else
+    typedef int           socket_t;
+#endif
+
+    class Reactor
+    {
+    public:
+        enum Kind { Descriptor, Timer, Wakeup };
+
+        /**
+        *   an event reported by wait().
+        *   `context` is the pointer given at registration.
+        */
+        struct Event
+        {
+            Kind    kind;
+            void   *context;
+            bool    readable;
+            bool    hangup;
+        };
+
+        Reactor();
+        ~Reactor();
+
+        /**
+        *   watches `fd`. if `readable` is false, only hang-ups/errors are reported.
+        *   returns false on failure.
+        */
+        bool add(const socket_t& fd, void *context, const bool& readable=true);
+
+        /**
+        *   stops watching `fd` (as added by add()). its entry may be reused
+        *   by the next add(). returns false if `fd` was not being watched.
+        */
+        bool remove(const socket_t& fd);
+
+        /**
+        *   adds a periodic timer that fires every `interval` nanoseconds.
+        *   returns false on failure.
+        */
+        bool add_timer(const uint64_t& interval, void *context);
+
+        /**
+        *   enables wakeup(), which makes wait() report a `Wakeup` event
+        *   with `context`. returns false on failure.
+        */
+        bool add_wakeup(void *context);
+
+        /**
+        *   wakes up the thread in wait(). it is safe to call from another thread,
+        *   and from a signal handler.
+        */
+        void wakeup();
+
+        /**
+        *   waits for events, and fills in up to `max` of them.
+        *   returns the number of events, or -1 on error.
+        */
+        int  wait(Event *events, const int& max);
+
+    private:
+        Reactor(const Reactor&);
+        Reactor& operator=(const Reactor&);
+
+        struct Entry
+        {
+            Kind        kind;
+            socket_t    fd;
+            void       *context;
+            bool        readable;
+            uint64_t    interval;
+            uint64_t    next;
+            /**
+            *   false once the entry has been removed
+            */
+            bool        active;
+        };
+
+        Entry *push(const Kind& kind, const socket_t& fd, void *context, const bool& readable);
+
+        /**
+        *   registered entries; pointers to them are handed out,
+        *   so that it only grows, and is reserved in advance.
+        *   removed entries are only deactivated, and get reused.
+        */
+        std::vector<Entry>  entries_;
+
+        /**
+        *   the descriptor to be written by wakeup(), or -1
+        */
+        int                 wakeup_fd_;
+
+#ifdef __linux__
+        int                 epoll_;
+#else
+        int                 pipe_[2];
+#endif
+    };
+}
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   ring.h -- bounded lock-free single-producer/single-consumer ring
+*
+*   the producer only ever writes `tail_`, and the consumer only ever writes `head_`.
+*   each index lives on its own cache line (together with the cached copy of the
+*   other side's index), so that the two threads do not bounce a line back and forth
+*   unless they actually have to synchronize.
+*/
+
+#ifndef __FE_RING_H__
+#define __FE_RING_H__
+
+#include <stddef.h>
+#include <atomic>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace fastevent {
+
+    const size_t CACHELINE_SIZE = 64;
+
+    /**
+    *   a hint to the CPU that we are in a spin-wait loop.
+    */
+    inline void cpu_relax()
+    {
+#if defined(_WIN32)
+        YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield" ::: "memory");
+#else
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+    }
+
+    /**
+    *   rounds `n` up to the next power of two (at least 2).
+    */
+    inline size_t ceil_pow2(size_t n)
+    {
+        size_t v = 2;
+        while (v < n) {
+            v <<= 1;
+        }
+        return v;
+    }
+
+    template <typename T>
+    class Ring
+    {
+    public:
+        /**
+        *   `depth` is rounded up to a power of two. the slots are zero-filled,
+        *   so that their pages are faulted in at construction.
+        */
+        explicit Ring(const size_t& depth):
+            head_(0), tail_cache_(0), tail_(0), head_cache_(0),
+            mask_(ceil_pow2(depth)-1), slots_(new T[mask_+1]()) { }
+
+        ~Ring() { delete[] slots_; }
+
+        size_t capacity() const { return mask_ + 1; }
+
+        /**
+        *   (producer only) returns false if the ring is full.
+        */
+        bool push(const T& item)
+        {
+            if (!reserve(1)) {
+                return false;
+            }
+            slots_[tail_.load(std::memory_order_relaxed) & mask_] = item;
+            publish(1);
+            return true;
+        }
+
+        /**
+        *   (producer only) checks whether there are `n` free slots.
+        */
+        bool reserve(const size_t& n)
+        {
+            const size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail - head_cache_ + n > capacity()) {
+                head_cache_ = head_.load(std::memory_order_acquire);
+                if (tail - head_cache_ + n > capacity()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+        *   (producer only) the `offset`-th slot after the current tail.
+        *   it only becomes visible to the consumer after publish().
+        */
+        T& slot(const size_t& offset)
+        {
+            return slots_[(tail_.load(std::memory_order_relaxed) + offset) & mask_];
+        }
+
+        /**
+        *   (producer only) makes `n` written slots visible to the consumer at once.
+        */
+        void publish(const size_t& n)
+        {
+            tail_.store(tail_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        }
+
+        /**
+        *   (consumer only) returns false if the ring is empty.
+        */
+        bool pop(T* item)
+        {
+            const size_t head = head_.load(std::memory_order_relaxed);
+            if (head == tail_cache_) {
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+                if (head == tail_cache_) {
+                    return false;
+                }
+            }
+            *item = slots_[head & mask_];
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+        *   (consumer only) copies the next item without taking it.
+        *   returns false if the ring is empty.
+        */
+        bool peek(T* item)
+        {
+            const size_t head = head_.load(std::memory_order_relaxed);
+            if (head == tail_cache_) {
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+                if (head == tail_cache_) {
+                    return false;
+                }
+            }
+            *item = slots_[head & mask_];
+            return true;
+        }
+
+        /**
+        *   may be called from either side. sequentially consistent,
+        *   so that it can be used as the re-check before going to sleep.
+        */
+        bool empty() const
+        {
+            return head_.load(std::memory_order_seq_cst) == tail_.load(std::memory_order_seq_cst);
+        }
+
+    private:
+        Ring(const Ring&);
+        Ring& operator=(const Ring&);
+
+        // consumer-side line
+        alignas(CACHELINE_SIZE) std::atomic<size_t> head_;
+        size_t                                      tail_cache_;
+
+        // producer-side line
+        alignas(CACHELINE_SIZE) std::atomic<size_t> tail_;
+        size_t                                      head_cache_;
+
+        // read-only after construction
+        alignas(CACHELINE_SIZE) const size_t        mask_;
+        T                                          *slots_;
+    };
+}
+
+#endif
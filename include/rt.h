@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   rt.h -- real-time related settings for the service threads
+*
+*   most of the functionality is only available on Linux;
+*   elsewhere, the functions fail with a message that says so.
+*/
+
+#ifndef __FE_RT_H__
+#define __FE_RT_H__
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "ks/utils.h"
+#include "config.h"
+
+// ASSERT if you want to be warned about heap allocations and iostream usage
+// on the hot path (Service::handle, DriverThread::run, ResponseThread::run
+// and OutputDriver::update)
+// COMMENT-OUT for production builds
+// #define __FE_ALLOC_GUARD__
+
+namespace fastevent {
+    namespace rt {
+        /**
+        *   the scheduling policy of a thread; `Inherit` leaves it as it is.
+        */
+        enum Scheduling { Inherit, Other, FIFO, RR };
+
+        /**
+        *   the CPU set and the scheduling of a thread, as read from
+        *   an entry in `threads` of `service.cfg`, e.g.:
+        *
+        *   { "cpus": [2, 3], "policy": "fifo", "priority": 80 }
+        */
+        struct ThreadPolicy
+        {
+            /**
+            *   the CPUs that the thread may run on (empty to leave it as it is)
+            */
+            std::vector<int> cpus;
+            Scheduling       scheduling;
+            int              priority;
+
+            ThreadPolicy(): cpus(), scheduling(Inherit), priority(0) { }
+
+            bool is_default() const { return (cpus.size() == 0) && (scheduling == Inherit); }
+        };
+
+        /**
+        *   reads a ThreadPolicy from `cfg`.
+        */
+        ks::Result<ThreadPolicy> parse_policy(Config& cfg);
+
+        /**
+        *   checks in advance whether `policy` can be applied, i.e. whether
+        *   the CPUs exist and whether the process has the privilege for the
+        *   scheduling policy. the calling thread is left unchanged.
+        */
+        ks::Result<bool> check(const ThreadPolicy& policy);
+
+        /**
+        *   applies `policy` to the calling thread.
+        */
+        ks::Result<bool> apply(const ThreadPolicy& policy);
+
+        /**
+        *   to be called by each service thread when it starts:
+        *   applies `policy` to the calling thread (printing a warning about
+        *   `name` on failure), and prefaults its stack in the real-time mode.
+        */
+        void setup_thread(const ThreadPolicy& policy, const std::string& name);
+
+        /**
+        *   the size of the stack region prefaulted by setup_thread()
+        */
+        const size_t PREFAULT_STACK_SIZE = 256 * 1024;
+
+        /**
+        *   enables the real-time mode for the process:
+        *
+        *   1. locks all the current and future memory (mlockall), so that
+        *      the buffers allocated afterwards are faulted in on allocation.
+        *   2. holds /dev/cpu_dma_latency open at 0, keeping the CPUs out of
+        *      deep C-states as long as the process lives.
+        *   3. makes setup_thread() prefault the thread stacks.
+        *
+        *   fails if the memory cannot be locked. failing to set the DMA latency
+        *   only prints a warning.
+        */
+        ks::Result<bool> enable_realtime();
+
+        bool realtime_enabled();
+
+        /**
+        *   marks the scope as a part of the hot path, where heap allocations
+        *   and iostream usage are reported (only with __FE_ALLOC_GUARD__).
+        *   `name` must be a string literal.
+        */
+        class HotSection
+        {
+        public:
+#ifdef __FE_ALLOC_GUARD__
+            explicit HotSection(const char *name);
+            ~HotSection();
+        private:
+            const char *previous_;
+#else
+            explicit HotSection(const char *name) { }
+#endif
+        };
+
+        /**
+        *   the numbers of violations reported by the allocation guard
+        *   (always 0 without __FE_ALLOC_GUARD__)
+        */
+        uint64_t hot_allocations();
+        uint64_t hot_stream_writes();
+
+        /**
+        *   pins the calling thread to the specified set of CPUs.
+        */
+        ks::Result<bool> set_affinity(const std::vector<int>& cpus);
+    }
+}
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   scheduler.h -- the order in which the clients get to the driver
+*
+*   DriverThread takes the requests out of its input buffer as soon as
+*   they arrive, and queues them up per client (i.e. per session).
+*   the client queues are then served by deficit round robin: on each round,
+*   a client may pass as many requests to the driver as its weight,
+*   so that a client flooding the server only fills up (and overflows)
+*   its own queue, while the others wait for at most one round.
+*
+*   a client may also be rate-limited by a token bucket, in which case
+*   the requests beyond the rate are dropped as they arrive.
+*/
+
+#ifndef __FE_SCHEDULER_H__
+#define __FE_SCHEDULER_H__
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+#include "ks/utils.h"
+#include "config.h"
+
+namespace fastevent {
+
+    namespace network {
+        union Address;
+    }
+    struct Packet;
+    class SessionTable;
+
+    /**
+    *   when a request is acknowledged (or echoed back):
+    *
+    *   - AckOnCommit:  once the driver has processed it.
+    *   - AckOnReceive: as soon as the server has received it.
+    *   - NoAck:        never.
+    */
+    enum AckMode { AckOnCommit, AckOnReceive, NoAck };
+
+    /**
+    *   the share of the driver given to the matching clients,
+    *   as read from an entry in `clients` of `service.cfg`, e.g.:
+    *
+    *   { "match": "192.168.0.10", "weight": 4, "rate_hz": 1000, "burst": 16, "ack": "receive" }
+    *
+    *   `match` is one of:
+    *
+    *   - "host" or "host:port": a UDP client (an IPv4 address)
+    *   - "/path":               a `unix` datagram client bound to the path
+    *   - "seqpacket":           any `unix` connection
+    *   - "shm":                 any client of the shared-memory transport
+    *   - "*":                   any client
+    */
+    struct ClientClass
+    {
+        enum Kind { Any, Network, LocalPath, Connection, SharedMemory };
+
+        std::string match;
+        Kind        kind;
+        /**
+        *   (Network) the address and the port (0 for any), in the network byte order
+        */
+        uint32_t    host;
+        uint16_t    port;
+        /**
+        *   (LocalPath)
+        */
+        std::string path;
+
+        /**
+        *   the number of requests served per round
+        */
+        unsigned    weight;
+        /**
+        *   the maximal rate of the requests (0 for unlimited),
+        *   and the number of requests allowed in a burst
+        */
+        double      rate;
+        double      burst;
+        /**
+        *   when the requests are acknowledged (unless a request says otherwise)
+        */
+        AckMode     ack;
+
+        ClientClass(): match("*"), kind(Any), host(0), port(0), path(),
+                       weight(1), rate(0), burst(0), ack(AckOnCommit) { }
+
+        bool matches(const network::Address& address, const uint8_t& address_len) const;
+    };
+
+    /**
+    *   reads a ClientClass from `cfg`.
+    */
+    ks::Result<ClientClass> parse_client_class(Config& cfg);
+
+    /**
+    *   the client queues in front of the driver (DriverThread only).
+    *   no memory is allocated after construction.
+    */
+    class Scheduler
+    {
+    public:
+        static const double DEFAULT_BURST;
+
+        /**
+        *   `capacity` is the number of requests that can be queued in total,
+        *   and `client_depth` the number of requests of a single client.
+        *   the clients that match none of `classes` get the weight of 1, without a limit.
+        */
+        Scheduler(SessionTable *sessions, const std::vector<ClientClass>& classes,
+                  const size_t& capacity, const size_t& client_depth);
+        ~Scheduler();
+
+        /**
+        *   queues up a request that arrived (at `now` in nanoseconds, on any
+        *   monotonic clock). if it is beyond the rate of the client, or if
+        *   there is no room for it, its session is released as dropped,
+        *   and false is returned.
+        */
+        bool push(const Packet& packet, const uint64_t& now);
+
+        /**
+        *   takes out the next request to be served. returns false if there is none.
+        */
+        bool pop(Packet *packet);
+
+        /**
+        *   takes out the oldest request through `listener` (used to flush
+        *   the requests of a connection before it is closed).
+        *   returns false if there is none.
+        */
+        bool pop_listener(const uint8_t& listener, Packet *packet);
+
+        bool empty() const { return queued_ == 0; }
+
+        size_t size() const { return queued_; }
+
+        /**
+        *   the number of requests dropped because of the rate limits,
+        *   and because the client queue (or the whole scheduler) was full
+        */
+        uint64_t limited() const { return limited_.load(std::memory_order_relaxed); }
+        uint64_t overflow() const { return overflow_.load(std::memory_order_relaxed); }
+
+    private:
+        Scheduler(const Scheduler&);
+        Scheduler& operator=(const Scheduler&);
+
+        static const uint32_t NIL = 0xFFFFFFFF;
+
+        /**
+        *   (re-)reads the class of a session taken by a new client
+        */
+        void     assign(const uint16_t& handle, const uint64_t& now);
+
+        /**
+        *   removes the head of the queue of `handle`
+        */
+        void     take(const uint16_t& handle, Packet *packet);
+
+        /**
+        *   removes `handle` from the head of the round
+        */
+        void     retire_head();
+
+        SessionTable           *sessions_;
+        std::vector<ClientClass> classes_;
+        ClientClass             default_class_;
+        size_t                  client_depth_;
+
+        /**
+        *   the pool of queued requests, linked by `next_`
+        */
+        Packet                 *nodes_;
+        uint32_t               *next_;
+        uint32_t                free_;
+        size_t                  queued_;
+
+        /**
+        *   per session: the queue, the class, the deficit and the token bucket
+        */
+        size_t                  num_sessions_;
+        uint32_t               *head_;
+        uint32_t               *tail_;
+        uint32_t               *count_;
+        uint32_t               *generation_;
+        const ClientClass     **class_;
+        uint32_t               *deficit_;
+        bool                   *visited_;
+        double                 *tokens_;
+        uint64_t               *refilled_;
+
+        /**
+        *   the sessions with requests, in the order they are served
+        */
+        uint16_t               *round_;
+        size_t                  round_head_;
+        size_t                  round_size_;
+
+        std::atomic<uint64_t>   limited_;
+        std::atomic<uint64_t>   overflow_;
+    };
+}
+
+#endif
@@ -46,7 +46,7 @@ namespace fastevent
 
     namespace serial
     {
-        enum Status { Success, Closed, Error };
+        enum Status { Success, Closed, Error, Timeout };
 
         /**
         *   8-bit, no-parity, 1-stopbit
@@ -58,6 +58,12 @@ namespace fastevent
         */
         Status get(serial_t port, char* c);
 
+        /**
+        *   reads a byte from the serial port, waiting for it for at most `timeout_ms`
+        *   milliseconds. returns fastevent::serial::Status (Timeout if nothing arrived).
+        */
+        Status get(serial_t port, char* c, const int& timeout_ms);
+
         /**
         *   writes a character. returns fastevent::serial::Status.
         */
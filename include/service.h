@@ -22,11 +22,14 @@
 *   we have Service, DriverThread and ResponseThread that take care of the client requests.
 *
 *   1. Service receives requests and push it into the buffer shared with DriverThread.
+*      the buffers are bounded lock-free queues (see ring.h), so that a short burst
+*      of requests is queued up rather than overwritten.
 *   2. DriverThread reads requests from the buffer shared with Service.
 *   3. Based on the request, DriverThread transacts with the output driver.
 *   4. After transaction, DriverThread push the same command/state into the buffer
 *      shared with ResponseThread.
-*   5. ResponseThread sends the response (the same command) back to the client.
+*   5. ResponseThread sends the response (the same command) back to the client
+*      (or a single ack for all the commands of a version 2 request; see protocol.h).
 *
 *   If Service receives 'SHUTDOWN' command, it pushes the 'EOF' into the buffer,
 *   which then sequentially shuts down the other downstream threads.
@@ -46,152 +49,1104 @@
   #include <sys/socket.h>
   #include <sys/types.h>
   #include <netinet/in.h>
+  #include <sys/uio.h>
+  #include <sys/un.h>
 #endif
 
 #include <stdint.h>
+#include <atomic>
+#include <chrono>
 
 #include "ks/utils.h"
 #include "ks/thread.h"
+#include "ks/timing.h"
 #include "config.h"
 #include "driver.h"
+#include "protocol.h"
+#include "ring.h"
+#include "reactor.h"
+#include "wait.h"
+#include "rt.h"
+#include "shm.h"
+#include "uring.h"
+#include "scheduler.h"
+#include "timers.h"
+
+#include <vector>
+#include <string>
 
 namespace fastevent {
 
     /**
-    *   let `fastevent::socket_t` be the correct type for native sockets
+    *   maximal number of acceptable clients
     */
-#ifdef _WIN32
-    typedef SOCKET        socket_t;
-#else
-    typedef int           socket_t;
-#endif
+    const int CONN_MAX  = 8;
 
     /**
-    *   maximal number of acceptable clients
+    *   maximal number of listening sockets (over all the ports and receivers)
     */
-    const int CONN_MAX  = 8;
+    const int LISTEN_MAX = 64;
+
+    /**
+    *   the Packet::listener value for the requests through the shared memory
+    */
+    const int SHM_LISTENER = LISTEN_MAX + CONN_MAX;
+
+    /**
+    *   the number of client sessions per receiving thread (a power of two)
+    */
+    const int SESSION_SLOTS = 4 * CONN_MAX;
 
     /**
     *   utility functions/classes related to network management
     */
     namespace network {
         /**
-        *   a support class for managing network initialization and cleanup
-        */
-        class Manager
-        {
-        public:
-            Manager();
-            ~Manager();
-        };
-    }
+        *   a support class for managing network initialization and cleanup
+        */
+        class Manager
+        {
+        public:
+            Manager();
+            ~Manager();
+        };
+
+        /**
+        *   the address of a client: a UDP/IP one, or a Unix-domain one
+        *   (the latter is not available on Windows)
+        */
+        union Address
+        {
+            struct sockaddr     any;
+            struct sockaddr_in  in;
+#ifndef _WIN32
+            struct sockaddr_un  un;
+            /**
+            *   a client of the shared-memory transport (with AF_UNSPEC)
+            */
+            struct {
+                sa_family_t     family;
+                uint16_t        index;
+                uint32_t        owner;
+            }                   channel;
+#endif
+        };
+
+        /**
+        *   a human-readable form of a client address (`len` being 0
+        *   for a connection, whose peer is not known by its address)
+        */
+        std::string describe(const Address& address, const uint8_t& len);
+    }
+
+    struct Packet;
+    class SessionTable;
+
+    /**
+     * the wall-clock time in nanoseconds since the epoch,
+     * i.e. on the same clock as the kernel receive timestamps.
+     */
+    inline uint64_t wallclock_ns()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    /**
+     * the wrapper for a listening socket.
+     *
+     * the receive path and the send path have their own descriptors
+     * (the send one being a duplicate of the listening socket, so that
+     * the responses leave from the port the requests arrived at) and
+     * their own scratch space, and take no locks. one thread may receive
+     * while another sends, but each path must only be used by one thread at a time.
+     */
+    class Socket
+    {
+    public:
+        /**
+         * where the arrival time of a datagram (Packet::arrival) comes from:
+         *
+         * - NoTimestamp:       nowhere (left 0).
+         * - UserTimestamp:     the user space, right after the datagram is received.
+         * - KernelTimestamp:   the kernel, through SO_TIMESTAMPNS.
+         * - SoftwareTimestamp: the kernel, through the software receive timestamp
+         *                      of SO_TIMESTAMPING.
+         *
+         * the kernel timestamps are only available on Linux, and have to be
+         * enabled on the socket beforehand (see Service::bind()).
+         */
+        enum Timestamping { NoTimestamp, UserTimestamp, KernelTimestamp, SoftwareTimestamp };
+
+        /**
+         * what the socket is:
+         *
+         * - Network:         a UDP socket.
+         * - LocalDatagram:   an AF_UNIX SOCK_DGRAM socket.
+         * - LocalConnection: an accepted AF_UNIX SOCK_SEQPACKET connection
+         *                    (the responses need no address).
+         *
+         * sending to a local client that has gone away (or whose queue is full)
+         * only drops the response, rather than failing.
+         */
+        enum Transport { Network, LocalDatagram, LocalConnection };
+
+        /**
+         * `recv_batch` is the maximal number of datagrams that
+         * a single call to recv_batch() may return, and `send_batch`
+         * is the maximal number of datagrams that send_batch() sends
+         * in a single system call.
+         */
+        explicit Socket(const socket_t& sock,
+                        const size_t& recv_batch=1,
+                        const size_t& send_batch=1,
+                        const Timestamping& timestamping=NoTimestamp,
+                        const Transport& transport=Network);
+        ~Socket();
+
+        /**
+         * (receive path)
+         */
+        int recv(char *buf, const int& len,
+                    network::Address* sender, uint8_t* sender_len);
+
+        /**
+         * (send path)
+         */
+        int send(const char *buf, const int& len,
+                    const network::Address* client, const uint8_t& client_len);
+
+        /**
+         * (receive path) receives up to `batch` datagrams without blocking,
+         * using a single recvmmsg(2) call where it is available.
+         * their arrival times are stamped according to the Timestamping,
+         * and the address of the sender of the i-th packet is left in sender(i).
+         *
+         * the datagrams are decoded into the packets as either a legacy request
+         * or a version 2 one (see protocol.h); the malformed ones
+         * (e.g. shorter than protocol::MSG_SIZE) are discarded.
+         * returns the number of packets filled in, or SOCKET_ERROR.
+         */
+        int recv_batch(Packet *packets);
+
+        /**
+         * (receive path) the sender of the i-th packet of the last recv_batch(),
+         * and the length of its address (0 for a LocalConnection)
+         */
+        const network::Address& sender(const size_t& i) const { return recv_names_[i]; }
+        uint8_t sender_len(const size_t& i) const { return recv_name_lens_[i]; }
+
+        /**
+         * (send path) sends `n` packets back to their clients (as found in `sessions`),
+         * using sendmmsg(2) where it is available. blocks until all of them are sent.
+         * a version 2 request is answered by a single ack.
+         *
+         * returns the number of packets sent, or SOCKET_ERROR.
+         */
+        int send_batch(const Packet *packets, const size_t& n, const SessionTable& sessions);
+
+        /**
+         * (Network only; Linux only) moves both paths onto io_uring(7):
+         * the datagrams are received by a multishot recvmsg into buffers
+         * provided to the kernel, and the responses are sent asynchronously,
+         * a single submission per send_batch(). the rings share the SQPOLL
+         * thread of `share` (if any).
+         *
+         * once it succeeds, poll_descriptor() (rather than the socket)
+         * becomes readable when there are datagrams to receive.
+         */
+        ks::Result<bool> use_uring(const UringOptions& options, const Uring *share=0);
+
+        /**
+         * the ring of the receive path (NULL unless use_uring() succeeded)
+         */
+        const Uring *uring() const { return recv_ring_; }
+
+        socket_t descriptor() const { return socket_; }
+
+        /**
+         * the descriptor to watch for the incoming datagrams
+         */
+        socket_t poll_descriptor() const;
+
+        size_t recv_batch_size() const { return recv_batch_; }
+
+        Transport transport() const { return transport_; }
+
+        /**
+         * (receive path) whether or not the peer of a LocalConnection
+         * has closed the connection
+         */
+        bool hung_up() const { return hung_up_; }
+
+        /**
+         * (receive path) closes the receiving side only. the send path
+         * keeps working (and keeps the connection open) until release().
+         */
+        void close_receive();
+
+        /**
+         * (send path) closes the sending side, after which the socket
+         * may be deleted by the receiving thread.
+         */
+        void release();
+
+        bool released() const { return released_.load(std::memory_order_acquire); }
+
+        /**
+         * the number of responses dropped because their clients could not be reached
+         */
+        uint64_t unsent() const { return unsent_.load(std::memory_order_relaxed); }
+
+        void close();
+    private:
+        /**
+         * how often (at most) an unreachable client is reported
+         */
+        static const uint64_t UNSENT_LOG_INTERVAL_NS = 1000000000ULL;
+
+        /**
+         * (send path) whether the last send failed because of its client only,
+         * in which case the response is counted as unsent (and is to be dropped)
+         */
+        bool skip_unsendable();
+
+        /**
+         * fills in Packet::arrival/received of `n` packets
+         * (Packet::arrival from the kernel, if any).
+         */
+        void stamp(Packet *packets, const size_t& n);
+
+        /**
+         * the io_uring counterparts of recv_batch()/send_batch()
+         */
+        int  recv_uring(Packet *packets);
+        int  send_uring(const Packet *packets, const size_t& n, const SessionTable& sessions);
+
+        /**
+         * (receive path) (re-)submits the multishot receive
+         */
+        bool arm_uring();
+
+        /**
+         * (send path) collects the completed sends
+         */
+        void reap_sends();
+
+        void drop_uring();
+
+        socket_t    socket_;
+        /**
+         * the descriptor for the send path
+         * (the same as `socket_` where it cannot be duplicated)
+         */
+        socket_t    send_socket_;
+        size_t      recv_batch_;
+        size_t      send_batch_;
+        Timestamping timestamping_;
+        Transport   transport_;
+        bool        hung_up_;
+        std::atomic<bool> released_;
+        std::atomic<uint64_t> unsent_;
+        uint64_t    unsent_logged_;
+
+        /**
+         * the senders of the packets of the last recv_batch()
+         */
+        network::Address *recv_names_;
+        uint8_t          *recv_name_lens_;
+
+#ifdef __linux__
+        /**
+         * scratch space for recvmmsg(2) and sendmmsg(2)
+         * (and for the control messages carrying the timestamps)
+         */
+        struct mmsghdr  *recv_msgs_;
+        struct iovec    *recv_iovs_;
+        char            *recv_ctrl_;
+        struct mmsghdr  *send_msgs_;
+        struct iovec    *send_iovs_;
+#endif
+        /**
+         * the datagrams of the last recv_batch() before they are decoded,
+         * and the responses being sent (Service::MAX_MSG_SIZE bytes each)
+         */
+        char            *recv_bufs_;
+        char            *send_bufs_;
+
+        Uring          *recv_ring_;
+        Uring          *send_ring_;
+#ifdef __linux__
+        /**
+         * the header of the multishot receive (only the sizes of
+         * the address and of the control messages are used)
+         */
+        struct msghdr   recv_template_;
+
+        /**
+         * a response in flight, which has to outlive send_uring()
+         */
+        struct SendSlot
+        {
+            struct msghdr       hdr;
+            struct iovec        iov;
+            network::Address    client;
+            char                payload[protocol::V2_RESPONSE_MAX];
+        };
+        SendSlot       *send_slots_;
+        unsigned       *free_slots_;
+        unsigned        num_slots_;
+        unsigned        num_free_;
+        /**
+         * the first error of the sends completed since the last send_batch()
+         */
+        int             send_error_;
+#endif
+    };
+
+    /**
+     * a command packet, as it is passed between threads
+     */
+    struct Packet
+    {
+        /**
+         * the client, as a handle to the SessionTable
+         * (SessionTable::NO_SESSION for the packets without a command)
+         */
+        uint16_t            session;
+        /**
+         * the container for the command packet. for a version 2 request,
+         * the index byte is the lower byte of the last sequence number,
+         * and the status byte is the last command.
+         */
+        char                payload[protocol::MSG_SIZE];
+        /**
+         * (version 2) the number of commands (0 for a legacy request),
+         * the sequence number of the first one, and the commands
+         */
+        uint8_t             count;
+        uint16_t            sequence;
+        char                commands[protocol::V2_COMMANDS_MAX];
+        /**
+         * (version 2) the flags of the request, and then of the ack
+         */
+        uint8_t             flags;
+        /**
+         * (version 2, with protocol::V2_FLAG_SCHEDULED) when the commands
+         * are to be issued, and when they were issued, in nanoseconds on monotonic_ns()
+         */
+        uint64_t            target;
+        uint64_t            issued;
+        /**
+         * when the request is acknowledged (an AckMode, as decided on receipt)
+         */
+        uint8_t             ack;
+        /**
+         * when the request was passed on by the receiving thread, in nanoseconds
+         * on monotonic_ns(), and (version 2, with protocol::V2_FLAG_MAX_AGE)
+         * its maximal age in microseconds
+         */
+        uint64_t            stamped;
+        uint32_t            max_age;
+        /**
+         * the index of the listening socket that received the packet
+         * (and therefore the one to send the response with)
+         */
+        uint8_t             listener;
+        /**
+         * whether or not this packet marks the EOF
+         */
+        bool                is_eof;
+        /**
+         * whether or not this packet marks the end of a LocalConnection
+         * (the listener). it carries no command, and makes ResponseThread
+         * release the socket once the responses before it have been sent.
+         */
+        bool                is_close;
+        /**
+         * when the datagram arrived, in nanoseconds on wallclock_ns():
+         * the kernel receive timestamp where it is enabled, or the time
+         * Socket::recv_batch() received it otherwise. 0 if it is not stamped.
+         */
+        uint64_t            arrival;
+        /**
+         * when Socket::recv_batch() received the datagram (0 if not stamped)
+         */
+        uint64_t            received;
+    };
+
+    /**
+     * the clients known to the server, i.e. the (listener, address) pairs
+     * the requests have come from, in a fixed-size open-addressing table.
+     *
+     * the table is split into partitions, one for each receiving thread
+     * (i.e. each lane of the DriverThread input), and only that thread opens
+     * sessions in its partition. the others only look the sessions up
+     * by the handle carried by the packets, or update their counters.
+     *
+     * a session is only evicted (to make room for a new client) once none of
+     * its packets is in the pipeline, so that the handles stay valid until the
+     * responses have been sent.
+     */
+    class SessionTable
+    {
+    public:
+        static const uint16_t NO_SESSION = 0xFFFF;
+
+        /**
+         * the counters of a client, as returned by snapshot()
+         */
+        struct Stats
+        {
+            std::string client;
+            uint8_t     listener;
+            /**
+             * the number of requests, the ones dropped because the pipeline
+             * was full, the ones whose index byte repeated a recent one,
+             * and the ones that came after a request with a later index byte
+             */
+            uint64_t    packets;
+            uint64_t    drops;
+            uint64_t    duplicates;
+            uint64_t    reordered;
+            /**
+             * the time (in nanoseconds) from the arrival of the last request
+             * to when its response was sent (0 if the requests are not timestamped)
+             */
+            uint64_t    last_rtt;
+        };
+
+        explicit SessionTable(const size_t& partitions);
+        ~SessionTable();
+
+        /**
+         * the new clients take the AckMode of the first of `classes` that they
+         * match (AckOnCommit if none). to be called before the receiving threads start.
+         */
+        void set_classes(const std::vector<ClientClass>& classes) { classes_ = classes; }
+
+        /**
+         * (receiving thread of `partition`) finds the session of the client,
+         * opening one if it is new, and accounts for a request with `index`
+         * (the protocol::INDEX_BYTE) in it.
+         *
+         * returns NO_SESSION if the partition is full of clients with
+         * requests in the pipeline.
+         */
+        uint16_t open(const size_t& partition, const uint8_t& listener,
+                      const network::Address& address, const uint8_t& address_len,
+                      const uint8_t& index);
+
+        /**
+         * (receiving thread of `partition`) makes the next open() with
+         * the same client start a new session (e.g. when a connection
+         * slot has been taken over by another client).
+         */
+        void retire(const size_t& partition, const uint8_t& listener,
+                    const network::Address& address, const uint8_t& address_len);
+
+        const network::Address& address(const uint16_t& handle) const { return slots_[handle].address; }
+        uint8_t address_len(const uint16_t& handle) const { return slots_[handle].address_len; }
+
+        /**
+         * (receiving thread of the partition) when the requests of the client are acknowledged
+         */
+        AckMode ack(const uint16_t& handle) const { return slots_[handle].ack; }
+
+        /**
+         * (receiving thread of the partition) one more response is in the pipeline
+         * for a request (i.e. the acknowledgement on receive, besides the request)
+         */
+        void hold(const uint16_t& handle) { slots_[handle].in_flight.fetch_add(1, std::memory_order_relaxed); }
+
+        /**
+         * incremented each time the slot of `handle` is taken by a new client
+         */
+        uint32_t generation(const uint16_t& handle) const { return slots_[handle].generation; }
+
+        /**
+         * the number of handles
+         */
+        size_t size() const { return partitions_ * SESSION_SLOTS; }
+
+        /**
+         * the request has left the pipeline without a response
+         * (`dropped` if it did not fit in it).
+         */
+        void release(const uint16_t& handle, const bool& dropped=false);
+
+        /**
+         * (ResponseThread) the response to a request has been sent.
+         */
+        void complete(const uint16_t& handle, const uint64_t& rtt);
+
+        /**
+         * the number of requests refused because of the lack of room
+         */
+        uint64_t exhausted() const { return exhausted_.load(std::memory_order_relaxed); }
+
+        /**
+         * the counters of the open sessions. it allocates, and must only be
+         * called while the receiving threads are not running.
+         */
+        std::vector<Stats> snapshot() const;
+
+    private:
+        SessionTable(const SessionTable&);
+        SessionTable& operator=(const SessionTable&);
+
+        /**
+         * Retired sessions keep their counters (until they are evicted),
+         * but no longer match their clients
+         */
+        enum State { Empty, Active, Retired };
+
+        struct Slot
+        {
+            // written by the receiving thread only
+            State               state;
+            uint8_t             listener;
+            uint8_t             address_len;
+            network::Address    address;
+            uint32_t            generation;
+            AckMode             ack;
+            uint64_t            last_seen;
+            bool                has_index;
+            uint8_t             last_index;
+            uint64_t            window;
+
+            std::atomic<uint32_t>   in_flight;
+            std::atomic<uint64_t>   packets;
+            std::atomic<uint64_t>   drops;
+            std::atomic<uint64_t>   duplicates;
+            std::atomic<uint64_t>   reordered;
+            std::atomic<uint64_t>   last_rtt;
+        };
+
+        /**
+         * the slot of the client in `partition`, or -1
+         */
+        int  find(const size_t& partition, const uint8_t& listener,
+                  const network::Address& address, const uint8_t& address_len) const;
+
+        /**
+         * updates the duplicate/reordering counters with a new index byte
+         */
+        void track(Slot& slot, const uint8_t& index);
+
+        size_t                  partitions_;
+        std::vector<ClientClass> classes_;
+        Slot                   *slots_;
+        uint64_t               *ticks_;
+        std::atomic<uint64_t>   exhausted_;
+    };
+
+    /**
+     * the latency statistics of a pipeline stage, i.e. how long it took
+     * since Packet::arrival for the packets to pass the stage.
+     * it is updated by a single thread, and may be read by the others.
+     */
+    class Latency
+    {
+    public:
+        Latency(): count_(0), total_(0), max_(0) { }
+
+        /**
+         * (the stage thread only) adds a packet that arrived at `arrival`,
+         * and passed the stage at `now`. unstamped packets are ignored.
+         */
+        void add(const uint64_t& arrival, const uint64_t& now)
+        {
+            if ((arrival == 0) || (now < arrival)) {
+                return;
+            }
+            const uint64_t elapsed = now - arrival;
+            count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            total_.store(total_.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+            if (elapsed > max_.load(std::memory_order_relaxed)) {
+                max_.store(elapsed, std::memory_order_relaxed);
+            }
+        }
+
+        uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+        /**
+         * the mean/maximal latency in microseconds (0 if no packets have passed)
+         */
+        double   mean_us() const
+        {
+            const uint64_t n = count();
+            return (n == 0)? 0.0 : (total_.load(std::memory_order_relaxed) / 1000.0 / n);
+        }
+        double   max_us() const { return max_.load(std::memory_order_relaxed) / 1000.0; }
+
+    private:
+        std::atomic<uint64_t>   count_;
+        std::atomic<uint64_t>   total_;
+        std::atomic<uint64_t>   max_;
+    };
+
+    /**
+     * the buffer structure for communication with threads.
+     *
+     * it is a set of bounded single-producer/single-consumer queues ("lanes")
+     * of packets, one for each writer thread. the reader visits the lanes
+     * in a round-robin manner, so that the order of packets is kept within
+     * each lane (but not across lanes). the buffer reaches its EOF when all
+     * the lanes have received the EOF.
+     *
+     * how the reader waits for the writers is up to the Waiter::Strategy
+     * of the buffer (see wait.h).
+     */
+    class IOBuffer
+    {
+    public:
+        static const size_t DEFAULT_DEPTH = 64;
+
+        explicit IOBuffer(const size_t& depth=DEFAULT_DEPTH, const size_t& lanes=1,
+                          const Waiter::Strategy& strategy=Waiter::Hybrid);
+        ~IOBuffer();
+
+        /**
+         * wait for the update, read into `packet`
+         *
+         * returns false if the buffer is at EOF (i.e. the read process failed).
+         * returns true otherwise.
+         */
+        bool read(Packet* packet);
+
+        /**
+         * reads up to `max` packets that are already in the buffer,
+         * without waiting. stops before the EOF, if any.
+         *
+         * returns the number of packets read.
+         */
+        size_t read_available(Packet* packets, const size_t& max);
+
+        /**
+         * whether or not the reader has hit the EOF
+         */
+        bool eof() const { return is_eof_; }
+
+        /**
+         * waits until there is a packet to read, or until `deadline`
+         * (on monotonic_ns()), or until signal() is called.
+         * returns false at the deadline.
+         */
+        bool wait_until(const uint64_t& deadline);
+
+        /**
+         * wakes up the reader from wait_until() without a packet
+         * (e.g. for the completions of an asynchronous driver)
+         */
+        void signal();
+
+        /**
+         * write into the `lane`, flag update
+         *
+         * returns false if the lane is full. the packet is dropped
+         * in that case, and is counted as an overflow.
+         */
+        bool write(const Packet& packet, const size_t& lane=0);
+
+        /**
+         * same as write(), except that a packet that does not fit
+         * is not counted as an overflow (the writer takes care of it).
+         */
+        bool try_write(const Packet& packet, const size_t& lane=0);
+
+        /**
+         * writes `n` packets into the `lane`, and makes them visible to the reader at once.
+         * the packets that do not fit are dropped and counted as overflow.
+         *
+         * returns the number of packets actually written.
+         */
+        size_t write_batch(const Packet *packets, const size_t& n, const size_t& lane=0);
+
+        /**
+         * write the EOF into the `lane`. unlike write(), it waits until
+         * there is a room in the lane, so that the EOF never gets lost.
+         */
+        void write_eof(const size_t& lane=0);
+
+        /**
+         * writes `packet` into the `lane`, waiting until there is a room
+         * (used for the packets that must not get lost, e.g. Packet::is_close).
+         */
+        void write_wait(const Packet& packet, const size_t& lane=0);
+
+        /**
+         * the number of packets dropped because the buffer was full
+         */
+        uint64_t overflow() const { return overflow_.load(std::memory_order_relaxed); }
+
+        size_t   depth() const { return lanes_[0]->capacity(); }
+
+        size_t   lanes() const { return num_lanes_; }
+
+        Waiter::Strategy strategy() const { return waiter_.strategy(); }
+
+    private:
+        enum PopStatus { Popped, Empty, AtEOF };
+
+        /**
+         * (reader only) pops a packet from any of the lanes.
+         */
+        PopStatus pop(Packet* packet);
+
+        /**
+         * whether or not all the lanes are empty
+         */
+        bool empty() const;
+
+        void wait();
+
+        Ring<Packet>          **lanes_;
+        size_t                  num_lanes_;
+
+        /**
+         * (reader only) the lane to be visited first by the next pop(),
+         * the lanes that have received the EOF, and the number of the others
+         */
+        size_t                  next_lane_;
+        bool                   *lane_eof_;
+        size_t                  open_lanes_;
+
+        /**
+         * whether or not the reader has hit the EOF
+         */
+        bool                    is_eof_;
+
+        std::atomic<uint64_t>   overflow_;
+
+        /**
+         * set by signal(), until the reader wakes up
+         */
+        std::atomic<bool>       signalled_;
+
+        /**
+         * the object that makes the reader wait for packet update
+         */
+        Waiter                  waiter_;
+    };
+
+    /**
+     * the completions reported by an asynchronous driver (the producer,
+     * from any single thread of it) to DriverThread (the consumer),
+     * which is woken up through its input-side buffer.
+     * no memory is allocated after construction.
+     */
+    class CompletionQueue: public Completion
+    {
+    public:
+        /**
+         * `depth` must be at least the number of submissions that may be outstanding
+         */
+        CompletionQueue(const size_t& depth, IOBuffer *wakeup): ring_(depth), wakeup_(wakeup), waiter_() { }
+
+        void completed(const uint64_t& tag, const bool& ok);
+
+        /**
+         * (DriverThread only) takes out a completion. returns false if there is none.
+         */
+        bool pop(uint64_t *tag, bool *ok);
+
+        /**
+         * (DriverThread only) waits until there is a completion, or until `deadline`
+         * (on monotonic_ns()). returns false at the deadline.
+         */
+        bool wait_until(const uint64_t& deadline);
+
+    private:
+        struct Entry
+        {
+            uint64_t    tag;
+            bool        ok;
+        };
+
+        Ring<Entry>     ring_;
+        IOBuffer       *wakeup_;
+        Waiter          waiter_;
+    };
+
+    /**
+     * the settings of the coalescing in DriverThread ("coalesce")
+     *
+     * when the driver falls behind, and more than one request is waiting
+     * for it, only the state that the last of them results in is passed
+     * to the driver. an output bit that is raised and cleared again within
+     * the requests is either dropped (Fold), or still raised for at least
+     * an update plus `pulse` nanoseconds before the final state (Pulse).
+     * only the version 2 requests are coalesced: a legacy request is always
+     * passed on its own, since its echo cannot be marked as coalesced.
+     */
+    struct CoalesceOptions
+    {
+        enum Policy { Fold, Pulse };
+
+        bool        enabled;
+        /**
+         * the policies for the event bit (MASK_EVENT) and the sync bit (MASK_SYNC)
+         */
+        Policy      event;
+        Policy      sync;
+        uint64_t    pulse;
+
+        CoalesceOptions(): enabled(false), event(Pulse), sync(Fold), pulse(0) { }
+
+        /**
+         * the command bits with the Pulse policy
+         */
+        char pulse_mask() const
+        {
+            return static_cast<char>(((event == Pulse)? MASK_EVENT : 0) | ((sync == Pulse)? MASK_SYNC : 0));
+        }
+    };
+
+    /**
+     * a thread class that handles communication with the driver
+     *
+     * with a Scheduler, the requests are taken out of the input-side buffer
+     * as soon as they arrive, and are passed to the driver in the order
+     * the scheduler decides (see scheduler.h). without one, they are passed
+     * in the order they are read.
+     *
+     * the requests with a target time in the future wait in a TimerQueue
+     * (see timers.h) before they are passed to the driver.
+     *
+     * the requests older than their maximal age (see set_max_age()) are not
+     * passed to the driver, but responded to as expired.
+     *
+     * with CoalesceOptions::enabled, the requests waiting in the scheduler
+     * are passed to the driver together, as a single state (see CoalesceOptions).
+     * the responses to all but the last of them are marked as coalesced.
+     */
+    class DriverThread: public ks::Thread
+    {
+    public:
+        /**
+         * how long (in nanoseconds) an asynchronous driver may take for a request,
+         * before it is given up on
+         */
+        static const uint64_t ASYNC_TIMEOUT_NS = 1000000000;
+
+        /**
+         * `lanes` is the number of threads that write into the input-side buffer.
+         * the output-side buffer has a lane for the thread itself (0), and one
+         * for each of the writers of the input side (1 + their lanes), through which
+         * they pass the acknowledgements on receive straight to ResponseThread.
+         */
+        DriverThread(OutputDriver* driver,
+                     const size_t& depth=IOBuffer::DEFAULT_DEPTH,
+                     const size_t& lanes=1,
+                     const Waiter::Strategy& input_wait=Waiter::Hybrid,
+                     const Waiter::Strategy& output_wait=Waiter::Hybrid):
+            ks::Thread(), driver_(driver), loop_(driver->command_loop()),
+            input_(depth, lanes, input_wait), output_(depth, 1 + lanes, output_wait),
+            intake_(new Packet[depth]), run_(new Packet[depth]), intake_size_(depth), sessions_(0), scheduler_(0),
+            timers_(new TimerQueue(TimerOptions::DEFAULT_DEPTH)), update_ns_(0),
+            timer_overflow_(0), timer_cancelled_(0), late_(0), state_(0), coalesced_(0), pulses_(0),
+            max_age_(0), expired_(0), async_depth_(driver->async_depth()), completions_(0),
+            pending_(0), pending_status_(0), submitted_(0), retired_(0), progress_(0), failed_(0)
+        {
+            setup_async();
+        }
+
+        ~DriverThread()
+        {
+            delete[] intake_; delete[] run_; delete timers_;
+            delete completions_; delete[] pending_; delete[] pending_status_;
+        }
+
+        /**
+         * returns its input-side IO buffer
+         */
+        IOBuffer *getInputBufferRef();
+
+        /**
+         * returns its output-side IO buffer
+         */
+        IOBuffer *getOutputBufferRef();
+
+        /**
+         * the CPU set/scheduling that the thread applies to itself on start
+         */
+        void set_policy(const rt::ThreadPolicy& policy) { policy_ = policy; }
+
+        /**
+         * the sessions of the packets dropped on the output side are released in `sessions`
+         */
+        void set_sessions(SessionTable *sessions) { sessions_ = sessions; }
+
+        /**
+         * the requests are queued up per client in `scheduler` (if any)
+         */
+        void set_scheduler(Scheduler *scheduler) { scheduler_ = scheduler; }
+
+        /**
+         * the settings of the TimerQueue (to be called before start())
+         */
+        void set_timers(const TimerOptions& options);
+
+        /**
+         * the settings of the coalescing (to be called before start())
+         */
+        void set_coalesce(const CoalesceOptions& options) { coalesce_options_ = options; }
+
+        /**
+         * the maximal age (in nanoseconds; 0 for no limit) of the requests
+         * that do not carry their own, counting from when they were received
+         * (or from their target times, if scheduled) to when they would be
+         * passed to the driver
+         */
+        void set_max_age(const uint64_t& max_age) { max_age_ = max_age; }
+
+        /**
+         * the number of requests dropped for being older than their maximal age
+         */
+        uint64_t expired() const { return expired_.load(std::memory_order_relaxed); }
+
+        /**
+         * how early (in nanoseconds) the scheduled commands are issued
+         */
+        uint64_t lead() const;
+
+        /**
+         * the latency from the arrival of the packets to when Socket::recv_batch()
+         * got them (i.e. the delay in the kernel), and to when the driver
+         * has processed them
+         */
+        const Latency& receive_latency() const { return receive_latency_; }
+        const Latency& driver_latency() const { return driver_latency_; }
+
+        /**
+         * how late the scheduled commands were issued, relative to
+         * their target times less the lead (counting from when they
+         * were meant to be issued)
+         */
+        const Latency& release_latency() const { return release_latency_; }
 
-    namespace protocol {
-        const int       MSG_SIZE     = 2;
-        const uint8_t   INDEX_BYTE   = 0;
-        const uint8_t   STATUS_BYTE  = 1;
-    }
+        void run();
 
-    /**
-     * the thread-safe wrapper for a socket.
-     */
-    class Socket
-    {
-    public:
-        explicit Socket(const socket_t& sock);
-        ~Socket();
+        /**
+         * (the inline pipeline, instead of run()) passes a request to the driver
+         * in the calling thread, unless it has expired. the scheduled ones are
+         * issued right away. returns true if it is to be responded to now
+         * (i.e. it is acknowledged on commit).
+         */
+        bool commit(Packet& packet);
 
-        int recv(char *buf, const int& len,
-                    struct sockaddr_in* sender);
-        int send(const char *buf, const int& len,
-                    struct sockaddr_in* client);
+        /**
+         * shuts down the driver (at the end of run(), or by the caller of commit())
+         */
+        void shutdown();
 
-        void close();
     private:
-        socket_t    socket_;
-        ks::Mutex   lock_;
-    };
+        /**
+         * takes in a request from the input-side buffer
+         */
+        void admit(Packet& packet);
 
-    /**
-     * the buffer structure for communication with threads
-     */
-    class IOBuffer
-    {
-    public:
-        IOBuffer();
-        ~IOBuffer();
+        /**
+         * passes a request to the driver, or to the TimerQueue
+         * if it is to be issued later
+         */
+        void process(Packet& packet);
 
         /**
-         * wait for the update, read into buffer
-         *
-         * returns false if the buffer is at EOF (i.e. the read process failed).
-         * returns true otherwise.
+         * passes a request (all the commands of it) to the driver,
+         * and then to the output-side buffer
          */
-        bool read(struct sockaddr_in* client, char *buffer);
+        void issue(Packet& packet);
 
         /**
-         * write into buffer, flag update
+         * passes the requests waiting in the scheduler to the driver
+         * as a single state (see CoalesceOptions)
          */
-        void write(const struct sockaddr_in* client,
-                   const char *buffer,
-                   const bool& is_eof=false);
+        void coalesce();
 
-        void write_eof() { write(0, 0, true); }
+        /**
+         * (coalesce()) passes the first `count` requests of `run_` as a single state
+         */
+        void fold(const size_t& count);
 
-    private:
         /**
-         * the client socket info
+         * if `packet` is older than its maximal age, marks it as expired
+         * (rather than to be passed to the driver), and returns true.
+         * an expired legacy request is not echoed (as with NoAck).
          */
-        struct sockaddr_in  client_;
+        bool expire(Packet& packet);
+
         /**
-         * the container for the command packet
+         * passes a request that has been through the driver to the output-side buffer
+         * (unless it has been acknowledged on receipt, or is not to be acknowledged)
          */
-        char                packet_[protocol::MSG_SIZE];
+        void complete(Packet& packet);
+
         /**
-         * whether or not the buffer is at the eof
+         * (an asynchronous driver) sets up the completions (in the constructor)
          */
-        bool                is_eof_;
+        void setup_async();
 
         /**
-         * the event flag object that monitors packet update
-         * including its associated mutex object
+         * (an asynchronous driver) submits a request to the driver, after waiting
+         * for a room among the outstanding ones. it is completed in reap().
          */
-        ks::Flag            update_;
-    };
+        void submit(Packet& packet);
 
-    /**
-     * a thread class that handles communication with the driver
-     */
-    class DriverThread: public ks::Thread
-    {
-    public:
-        DriverThread(OutputDriver* driver):
-            ks::Thread(), driver_(driver), input_(), output_() { }
+        /**
+         * (an asynchronous driver) takes in the completions, and completes
+         * the requests in the order of submission. with `wait`, waits (up to
+         * `timeout` nanoseconds) for at least one request to be completed.
+         * returns the number of the requests completed.
+         */
+        size_t reap(const bool& wait=false, const uint64_t& timeout=0);
 
-        ~DriverThread() { }
+        /**
+         * (an asynchronous driver) waits until at most `limit` requests are outstanding,
+         * giving up on the oldest one each time the driver takes ASYNC_TIMEOUT_NS
+         * without completing any.
+         */
+        void wait_outstanding(const size_t& limit);
 
         /**
-         * returns its input-side IO buffer
+         * updates the mean time per command from `passed` commands, since `start`
          */
-        IOBuffer *getInputBufferRef();
+        void account(const uint64_t& start, const size_t& passed);
 
         /**
-         * returns its output-side IO buffer
+         * issues the scheduled requests that are due (spinning for the
+         * ones that are due within TimerOptions::spin). returns the time
+         * when the next one is to be issued, or 0 if there is none.
          */
-        IOBuffer *getOutputBufferRef();
+        uint64_t release();
 
-        void run();
+        /**
+         * drops all the scheduled requests (on shutdown)
+         */
+        void cancel_timers();
 
-    private:
         /**
-         * shuts down the driver
+         * passes all the commands of a request to the driver
          */
-        void shutdown();
+        void execute(const Packet& packet);
+
+        /**
+         * sets the driver to `state` (a command without the newlines)
+         */
+        void update(const char& state);
+
+        /**
+         * passes `count` commands (skipping the newlines) to the driver
+         * through the command loop for its type
+         */
+        void update(const char *commands, const size_t& count);
 
         /**
         *   the output generator driver to be used
         */
         OutputDriver *driver_;
+        CommandLoop   loop_;
 
         /**
          * IO buffers for communication between I/O threads
@@ -199,36 +1154,309 @@ namespace fastevent {
         IOBuffer      input_;
         IOBuffer      output_;
 
-        struct sockaddr_in  client_;
-        char                buffer_[protocol::MSG_SIZE];
+        Packet        packet_;
+
+        /**
+         * the requests taken in at once
+         */
+        Packet       *intake_;
+        /**
+         * the requests being coalesced
+         */
+        Packet       *run_;
+        size_t        intake_size_;
+        ks::nanostamp clock_;
+
+        rt::ThreadPolicy policy_;
+
+        Latency       receive_latency_;
+        Latency       driver_latency_;
+
+        SessionTable *sessions_;
+        Scheduler    *scheduler_;
+
+        TimerQueue   *timers_;
+        TimerOptions  timer_options_;
+        /**
+         * the mean time (in nanoseconds) that driver_->update() takes
+         */
+        std::atomic<uint64_t> update_ns_;
+        Latency       release_latency_;
+        uint64_t      timer_overflow_;
+        uint64_t      timer_cancelled_;
+        uint64_t      late_;
+
+        CoalesceOptions coalesce_options_;
+        /**
+         * the last command passed to the driver
+         */
+        char          state_;
+        /**
+         * the number of requests folded into the later ones,
+         * and the number of pulses kept in doing so
+         */
+        uint64_t      coalesced_;
+        uint64_t      pulses_;
+
+        uint64_t      max_age_;
+        std::atomic<uint64_t> expired_;
+
+        /**
+         * (an asynchronous driver) the maximal number of outstanding submissions
+         * (0 for a synchronous driver), the completions of them, and the requests
+         * submitted (in a ring indexed by the tag) with their status:
+         * tags from `retired_` up to `submitted_` are still in the ring.
+         */
+        enum Submission { Outstanding, Completed, Failed };
+
+        size_t        async_depth_;
+        CompletionQueue *completions_;
+        Packet       *pending_;
+        char         *pending_status_;
+        size_t        pending_mask_;
+        uint64_t      submitted_;
+        uint64_t      retired_;
+        /**
+         * when a request was last submitted or completed (or given up on)
+         */
+        uint64_t      progress_;
+        /**
+         * the number of requests that the driver has failed to pass to the output
+         */
+        uint64_t      failed_;
     };
 
+    class Service;
+    class SharedMemoryThread;
+
     /**
-     * a thread class for managing output back to client
+     * a thread class for managing output back to client.
+     *
+     * on every wakeup, it collects all the responses that are ready
+     * (up to `batch`), optionally waits up to `hold` nanoseconds for
+     * more to arrive, and sends them out at once.
+     *
+     * `sockets` is the table of listening sockets, indexed by Packet::listener.
      */
     class ResponseThread: public ks::Thread
     {
     public:
-        ResponseThread(Socket *socket, IOBuffer *input):
-            ks::Thread(), socket_(socket), input_(input) { }
-        ~ResponseThread() { }
+        ResponseThread(Socket **sockets, SessionTable *sessions, IOBuffer *input,
+                       const size_t& batch=1, const uint64_t& hold=0):
+            ks::Thread(), sockets_(sockets), sessions_(sessions), input_(input),
+            batch_size_(batch), hold_(hold), batch_(new Packet[batch]), shm_(0), service_(0) { }
+        ~ResponseThread() { delete[] batch_; }
+
+        /**
+         * the CPU set/scheduling that the thread applies to itself on start
+         */
+        void set_policy(const rt::ThreadPolicy& policy) { policy_ = policy; }
+
+        /**
+         * the latency from the arrival of the packets to when their responses are sent
+         */
+        const Latency& response_latency() const { return response_latency_; }
+
+        /**
+        *   the responses to SHM_LISTENER go through `shm`
+        */
+        void set_shared_memory(SharedMemoryThread *shm) { shm_ = shm; }
+
+        /**
+        *   the service to be stopped when the responses can no longer be sent
+        */
+        void set_service(Service *service) { service_ = service; }
 
         void run();
 
     private:
-        Socket             *socket_;
+        /**
+         * collects the responses to be sent on this wakeup into `batch_`.
+         * returns the number of packets collected.
+         */
+        size_t collect();
+
+        Socket            **sockets_;
+        SessionTable       *sessions_;
         IOBuffer           *input_;
-        char                buffer_[protocol::MSG_SIZE];
-        struct sockaddr_in  client_;
+        size_t              batch_size_;
+        uint64_t            hold_;
+        Packet             *batch_;
+        ks::nanostamp       clock_;
+        rt::ThreadPolicy    policy_;
+        Latency             response_latency_;
+        SharedMemoryThread *shm_;
+        Service            *service_;
     };
 
+    class ReceiverThread;
+
     /**
     *   a class that handles the actual FastEventServer service
+    *
+    *   by default, the thread that calls run() receives the requests.
+    *   if `receivers` is more than one, each port is opened by that many
+    *   sockets with SO_REUSEPORT instead, and each socket is served by its own
+    *   ReceiverThread. the kernel distributes the datagrams to the sockets by
+    *   hashing the flow, so that all the requests from a client go through the
+    *   same socket, and hence through the same lane into DriverThread.
     */
     class Service {
     public:
-        static const size_t MAX_MSG_SIZE = 32;
-        enum Status { Acqknowledge, HandlingError, CloseRequest, ShutdownRequest };
+        static const size_t MAX_MSG_SIZE = 64;
+        static const size_t DEFAULT_RECV_BATCH = 16;
+        static const size_t DEFAULT_SEND_BATCH = 16;
+        static const unsigned DEFAULT_SPIN_US = 200;
+        static const unsigned DEFAULT_BUSY_POLL_US = 50;
+        enum Status { Acqknowledge, HandlingError, CloseRequest, ShutdownRequest, Idle };
+
+        /**
+        *   a listening socket, as registered to the reactor.
+        *   `kind` is either a datagram socket (UDP or AF_UNIX SOCK_DGRAM),
+        *   an AF_UNIX SOCK_SEQPACKET socket accepting connections,
+        *   or one of the accepted connections.
+        */
+        struct Listener
+        {
+            enum Kind { Datagram, Acceptor, Connection };
+
+            socket_t    desc;
+            uint8_t     index;
+            Kind        kind;
+        };
+
+        /**
+        *   an AF_UNIX socket to listen to, next to the UDP port(s)
+        */
+        struct LocalPort
+        {
+            std::string         path;
+            /**
+            *   either Socket::LocalDatagram (SOCK_DGRAM), or
+            *   Socket::LocalConnection (SOCK_SEQPACKET)
+            */
+            Socket::Transport   transport;
+        };
+
+        /**
+        *   the tunables of the service, as read from `service.cfg`
+        */
+        struct Options
+        {
+            /**
+            *   the UDP port(s) to listen to ("port", a number or an array)
+            */
+            std::vector<uint16_t> ports;
+            /**
+            *   the AF_UNIX socket(s) to listen to ("unix", an object or an array)
+            */
+            std::vector<LocalPort> local_ports;
+            /**
+            *   the name of the shared-memory region ("shm/name"; empty to disable),
+            *   and whether or not its thread may sleep, to be woken up by
+            *   the doorbell ("shm/doorbell"), and the group whose members may
+            *   attach to it besides the owner ("shm/group"; empty for the owner only)
+            */
+            std::string shm_name;
+            bool        shm_doorbell;
+            std::string shm_group;
+            /**
+            *   the depth of the buffers between threads ("buffer_depth")
+            */
+            size_t      depth;
+            /**
+            *   the maximal number of datagrams received per wakeup ("recv_batch")
+            */
+            size_t      recv_batch;
+            /**
+            *   the maximal number of responses sent at once ("send_batch")
+            */
+            size_t      send_batch;
+            /**
+            *   the maximal time (in nanoseconds) for a response to be held,
+            *   waiting for others to be sent together ("send_hold_us")
+            */
+            uint64_t    send_hold;
+            /**
+            *   the interval (in nanoseconds) of the status report
+            *   on the standard error ("stats_interval_s"; 0 to disable)
+            */
+            uint64_t    stats_interval;
+            /**
+            *   the number of receiver threads per port ("receivers")
+            */
+            size_t      receivers;
+            /**
+            *   the CPUs to pin the receiver threads to, in turn ("receiver_cpus")
+            */
+            std::vector<int> receiver_cpus;
+            /**
+            *   whether or not to spin on the sockets instead of
+            *   blocking on them ("receive_mode": "block" or "busy_poll")
+            */
+            bool        busy_poll;
+            /**
+            *   how long (in nanoseconds) to keep spinning after the last
+            *   packet, before falling back to blocking ("spin_us")
+            */
+            uint64_t    spin_budget;
+            /**
+            *   the SO_BUSY_POLL value of the sockets, in microseconds ("busy_poll_us")
+            */
+            unsigned    busy_poll_us;
+            /**
+            *   how DriverThread/ResponseThread wait for their inputs
+            *   ("wait": {"driver": ..., "response": ...})
+            */
+            Waiter::Strategy driver_wait;
+            Waiter::Strategy response_wait;
+            /**
+            *   the CPU sets/scheduling policies of the threads
+            *   ("threads": {"receiver": ..., "driver": ..., "response": ...}).
+            *   the receiver policy applies to the thread in run() or to each
+            *   ReceiverThread (with its CPU set replaced by `receiver_cpus`, if any).
+            */
+            rt::ThreadPolicy receiver_policy;
+            rt::ThreadPolicy driver_policy;
+            rt::ThreadPolicy response_policy;
+            /**
+            *   how the arrival of the requests is timestamped
+            *   ("rx_timestamp": "none", "user", "ns" or "software")
+            */
+            Socket::Timestamping timestamping;
+            /**
+            *   whether or not the UDP sockets go through io_uring ("io_backend":
+            *   "default" or "uring"), and the settings of the rings ("io_uring")
+            */
+            bool         uring;
+            UringOptions uring_options;
+            /**
+            *   the weights/rate limits of the clients, the first matching entry
+            *   applying ("clients"), and the number of requests that a client
+            *   may have queued for the driver ("client_queue_depth")
+            */
+            std::vector<ClientClass> clients;
+            size_t       client_depth;
+            /**
+            *   the settings of the scheduled commands ("timed_output")
+            */
+            TimerOptions timers;
+            /**
+            *   the settings of the coalescing of the pending commands ("coalesce")
+            */
+            CoalesceOptions coalesce;
+            /**
+            *   the maximal age (in nanoseconds) of the requests
+            *   when they reach the driver ("max_age_us"; 0 for no limit)
+            */
+            uint64_t     max_age;
+            /**
+            *   whether or not the thread in run() passes the requests to the
+            *   driver and responds to them by itself, instead of going through
+            *   DriverThread and ResponseThread ("pipeline": "threaded" or "inline")
+            */
+            bool         inline_pipeline;
+        };
 
         /**
         *   attempts to build a Service instance.
@@ -242,6 +1470,47 @@ namespace fastevent {
         */
         void   run(const bool& verbose=true);
 
+        /**
+        *   makes run() shut down the service, as if a shutdown request has arrived.
+        *   it is safe to call from another thread, and from a signal handler.
+        */
+        void   stop();
+
+        /**
+        *   receives the pending requests on `socket` into `batch`, and passes
+        *   them to `lane` of `output`. used by run() and by ReceiverThread.
+        *
+        *   @returns    status  a Service::Status value to represent the resulting response
+        */
+        static Status forward(Socket *socket, const uint8_t& listener, Packet *batch,
+                              IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions,
+                              uint64_t *received);
+
+        /**
+        *   passes `count` received packets to `lane` of `output`,
+        *   cutting the batch off at a shutdown request (then followed by the EOF).
+        *   the sessions of the packets that do not make it are released.
+        *   the ones to be acknowledged on receipt are also passed to `1 + lane` of `acks`.
+        *
+        *   @returns    status  ShutdownRequest if any, or Acqknowledge otherwise
+        */
+        static Status dispatch(Packet *batch, const size_t& count,
+                               IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions);
+
+        /**
+        *   keeps calling forward() on the `n` listeners (`sockets[i]` being
+        *   the socket of `listeners[i]`) without blocking,
+        *   until none of them has received anything for `budget` nanoseconds,
+        *   or until `stopping` is set.
+        *
+        *   @returns    status  Idle when the budget has run out, or the status
+        *                       from forward() that ended the spin otherwise
+        */
+        static Status spin(Socket **sockets, const Listener *listeners, const size_t& n,
+                           Packet *batch, IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions,
+                           const uint64_t& budget, const std::atomic<bool>& stopping,
+                           uint64_t *received, uint64_t *spun);
+
     private:
         /**
         *   just to make sure proper startup/cleanup in Windows.
@@ -260,16 +1529,77 @@ namespace fastevent {
         *   a private routine for attempting to bind to the specified port.
         *   the bound listening socket will be returned when Result::successful().
         */
-        static ks::Result<socket_t> bind(uint16_t port, const bool& verbose=true);
+        static ks::Result<socket_t> bind(uint16_t port, const Options& options, const bool& verbose=true);
+
+        /**
+        *   creates an AF_UNIX socket at `local.path` (replacing a stale socket
+        *   file, if any), and starts listening in case of SOCK_SEQPACKET.
+        */
+        static ks::Result<socket_t> bind_local(const LocalPort& local, const Options& options,
+                                               const bool& verbose=true);
+
+        /**
+        *   the routine for handling the requests from clients.
+        *   all the datagrams pending on the socket (up to `recv_batch`)
+        *   are received at once, and are passed to DriverThread as a batch.
+        *   a shutdown request in the middle of a batch cuts it off there.
+        *
+        *   @returns    status  a Service::Status value to represent the resulting response
+        */
+        Status  handle(const Listener& listener);
 
         /**
-        *   the routine for handling a request from a client.
-        *   `driver` is explicitly passed from `loop()` in case we plug an
-        *   external handler in the future.
+        *   (the inline pipeline) receives the pending requests on `listener`,
+        *   passes them to the driver one by one, and responds to them,
+        *   all in the calling thread. a shutdown request ends the batch there.
         *
         *   @returns    status  a Service::Status value to represent the resulting response
         */
-        Status  handle();
+        Status  serve(const Listener& listener);
+
+        /**
+        *   (the inline pipeline) sends the response to `packet` through `socket`,
+        *   and closes the request in its session. a response that cannot be sent
+        *   is dropped (as ResponseThread would), without stopping the service.
+        */
+        void    respond(Socket *socket, const Packet& packet);
+
+        /**
+        *   accepts a SOCK_SEQPACKET connection on `acceptor`, and starts watching it.
+        */
+        void    accept(const Listener& acceptor);
+
+        /**
+        *   stops watching a closed connection, and lets ResponseThread
+        *   release its socket after the pending responses.
+        */
+        void    disconnect(Listener& connection);
+
+        /**
+        *   prints the packet counters to the standard error.
+        */
+        void    report();
+
+        /**
+        *   prints the counters of the clients to the standard error.
+        */
+        void    report_sessions();
+
+        /**
+        *   sums up the counters over the receiving threads.
+        */
+        void    count(uint64_t *received, uint64_t *spun);
+
+        /**
+        *   makes the packet source(s) send the EOF downstream.
+        */
+        void    close_input();
+
+        /**
+        *   makes the receiver threads and the shared-memory thread
+        *   (if any) send the EOF downstream.
+        */
+        void    stop_receivers();
 
        /**
         *   a private routine for shutting down the service.
@@ -281,19 +1611,88 @@ namespace fastevent {
         *   the private constructor.
         *   use `configure()` instead to build a Service.
         */
-        Service(socket_t listening, OutputDriver* driver);
+        Service(const std::vector<socket_t>& listening, const std::vector<socket_t>& local,
+                shm::Region *region, OutputDriver* driver, const Options& options);
+
+        /**
+        *   the listening socket objects: the datagram sockets come first
+        *   (the UDP ones, and then the AF_UNIX ones), and the accepted
+        *   connections take the CONN_MAX slots from LISTEN_MAX on.
+        *   `sockets_` is indexed by Packet::listener.
+        */
+        Listener       listeners_[LISTEN_MAX + CONN_MAX];
+        Socket        *sockets_[LISTEN_MAX + CONN_MAX];
+        size_t         num_listeners_;
+
+        /**
+        *   the SOCK_SEQPACKET sockets accepting connections
+        */
+        Listener       acceptors_[LISTEN_MAX];
+        size_t         num_acceptors_;
+
+        /**
+        *   the AF_UNIX socket files to be removed at shutdown
+        */
+        std::vector<std::string> local_paths_;
+
+        size_t         recv_batch_;
+        size_t         send_batch_;
+
+        /**
+        *   the lane of the DriverThread input that the thread in run() writes into,
+        *   if any (there is none when all the sockets are served by ReceiverThread's)
+        */
+        bool           has_lane_;
+        size_t         lane_;
+
+        /**
+        *   the event loop that watches the listening sockets,
+        *   the output device, the status timer and the stop() requests
+        */
+        Reactor        reactor_;
+        int            serial_desc_;
+
+        rt::ThreadPolicy receiver_policy_;
+
+        /**
+        *   the number of packets received (by the thread in run()), and
+        *   in the busy-poll mode, how many of them were picked up while
+        *   spinning, rather than after sleeping
+        */
+        uint64_t       received_;
+        uint64_t       spun_;
+        bool           busy_poll_;
+        uint64_t       spin_budget_;
+        Socket::Timestamping timestamping_;
 
         /**
-        *   the listening socket object
+        *   set by stop(), so that a spinning loop notices it
         */
-        socket_t       socket_desc_;
-        Socket         socket_;
+        std::atomic<bool> stopping_;
 
         /**
-        *   `fdread_` and `fdwatch_` are used as arguments of `select()` call
+        *   whether or not the requests go through the inline pipeline,
+        *   and the latency until their responses are sent, if so
         */
-        fd_set         fdread_;
-        int            fdwatch_;
+        bool           inline_;
+        Latency        response_latency_;
+
+        /**
+         * the receiver threads, if any (one for each listening socket)
+         */
+        std::vector<ReceiverThread *> receivers_;
+
+        /**
+         * the thread serving the shared-memory transport, if any
+         */
+        SharedMemoryThread *shm_;
+
+        /**
+         * the clients, partitioned by the lanes of `output_`,
+         * and the order they get to the driver in
+         */
+        SessionTable  *sessions_;
+        Scheduler     *scheduler_;
 
         /**
          * the other threads
@@ -302,9 +1701,133 @@ namespace fastevent {
         ResponseThread *response_;
 
         /**
-         * the I/O buffer for communication between the other threads
+         * the I/O buffers for communication between the other threads:
+         * the input of DriverThread, and the input of ResponseThread
+         * (for the acknowledgements on receive)
          */
         IOBuffer      *output_;
+        IOBuffer      *acks_;
+
+        /**
+         * the receive buffer for handle()
+         */
+        Packet        *batch_;
+    };
+
+    /**
+    *   a thread class that receives requests from one listening socket,
+    *   and passes them to its own lane of the DriverThread input.
+    */
+    class ReceiverThread: public ks::Thread
+    {
+    public:
+        ReceiverThread(Service *service, Socket *socket, const uint8_t& listener,
+                       IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions,
+                       const rt::ThreadPolicy& policy=rt::ThreadPolicy(),
+                       const uint64_t& spin_budget=0);
+        ~ReceiverThread();
+
+        void run();
+
+        /**
+        *   makes the thread send the EOF to its lane and exit.
+        */
+        void stop();
+
+        uint64_t received() const { return received_.load(std::memory_order_relaxed); }
+
+        /**
+        *   the number of packets picked up while spinning (busy-poll mode)
+        */
+        uint64_t spun() const { return spun_.load(std::memory_order_relaxed); }
+
+    private:
+        Service                *service_;
+        Socket                 *socket_;
+        Service::Listener       listener_;
+        IOBuffer               *output_;
+        IOBuffer               *acks_;
+        size_t                  lane_;
+        SessionTable           *sessions_;
+        rt::ThreadPolicy        policy_;
+        Reactor                 reactor_;
+        Packet                 *batch_;
+        uint64_t                spin_budget_;
+        std::atomic<bool>       stopping_;
+        std::atomic<uint64_t>   received_;
+        std::atomic<uint64_t>   spun_;
+    };
+
+    /**
+    *   a thread class that serves the shared-memory transport (see shm.h),
+    *   passing the requests to its own lane of the DriverThread input.
+    *   ResponseThread puts the responses back through respond().
+    *
+    *   the thread keeps polling the channels, and only goes to sleep
+    *   (on the doorbell) after nothing has arrived for `spin_budget`
+    *   nanoseconds, if `doorbell` is true.
+    */
+    class SharedMemoryThread: public ks::Thread
+    {
+    public:
+        /**
+        *   creates the region `name` (replacing a stale one, if any),
+        *   accessible only to the owner, or also to `group` if it is not empty.
+        */
+        static ks::Result<shm::Region *> create(const std::string& name, const std::string& group="");
+
+        /**
+        *   takes over `region` (as returned by create())
+        */
+        SharedMemoryThread(Service *service, shm::Region *region, const std::string& name,
+                           IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions,
+                           const rt::ThreadPolicy& policy, const uint64_t& spin_budget,
+                           const bool& doorbell, const Socket::Timestamping& timestamping);
+        ~SharedMemoryThread();
+
+        void run();
+
+        /**
+        *   makes the thread send the EOF to its lane and exit.
+        */
+        void stop();
+
+        /**
+        *   (ResponseThread only) puts the responses back into the channels.
+        *   a response to a full queue is dropped.
+        */
+        void respond(const Packet *packets, const size_t& n, const SessionTable& sessions);
+
+        uint64_t received() const { return received_.load(std::memory_order_relaxed); }
+
+        uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+        /**
+        *   takes the pending requests (up to `max`) from all the channels
+        */
+        size_t   poll(Packet *packets, const size_t& max);
+
+        /**
+        *   sleeps on the doorbell, unless a request arrives in the meantime
+        */
+        void     sleep();
+
+        Service                *service_;
+        shm::Region            *region_;
+        std::string             name_;
+        IOBuffer               *output_;
+        IOBuffer               *acks_;
+        size_t                  lane_;
+        SessionTable           *sessions_;
+        rt::ThreadPolicy        policy_;
+        uint64_t                spin_budget_;
+        bool                    doorbell_;
+        Socket::Timestamping    timestamping_;
+        Packet                 *batch_;
+        std::atomic<bool>       stopping_;
+        std::atomic<uint64_t>   received_;
+        std::atomic<uint64_t>   dropped_;
     };
 }
 
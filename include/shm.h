@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   shm.h -- the shared-memory transport for the clients on the same host (*NIX only)
+*
+*   the server creates a named POSIX shared-memory region (shm_open(3)),
+*   which holds CHANNELS_MAX channels. a client claims a free channel, and
+*   talks to the server through the two lock-free single-producer/single-consumer
+*   queues of the channel: requests (client -> server) and responses
+*   (server -> client). the messages are the same 2-byte commands as in UDP.
+*
+*   as long as the server keeps polling the region, neither side enters the kernel.
+*   when the server is asleep, the client rings the doorbell (a futex in the region)
+*   to wake it up; likewise, a client may sleep on its channel waiting for the response.
+*   the futexes are Linux-only; elsewhere, the sleeping side polls at short intervals.
+*
+*   this header is self-contained, so that it can be copied into the client code
+*   (see shm::Client below).
+*/
+
+#ifndef __FE_SHM_H__
+#define __FE_SHM_H__
+
+namespace fastevent {
+    namespace shm {
+        struct Region;
+    }
+}
+
+#ifndef _WIN32
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace fastevent {
+    namespace shm {
+        const uint32_t  MAGIC         = 0x4d534546; // "FESM"
+        const uint32_t  VERSION       = 1;
+
+        /**
+        *   the number of channels (i.e. clients at a time) in a region
+        */
+        const uint32_t  CHANNELS_MAX  = 8;
+
+        /**
+        *   the number of slots in each queue (a power of two)
+        */
+        const uint32_t  SLOTS         = 64;
+
+        /**
+        *   the size of a command (the same as protocol::MSG_SIZE)
+        */
+        const uint32_t  MSG_SIZE      = 2;
+
+        const size_t    LINE_SIZE     = 64;
+
+        static_assert(ATOMIC_INT_LOCK_FREE == 2, "the shared-memory transport requires lock-free atomics");
+
+        /**
+        *   the futex operations across processes (a no-op outside Linux)
+        */
+        inline void futex_wait(std::atomic<uint32_t> *word, const uint32_t& expected,
+                               const uint64_t& timeout_ns)
+        {
+#ifdef __linux__
+            struct timespec timeout;
+            timeout.tv_sec  = timeout_ns / 1000000000ULL;
+            timeout.tv_nsec = timeout_ns % 1000000000ULL;
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected, &timeout, 0, 0);
+#else
+            (void)word; (void)expected;
+            struct timespec interval;
+            interval.tv_sec  = 0;
+            interval.tv_nsec = (timeout_ns < 100000)? timeout_ns : 100000;
+            nanosleep(&interval, 0);
+#endif
+        }
+
+        inline void futex_wake(std::atomic<uint32_t> *word)
+        {
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, 1, 0, 0, 0);
+#else
+            (void)word;
+#endif
+        }
+
+        /**
+        *   a command in a queue
+        */
+        struct Message
+        {
+            char    payload[MSG_SIZE];
+        };
+
+        /**
+        *   a single-producer/single-consumer queue living in the region.
+        *   the producer only writes `tail`, and the consumer only writes `head`.
+        */
+        struct Queue
+        {
+            alignas(LINE_SIZE) std::atomic<uint32_t>  head;
+            alignas(LINE_SIZE) std::atomic<uint32_t>  tail;
+            alignas(LINE_SIZE) Message                slots[SLOTS];
+
+            /**
+            *   (producer only) returns false if the queue is full.
+            */
+            bool push(const char *payload)
+            {
+                const uint32_t t = tail.load(std::memory_order_relaxed);
+                if (t - head.load(std::memory_order_acquire) >= SLOTS) {
+                    return false;
+                }
+                memcpy(slots[t & (SLOTS-1)].payload, payload, MSG_SIZE);
+                tail.store(t + 1, std::memory_order_release);
+                return true;
+            }
+
+            /**
+            *   (consumer only) returns false if the queue is empty.
+            */
+            bool pop(char *payload)
+            {
+                const uint32_t h = head.load(std::memory_order_relaxed);
+                if (h == tail.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                memcpy(payload, slots[h & (SLOTS-1)].payload, MSG_SIZE);
+                head.store(h + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool empty() const
+            {
+                return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+            }
+        };
+
+        /**
+        *   the queues of a client
+        */
+        struct Channel
+        {
+            /**
+            *   the process ID of the client, or 0 if the channel is free
+            */
+            alignas(LINE_SIZE) std::atomic<uint32_t>  owner;
+            /**
+            *   the futex word that the client sleeps on, and whether it does
+            */
+            std::atomic<uint32_t>                     response_bell;
+            std::atomic<uint32_t>                     client_sleeping;
+
+            Queue                                     requests;
+            Queue                                     responses;
+        };
+
+        struct Region
+        {
+            /**
+            *   filled in last by the server, once the region is ready
+            */
+            std::atomic<uint32_t>   magic;
+            uint32_t                version;
+            uint32_t                channels;
+            uint32_t                slots;
+
+            /**
+            *   the futex word that the server sleeps on, and whether it does
+            */
+            alignas(LINE_SIZE) std::atomic<uint32_t>  doorbell;
+            std::atomic<uint32_t>                     server_sleeping;
+
+            Channel                 channel[CHANNELS_MAX];
+        };
+
+        /**
+        *   the client side of the shared-memory transport.
+        *
+        *   ```
+        *   fastevent::shm::Client client;
+        *   if (client.open("/fastevent")) {
+        *       char cmd[2] = { index, command }, ack[2];
+        *       client.send(cmd);
+        *       client.wait(ack);
+        *   }
+        *   ```
+        *
+        *   the object is for a single thread.
+        */
+        class Client
+        {
+        public:
+            /**
+            *   `spin` is the number of polls before wait() goes to sleep.
+            */
+            explicit Client(const uint32_t& spin=20000):
+                region_(0), channel_(0), spin_(spin) { }
+            ~Client() { close(); }
+
+            /**
+            *   maps the region `name` (as in the "shm" config of the server), and claims
+            *   a channel. returns false on failure, with errno set (EBUSY if all the
+            *   channels are taken, EPROTO if the region is not a compatible one).
+            */
+            bool open(const std::string& name)
+            {
+                close();
+                int fd = shm_open(name.c_str(), O_RDWR, 0);
+                if (fd < 0) {
+                    return false;
+                }
+                void *addr = mmap(0, sizeof(Region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                ::close(fd);
+                if (addr == MAP_FAILED) {
+                    return false;
+                }
+                region_ = static_cast<Region *>(addr);
+                if ((region_->magic.load(std::memory_order_acquire) != MAGIC) ||
+                    (region_->version != VERSION) || (region_->slots != SLOTS)) {
+                    close();
+                    errno = EPROTO;
+                    return false;
+                }
+
+                const uint32_t self = static_cast<uint32_t>(getpid());
+                for (uint32_t i=0; i<region_->channels; i++) {
+                    Channel& channel = region_->channel[i];
+                    uint32_t owner = channel.owner.load(std::memory_order_relaxed);
+                    // take over the channels left by the processes that have gone
+                    if ((owner != 0) && ((kill(static_cast<pid_t>(owner), 0) == 0) || (errno != ESRCH))) {
+                        continue;
+                    }
+                    if (channel.owner.compare_exchange_strong(owner, self)) {
+                        channel_ = &channel;
+                        // discard the responses to the previous owner
+                        char stale[MSG_SIZE];
+                        while (channel_->responses.pop(stale)) { }
+                        return true;
+                    }
+                }
+                close();
+                errno = EBUSY;
+                return false;
+            }
+
+            /**
+            *   releases the channel, and unmaps the region.
+            */
+            void close()
+            {
+                if (channel_ != 0) {
+                    channel_->owner.store(0, std::memory_order_release);
+                    channel_ = 0;
+                }
+                if (region_ != 0) {
+                    munmap(region_, sizeof(Region));
+                    region_ = 0;
+                }
+            }
+
+            bool is_open() const { return channel_ != 0; }
+
+            /**
+            *   sends a command without waiting. returns false if the queue is full.
+            *   the server only gets woken up (through a system call) if it is asleep.
+            */
+            bool send(const char *payload)
+            {
+                if (!channel_->requests.push(payload)) {
+                    return false;
+                }
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (region_->server_sleeping.load(std::memory_order_relaxed) != 0) {
+                    region_->doorbell.fetch_add(1, std::memory_order_seq_cst);
+                    futex_wake(&(region_->doorbell));
+                }
+                return true;
+            }
+
+            /**
+            *   takes a response if there is any, without waiting.
+            */
+            bool receive(char *payload)
+            {
+                return channel_->responses.pop(payload);
+            }
+
+            /**
+            *   waits for a response for up to `timeout_ns` nanoseconds:
+            *   spins first, and then sleeps. returns false on timeout.
+            */
+            bool wait(char *payload, const uint64_t& timeout_ns=1000000000ULL)
+            {
+                for (uint32_t i=0; i<spin_; i++) {
+                    if (receive(payload)) {
+                        return true;
+                    }
+                }
+
+                struct timespec start, now;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                while (true) {
+                    const uint32_t bell = channel_->response_bell.load(std::memory_order_relaxed);
+                    channel_->client_sleeping.store(1, std::memory_order_seq_cst);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (receive(payload)) {
+                        channel_->client_sleeping.store(0, std::memory_order_relaxed);
+                        return true;
+                    }
+
+                    clock_gettime(CLOCK_MONOTONIC, &now);
+                    const uint64_t elapsed = static_cast<uint64_t>(now.tv_sec - start.tv_sec) * 1000000000ULL
+                                             + now.tv_nsec - start.tv_nsec;
+                    if (elapsed >= timeout_ns) {
+                        channel_->client_sleeping.store(0, std::memory_order_relaxed);
+                        return false;
+                    }
+                    futex_wait(&(channel_->response_bell), bell, timeout_ns - elapsed);
+                }
+            }
+
+        private:
+            Client(const Client&);
+            Client& operator=(const Client&);
+
+            Region     *region_;
+            Channel    *channel_;
+            uint32_t    spin_;
+        };
+    }
+}
+
+#endif
+#endif
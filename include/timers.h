@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   timers.h -- the requests to be issued to the driver at a later time
+*
+*   a version 2 request may carry a target time (see protocol.h). DriverThread
+*   keeps such a request in a TimerQueue until the target time less the lead,
+*   i.e. the time it takes for the driver to get the command out,
+*   so that the output lands on the target rather than after it.
+*
+*   DriverThread sleeps until shortly before the release time (still being
+*   woken up by the new requests), and spins for the rest of it.
+*/
+
+#ifndef __FE_TIMERS_H__
+#define __FE_TIMERS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fastevent {
+
+    struct Packet;
+
+    /**
+    *   the settings of the timed output (the "timed_output" config)
+    */
+    struct TimerOptions
+    {
+        static const size_t   DEFAULT_DEPTH   = 256;
+        static const uint64_t DEFAULT_SPIN_NS = 100000;
+
+        /**
+        *   the number of requests that can be waiting for their times
+        */
+        size_t      depth;
+        /**
+        *   how early (in nanoseconds) a request is issued to the driver
+        *   (negative to use the mean time that the driver takes for a command)
+        */
+        int64_t     lead;
+        /**
+        *   how long (in nanoseconds) DriverThread spins before the release
+        *   time, rather than sleeping until it
+        */
+        uint64_t    spin;
+
+        TimerOptions(): depth(DEFAULT_DEPTH), lead(-1), spin(DEFAULT_SPIN_NS) { }
+    };
+
+    /**
+    *   the requests waiting for their target times, in a fixed-size
+    *   binary heap (DriverThread only). the requests with the same
+    *   target time come out in the order they went in.
+    *   no memory is allocated after construction.
+    */
+    class TimerQueue
+    {
+    public:
+        explicit TimerQueue(const size_t& capacity);
+        ~TimerQueue();
+
+        /**
+        *   keeps `packet` until Packet::target. returns false if the queue is full.
+        */
+        bool push(const Packet& packet);
+
+        /**
+        *   takes out the request with the earliest target time
+        *   (the queue must not be empty).
+        */
+        void pop(Packet *packet);
+
+        /**
+        *   takes out a request through `listener` (used to drop the requests
+        *   of a connection that has been closed). returns false if there is none.
+        */
+        bool pop_listener(const uint8_t& listener, Packet *packet);
+
+        /**
+        *   the earliest target time (the queue must not be empty)
+        */
+        uint64_t next() const { return heap_[0].target; }
+
+        bool   empty() const { return size_ == 0; }
+
+        size_t size() const { return size_; }
+
+    private:
+        TimerQueue(const TimerQueue&);
+        TimerQueue& operator=(const TimerQueue&);
+
+        struct Entry
+        {
+            uint64_t    target;
+            uint64_t    serial;
+            uint32_t    slot;
+        };
+
+        static bool earlier(const Entry& a, const Entry& b)
+        {
+            return (a.target < b.target) || ((a.target == b.target) && (a.serial < b.serial));
+        }
+
+        /**
+        *   removes the `index`-th entry of the heap
+        */
+        void remove(const size_t& index);
+
+        /**
+        *   puts `entry` at the `i`-th place of the heap,
+        *   and moves it up or down to where it belongs
+        */
+        void place(size_t i, const Entry& entry);
+
+        size_t      capacity_;
+        /**
+        *   the requests (in the slots), the free slots, and the heap of them
+        */
+        Packet     *packets_;
+        uint32_t   *free_;
+        Entry      *heap_;
+        size_t      size_;
+        uint64_t    serial_;
+    };
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   uring.h -- a minimal io_uring(7) ring, on the raw system calls (Linux only)
+*
+*   a Uring is a submission queue (SQ) and a completion queue (CQ) shared
+*   with the kernel. the entries are prepared and reaped in the user space,
+*   and io_uring_enter(2) is only needed to submit them, unless the kernel
+*   polls the SQ by itself (SQPOLL), in which case the system call is only
+*   needed to wake the polling thread after it has gone idle.
+*
+*   the ring descriptor becomes readable whenever there are completions,
+*   so that it can be watched by Reactor like a socket.
+*
+*   a ring must only be used by one thread at a time.
+*/
+
+#ifndef __FE_URING_H__
+#define __FE_URING_H__
+
+#include "ks/utils.h"
+#include <stdint.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+namespace fastevent {
+
+    /**
+    *   the settings of the rings (the "io_uring" config)
+    */
+    struct UringOptions
+    {
+        /**
+        *   the number of SQ entries (rounded up to a power of two by the kernel)
+        */
+        unsigned    entries;
+        /**
+        *   whether or not the kernel polls the SQ
+        */
+        bool        sqpoll;
+        /**
+        *   the CPU to pin the polling thread to (negative to leave it unpinned)
+        */
+        int         sqpoll_cpu;
+        /**
+        *   how long (in milliseconds) the polling thread spins before going idle
+        */
+        unsigned    sqpoll_idle;
+
+        UringOptions(): entries(64), sqpoll(false), sqpoll_cpu(-1), sqpoll_idle(100) { }
+    };
+
+#ifdef __linux__
+    class Uring
+    {
+    public:
+        /**
+        *   sets up a ring. with SQPOLL, the ring shares the polling thread
+        *   of `share` (if given), so that a single kernel thread serves all the rings.
+        */
+        static ks::Result<Uring *> create(const UringOptions& options, const Uring *share=0);
+        ~Uring();
+
+        int descriptor() const { return fd_; }
+
+        /**
+        *   returns a cleared SQE to fill in, or NULL if the SQ is full.
+        *   the SQE is not visible to the kernel until submit().
+        */
+        struct io_uring_sqe *next_sqe();
+
+        /**
+        *   passes the SQEs prepared so far to the kernel, and waits until
+        *   at least `wait` completions are available.
+        *
+        *   returns 0, or -1 with errno set.
+        */
+        int submit(const unsigned& wait=0);
+
+        /**
+        *   returns the oldest completion (without removing it), or NULL if there is none.
+        */
+        struct io_uring_cqe *peek();
+
+        /**
+        *   removes the completion returned by peek().
+        */
+        void consume();
+
+        /**
+        *   registers `count` (a power of two) buffers of `size` bytes
+        *   as the buffer group `group`, for the requests with IOSQE_BUFFER_SELECT.
+        *   a ring may only have one group.
+        */
+        ks::Result<bool> provide_buffers(const uint16_t& group, const unsigned& count, const unsigned& size);
+
+        char *buffer(const uint16_t& id) { return buffers_ + static_cast<size_t>(id) * buffer_size_; }
+
+        /**
+        *   gives the buffer `id` back to the kernel.
+        */
+        void recycle(const uint16_t& id);
+
+    private:
+        Uring();
+        Uring(const Uring&);
+        Uring& operator=(const Uring&);
+
+        int                 fd_;
+        bool                sqpoll_;
+
+        void               *sq_ring_;
+        size_t              sq_ring_size_;
+        void               *cq_ring_;
+        size_t              cq_ring_size_;
+        struct io_uring_sqe *sqes_;
+        size_t              sqes_size_;
+
+        unsigned           *sq_head_;
+        unsigned           *sq_tail_;
+        unsigned           *sq_flags_;
+        unsigned           *sq_array_;
+        unsigned            sq_mask_;
+        unsigned            sq_entries_;
+        /**
+        *   the SQ tail as far as prepared (the kernel sees `sq_tail_` only)
+        */
+        unsigned            sq_local_tail_;
+
+        unsigned           *cq_head_;
+        unsigned           *cq_tail_;
+        struct io_uring_cqe *cqes_;
+        unsigned            cq_mask_;
+
+        struct io_uring_buf_ring *buf_ring_;
+        size_t              buf_ring_size_;
+        char               *buffers_;
+        size_t              buffer_size_;
+        unsigned            buf_count_;
+        uint16_t            buf_tail_;
+    };
+#else
+    class Uring;
+#endif
+}
+
+#endif
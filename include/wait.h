@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   wait.h -- strategies for a consumer thread to wait for its producer(s)
+*
+*   1. Block:  sleep on a ks::Flag (condition variable) right away.
+*   2. Spin:   never sleep; poll with a `pause` in between.
+*   3. Hybrid: spin for a while, then sleep on a futex. the spin length adapts
+*              itself to how long the consumer usually had to wait.
+*   4. Futex:  sleep on a futex right away; the producer wakes the consumer
+*              directly, without any mutex.
+*
+*   the futex is only available on Linux; elsewhere, the futex-based
+*   strategies sleep on the ks::Flag instead.
+*
+*   the consumer announces that it is going to sleep before it re-checks
+*   the condition, and the producers check the announcement after publishing,
+*   so that a wakeup never gets lost.
+*
+*   the consumer may also wait until a deadline on monotonic_ns(). the futex
+*   then sleeps with an absolute timeout on the same clock; elsewhere (and for
+*   Block, as ks::Flag has no timeout), the consumer sleeps in short slices.
+*/
+
+#ifndef __FE_WAIT_H__
+#define __FE_WAIT_H__
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdint.h>
+
+#include "ks/utils.h"
+#include "ks/thread.h"
+#include "ring.h"
+
+namespace fastevent {
+
+    /**
+    *   the time in nanoseconds on the monotonic clock
+    *   (CLOCK_MONOTONIC on Linux), i.e. the clock of the deadlines.
+    */
+    inline uint64_t monotonic_ns()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    class Waiter
+    {
+    public:
+        enum Strategy { Block, Spin, Hybrid, Futex };
+
+        /**
+        *   the spin-length limits (in the number of polls) for Hybrid
+        */
+        static const uint32_t MIN_SPIN = 64;
+        static const uint32_t MAX_SPIN = 16384;
+
+        /**
+        *   the length of a sleep (in nanoseconds) when waiting
+        *   for a deadline without the futex
+        */
+        static const uint64_t SLEEP_SLICE_NS = 50000;
+
+        /**
+        *   parses one of "block", "spin", "hybrid" and "futex".
+        */
+        static ks::Result<Strategy> parse(const std::string& name);
+
+        static const char *name(const Strategy& strategy);
+
+        explicit Waiter(const Strategy& strategy=Hybrid):
+            strategy_(strategy), spin_(MIN_SPIN * 4), sleeping_(0), flag_() { }
+
+        Strategy strategy() const { return strategy_; }
+
+        /**
+        *   (consumer only) waits until `ready()` returns true.
+        */
+        template <typename Condition>
+        void wait(const Condition& ready)
+        {
+            switch (strategy_) {
+            case Spin:
+                while (!ready()) {
+                    cpu_relax();
+                }
+                return;
+
+            case Hybrid:
+                {
+                    uint32_t i = 0;
+                    for (; i<spin_; i++) {
+                        if (ready()) {
+                            // waited just for a while: let the next spin be
+                            // a little longer than this one
+                            adapt(2*i);
+                            return;
+                        }
+                        cpu_relax();
+                    }
+                    adapt(MIN_SPIN);
+                }
+                sleep(ready);
+                return;
+
+            case Futex:
+                sleep(ready);
+                return;
+
+            case Block:
+            default:
+                block(ready);
+                return;
+            }
+        }
+
+        /**
+        *   (consumer only) waits until `ready()` returns true, or until
+        *   `deadline` (on monotonic_ns()). returns false at the deadline.
+        */
+        template <typename Condition>
+        bool wait_until(const Condition& ready, const uint64_t& deadline)
+        {
+            switch (strategy_) {
+            case Spin:
+                while (!ready()) {
+                    if (monotonic_ns() >= deadline) {
+                        return false;
+                    }
+                    cpu_relax();
+                }
+                return true;
+
+            case Hybrid:
+                for (uint32_t i=0; i<spin_; i++) {
+                    if (ready()) {
+                        return true;
+                    }
+                    cpu_relax();
+                }
+                return sleep_until(ready, deadline);
+
+            case Futex:
+                return sleep_until(ready, deadline);
+
+            case Block:
+            default:
+                return doze_until(ready, deadline);
+            }
+        }
+
+        /**
+        *   (producer side) wakes up the consumer if it is asleep.
+        *   to be called after publishing.
+        */
+        void notify()
+        {
+            if (strategy_ == Spin) {
+                return;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleeping_.load(std::memory_order_relaxed) == 0) {
+                return;
+            }
+#ifdef __linux__
+            if (strategy_ != Block) {
+                if (sleeping_.exchange(0, std::memory_order_seq_cst) != 0) {
+                    futex_wake();
+                }
+                return;
+            }
+#endif
+            flag_.lock();
+            flag_.notifyAll();
+            flag_.unlock();
+        }
+
+    private:
+        Waiter(const Waiter&);
+        Waiter& operator=(const Waiter&);
+
+        /**
+        *   moves the spin length toward `observed` by 1/8
+        */
+        void adapt(const uint32_t& observed)
+        {
+            int64_t next = static_cast<int64_t>(spin_) + (static_cast<int64_t>(observed) - spin_) / 8;
+            if (next < MIN_SPIN) {
+                next = MIN_SPIN;
+            } else if (next > MAX_SPIN) {
+                next = MAX_SPIN;
+            }
+            spin_ = static_cast<uint32_t>(next);
+        }
+
+        template <typename Condition>
+        void block(const Condition& ready)
+        {
+            flag_.lock();
+            sleeping_.store(1, std::memory_order_seq_cst);
+            while (!ready()) {
+                flag_.wait();
+            }
+            sleeping_.store(0, std::memory_order_relaxed);
+            flag_.unlock();
+        }
+
+        template <typename Condition>
+        void sleep(const Condition& ready)
+        {
+#ifdef __linux__
+            while (!ready()) {
+                sleeping_.store(1, std::memory_order_seq_cst);
+                if (ready()) {
+                    break;
+                }
+                futex_wait();
+            }
+            sleeping_.store(0, std::memory_order_relaxed);
+#else
+            block(ready);
+#endif
+        }
+
+        template <typename Condition>
+        bool sleep_until(const Condition& ready, const uint64_t& deadline)
+        {
+#ifdef __linux__
+            bool done = true;
+            while (!ready()) {
+                if (monotonic_ns() >= deadline) {
+                    done = false;
+                    break;
+                }
+                sleeping_.store(1, std::memory_order_seq_cst);
+                if (ready()) {
+                    break;
+                }
+                futex_wait_until(deadline);
+            }
+            sleeping_.store(0, std::memory_order_relaxed);
+            return done;
+#else
+            return doze_until(ready, deadline);
+#endif
+        }
+
+        /**
+        *   polls `ready()` in between short sleeps
+        */
+        template <typename Condition>
+        bool doze_until(const Condition& ready, const uint64_t& deadline)
+        {
+            while (!ready()) {
+                const uint64_t now = monotonic_ns();
+                if (now >= deadline) {
+                    return false;
+                }
+                const uint64_t left = deadline - now;
+                std::this_thread::sleep_for(std::chrono::nanoseconds(
+                    (left < SLEEP_SLICE_NS)? left : SLEEP_SLICE_NS));
+            }
+            return true;
+        }
+
+#ifdef __linux__
+        /**
+        *   sleeps as long as `sleeping_` is 1
+        *   (or until `deadline` on monotonic_ns())
+        */
+        void futex_wait();
+        void futex_wait_until(const uint64_t& deadline);
+        void futex_wake();
+#endif
+
+        Strategy                strategy_;
+
+        /**
+        *   (consumer only) the current spin length for Hybrid
+        */
+        uint32_t                spin_;
+
+        /**
+        *   1 if the consumer is (about to be) asleep. it is also the futex word.
+        */
+        std::atomic<int>        sleeping_;
+
+        /**
+        *   the event flag object for Block
+        *   (and for the other strategies outside Linux)
+        */
+        ks::Flag                flag_;
+    };
+}
+
+#endif
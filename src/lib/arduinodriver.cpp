@@ -38,10 +38,32 @@ namespace fastevent {
             const char EVENT     = 'L';
             const char SYNC      = 'A';
             const char LINE_END  = '\n';
+
+            /**
+            *   the tag of the bytes sent through update() (i.e. not submitted)
+            */
+            const uint64_t NO_TAG    = 0xFFFFFFFFFFFFFFFFULL;
         }
 
+        /**
+        *   takes the echoes of a pipelined ArduinoDriver
+        */
+        class EchoReader: public ks::Thread
+        {
+        public:
+            explicit EchoReader(ArduinoDriver *driver): ks::Thread(), driver_(driver) { }
+            void run() { driver_->read_echoes(); }
+        private:
+            ArduinoDriver *driver_;
+        };
+
+        const int      ArduinoDriver::ECHO_POLL_MS;
+        const uint64_t ArduinoDriver::ECHO_TIMEOUT_NS;
+
         ArduinoDriver::ArduinoDriver(const serial_t& port):
-            port_(port), closed_(false), prev_(arduino::CLEAR)
+            port_(port), closed_(false), prev_(arduino::CLEAR),
+            depth_(0), echoes_(0), reader_(0),
+            inflight_(0), stopping_(false), failed_(false), mismatched_(0), lost_(0)
 #ifdef __FE_PROFILE_IO__
             , latency(MAX_LATENCY), minimum(MAX_LATENCY), maximum(0)
 #endif
@@ -51,7 +73,20 @@ namespace fastevent {
 
         ArduinoDriver::~ArduinoDriver()
         {
-            // do nothing
+            stop_pipeline();
+            delete echoes_;
+        }
+
+        char ArduinoDriver::encode(const char& cmd)
+        {
+            char out = arduino::CLEAR;
+            if (has_event(cmd)) {
+                out |= arduino::EVENT;
+            }
+            if (has_sync(cmd)) {
+                out |= arduino::SYNC;
+            }
+            return out;
         }
 
         void ArduinoDriver::clear()
@@ -98,17 +133,34 @@ namespace fastevent {
                 }
             }
 
+            const char out = encode(cmd);
+            if (reader_ != 0) {
+                // the echo is taken by EchoReader: wait until it arrives,
+                // or until EchoReader gives up on it (the deadline is only a safety net)
+                const uint64_t lost = lost_.load(std::memory_order_relaxed);
+                if (send(out, false, arduino::NO_TAG)) {
+                    const uint64_t deadline = monotonic_ns() + 2*ECHO_TIMEOUT_NS;
+                    while ((inflight_.load(std::memory_order_acquire) > 0) &&
+                           !failed_.load(std::memory_order_acquire)) {
+                        if (monotonic_ns() > deadline) {
+                            std::cerr << "***no echo from the Arduino" << std::endl;
+                            return;
+                        }
+                        cpu_relax();
+                    }
+                    if (lost_.load(std::memory_order_relaxed) != lost) {
+                        // sent again by the next update
+                        return;
+                    }
+                    prev_ = out;
+                }
+                return;
+            }
+
 #ifdef __FE_PROFILE_IO__
-            uint64_t start, stop;
+            uint64_t start;
             clock_.get(&start);
 #endif
-            char out = arduino::CLEAR;
-            if (has_event(cmd)) {
-                out |= arduino::EVENT;
-            }
-            if (has_sync(cmd)) {
-                out |= arduino::SYNC;
-            }
             switch (serial::put(port_, &out))
             {
             case serial::Success:
@@ -136,11 +188,20 @@ namespace fastevent {
                 return;
             }
 
-            // TODO: assert buf == out??
-            // for the moment, let us not do it since it seems worthless
+            if (buf != out) {
+                mismatched_.fetch_add(1, std::memory_order_relaxed);
+            }
             prev_ = out;
 
 #ifdef __FE_PROFILE_IO__
+            add_latency(start);
+#endif
+        }
+
+        void ArduinoDriver::add_latency(const uint64_t& start)
+        {
+#ifdef __FE_PROFILE_IO__
+            uint64_t stop;
             clock_.get(&stop);
             uint64_t lat = stop - start;
             latency.add(lat);
@@ -149,15 +210,217 @@ namespace fastevent {
 #endif
         }
 
+        void ArduinoDriver::start_pipeline(const size_t& depth)
+        {
+            if (closed_ || (reader_ != 0)) {
+                return;
+            }
+            depth_  = depth;
+            echoes_ = new Ring<Echo>(depth);
+            reader_ = new EchoReader(this);
+            reader_->start();
+            std::cerr << "sending up to " << depth << " commands ahead of their echoes." << std::endl;
+        }
+
+        void ArduinoDriver::stop_pipeline()
+        {
+            if (reader_ == 0) {
+                return;
+            }
+
+            // let the echoes of what has been sent arrive (for a while)
+            const uint64_t deadline = monotonic_ns() + ECHO_TIMEOUT_NS;
+            while ((inflight_.load(std::memory_order_acquire) > 0) &&
+                   !failed_.load(std::memory_order_acquire) &&
+                   (monotonic_ns() < deadline)) {
+                cpu_relax();
+            }
+            stopping_.store(true, std::memory_order_release);
+            reader_->join();
+            delete reader_;
+            reader_ = 0;
+
+            // (EchoReader is gone: the rest will never be echoed)
+            fail_outstanding();
+        }
+
+        bool ArduinoDriver::submit(const Command *commands, const size_t& count, const uint64_t& tag)
+        {
+            if (closed_ || (reader_ == 0)) {
+                return false;
+            }
+            // (every command is sent, as the completion comes with the echo of the last one)
+            for (size_t i=0; i<count; i++) {
+                const char out = encode(commands[i]);
+                if (!send(out, (i + 1 == count), tag)) {
+                    return false;
+                }
+                prev_ = out;
+            }
+            return true;
+        }
+
+        bool ArduinoDriver::send(const char& out, const bool& last, const uint64_t& tag)
+        {
+            if (inflight_.load(std::memory_order_acquire) >= depth_) {
+                const uint64_t deadline = monotonic_ns() + ECHO_TIMEOUT_NS;
+                while (inflight_.load(std::memory_order_acquire) >= depth_) {
+                    if (failed_.load(std::memory_order_acquire) || (monotonic_ns() > deadline)) {
+                        return false;
+                    }
+                    cpu_relax();
+                }
+            }
+            if (failed_.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            // the byte is counted and queued before it is sent, so that EchoReader
+            // never takes an echo (or gives up on a byte) before it is counted.
+            // (there is always a room, as the ring holds at least `depth_` bytes)
+            inflight_.fetch_add(1, std::memory_order_release);
+            Echo echo;
+            echo.sent    = out;
+            echo.last    = last;
+            echo.tag     = tag;
+            echo.sent_at = 0;
+#ifdef __FE_PROFILE_IO__
+            clock_.get(&echo.sent_at);
+#endif
+            echoes_->push(echo);
+
+            switch (serial::put(port_, &out))
+            {
+            case serial::Success:
+                return true;
+            case serial::Error:
+            default:
+                std::cerr << "***error sending serial command: "
+                          << ks::error_message() << std::endl;
+                failed_.store(true, std::memory_order_release);
+                shutdown();
+                return false;
+            }
+        }
+
+        void ArduinoDriver::read_echoes()
+        {
+            char     buf;
+            Echo     echo;
+            uint64_t current = arduino::NO_TAG;
+            bool     ok      = true; // whether the echoes of `current` have all matched
+            uint64_t waiting = 0;    // since when no echo has arrived for the outstanding bytes
+
+            while (!stopping_.load(std::memory_order_acquire)) {
+                switch (serial::get(port_, &buf, ECHO_POLL_MS))
+                {
+                case serial::Success:
+                    break;
+                case serial::Timeout:
+                    if (failed_.load(std::memory_order_acquire)) {
+                        fail_outstanding();
+                    } else if (inflight_.load(std::memory_order_acquire) == 0) {
+                        waiting = 0;
+                    } else if (waiting == 0) {
+                        waiting = monotonic_ns();
+                    } else if (monotonic_ns() - waiting > ECHO_TIMEOUT_NS) {
+                        // an echo has been lost: start over, rather than
+                        // matching the later echoes against the wrong bytes
+                        const size_t lost = fail_outstanding(true);
+                        std::cerr << "***no echo from the Arduino: gave up on "
+                                  << lost << " command(s)" << std::endl;
+                        waiting = 0;
+                    }
+                    continue;
+                case serial::Error:
+                    std::cerr << "***error receiving the response: "
+                              << ks::error_message() << std::endl;
+                    // fallthrough
+                case serial::Closed:
+                default:
+                    failed_.store(true, std::memory_order_release);
+                    fail_outstanding();
+                    return;
+                }
+
+                waiting = 0;
+                if (!echoes_->pop(&echo)) {
+                    // an echo of nothing
+                    mismatched_.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if (echo.tag != current) {
+                    current = echo.tag;
+                    ok      = true;
+                }
+                if (buf != echo.sent) {
+                    Echo next;
+                    if (echoes_->peek(&next) && (next.sent == buf)) {
+                        // the echo of `echo` has been lost, and this one is of the next byte:
+                        // give up on the former, rather than matching every later echo one off
+                        lost_.fetch_add(1, std::memory_order_relaxed);
+                        inflight_.fetch_sub(1, std::memory_order_release);
+                        if (echo.last) {
+                            completion_->completed(echo.tag, false);
+                        }
+                        ok = false;
+                        echoes_->pop(&echo);
+                        if (echo.tag != current) {
+                            current = echo.tag;
+                            ok      = true;
+                        }
+                    } else {
+                        mismatched_.fetch_add(1, std::memory_order_relaxed);
+                        ok = false;
+                    }
+                }
+#ifdef __FE_PROFILE_IO__
+                add_latency(echo.sent_at);
+#endif
+                inflight_.fetch_sub(1, std::memory_order_release);
+                if (echo.last) {
+                    completion_->completed(echo.tag, ok);
+                }
+            }
+        }
+
+        size_t ArduinoDriver::fail_outstanding(const bool& lost)
+        {
+            Echo   echo;
+            size_t count = 0;
+            while (echoes_->pop(&echo)) {
+                if (lost) {
+                    // counted before it stops being in flight, for update()
+                    lost_.fetch_add(1, std::memory_order_relaxed);
+                }
+                inflight_.fetch_sub(1, std::memory_order_release);
+                if (echo.last) {
+                    completion_->completed(echo.tag, false);
+                }
+                count++;
+            }
+            return count;
+        }
+
         void ArduinoDriver::shutdown()
         {
             if (!closed_)
             {
                 std::cerr << "shutting down ArduinoDriver." << std::endl;
+                stop_pipeline();
                 serial::put(port_, &arduino::CLEAR);
                 serial::close(port_);
                 closed_ = true;
 
+                const uint64_t mismatched = mismatched_.load(std::memory_order_relaxed);
+                if (mismatched > 0) {
+                    std::cerr << "***echoes that did not match the commands sent: " << mismatched << std::endl;
+                }
+                const uint64_t lost = lost_.load(std::memory_order_relaxed);
+                if (lost > 0) {
+                    std::cerr << "***commands given up on for the lack of their echoes: " << lost << std::endl;
+                }
+
 #ifdef __FE_PROFILE_IO__
                 double lat = latency.get();
                 std::cerr << "------------------------------------------------" << std::endl;
@@ -172,6 +435,15 @@ namespace fastevent {
             }
         }
 
+        int ArduinoDriver::descriptor() const
+        {
+#ifdef _WIN32
+            return -1;
+#else
+            return closed_? -1 : port_;
+#endif
+        }
+
         const std::string LeonardoDriver::_identifier("leonardo");
 
         const std::string& LeonardoDriver::identifier()
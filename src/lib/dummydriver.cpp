@@ -48,11 +48,6 @@ namespace fastevent {
             // do nothing
         }
 
-        void DummyDriver::update(const char& out)
-        {
-            // do nothing
-        }
-
         void DummyDriver::shutdown()
         {
             std::cout << "shutting down DummyDriver." << std::endl;
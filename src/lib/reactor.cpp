@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   reactor.cpp -- see reactor.h for description
+*/
+#include "reactor.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+
+namespace fastevent {
+
+    /**
+    *   the maximal number of registrations per Reactor
+    */
+    const size_t MAX_ENTRIES = 128;
+
+#ifndef _WIN32
+    /**
+    *   monotonic clock in nanoseconds (used by the select-based timers)
+    */
+    inline uint64_t monotonic_now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+    }
+#endif
+
+    Reactor::Entry *Reactor::push(const Kind& kind, const socket_t& fd, void *context, const bool& readable)
+    {
+        Entry entry;
+        entry.kind      = kind;
+        entry.fd        = fd;
+        entry.context   = context;
+        entry.readable  = readable;
+        entry.interval  = 0;
+        entry.next      = 0;
+        entry.active    = true;
+
+        for (std::vector<Entry>::iterator it=entries_.begin(); it!=entries_.end(); it++) {
+            if (!it->active) {
+                *it = entry;
+                return &(*it);
+            }
+        }
+        if (entries_.size() == MAX_ENTRIES) {
+            return 0;
+        }
+        entries_.push_back(entry);
+        return &(entries_.back());
+    }
+
+    bool Reactor::remove(const socket_t& fd)
+    {
+        for (std::vector<Entry>::iterator it=entries_.begin(); it!=entries_.end(); it++) {
+            if (it->active && (it->kind == Descriptor) && (it->fd == fd)) {
+#ifdef __linux__
+                epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, 0);
+#endif
+                it->active = false;
+                return true;
+            }
+        }
+        return false;
+    }
+
+#ifdef __linux__
+    Reactor::Reactor(): entries_(), wakeup_fd_(-1)
+    {
+        entries_.reserve(MAX_ENTRIES);
+        epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    Reactor::~Reactor()
+    {
+        for (std::vector<Entry>::iterator it=entries_.begin(); it!=entries_.end(); it++) {
+            if (it->active && (it->kind != Descriptor)) {
+                ::close(it->fd);
+            }
+        }
+        if (epoll_ >= 0) {
+            ::close(epoll_);
+        }
+    }
+
+    bool Reactor::add(const socket_t& fd, void *context, const bool& readable)
+    {
+        Entry *entry = push(Descriptor, fd, context, readable);
+        if ((epoll_ < 0) || (entry == 0)) {
+            return false;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = readable? EPOLLIN : 0;
+        ev.data.ptr = entry;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            entry->active = false;
+            return false;
+        }
+        return true;
+    }
+
+    bool Reactor::add_timer(const uint64_t& interval, void *context)
+    {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct itimerspec spec;
+        spec.it_interval.tv_sec  = interval / 1000000000ULL;
+        spec.it_interval.tv_nsec = interval % 1000000000ULL;
+        spec.it_value            = spec.it_interval;
+        if (timerfd_settime(fd, 0, &spec, 0) != 0) {
+            ::close(fd);
+            return false;
+        }
+
+        Entry *entry = push(Timer, fd, context, true);
+        if (entry == 0) {
+            ::close(fd);
+            return false;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = EPOLLIN;
+        ev.data.ptr = entry;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            entry->active = false;
+            ::close(fd);
+            return false;
+        }
+        return true;
+    }
+
+    bool Reactor::add_wakeup(void *context)
+    {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        Entry *entry = push(Wakeup, fd, context, true);
+        if (entry == 0) {
+            ::close(fd);
+            return false;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = EPOLLIN;
+        ev.data.ptr = entry;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            entry->active = false;
+            ::close(fd);
+            return false;
+        }
+        wakeup_fd_ = fd;
+        return true;
+    }
+
+    void Reactor::wakeup()
+    {
+        if (wakeup_fd_ >= 0) {
+            uint64_t one = 1;
+            ssize_t ret = ::write(wakeup_fd_, &one, sizeof(one));
+            (void)ret;
+        }
+    }
+
+    int Reactor::wait(Event *events, const int& max)
+    {
+        struct epoll_event ready[MAX_ENTRIES];
+        int count = max;
+        if (count > static_cast<int>(MAX_ENTRIES)) {
+            count = MAX_ENTRIES;
+        }
+
+        int n;
+        do {
+            n = epoll_wait(epoll_, ready, count, -1);
+        } while ((n < 0) && (errno == EINTR));
+        if (n < 0) {
+            return -1;
+        }
+
+        for (int i=0; i<n; i++) {
+            Entry *entry = static_cast<Entry *>(ready[i].data.ptr);
+            if (entry->kind != Descriptor) {
+                // consume the timer expirations/wakeup count
+                uint64_t value;
+                ssize_t ret = ::read(entry->fd, &value, sizeof(value));
+                (void)ret;
+            }
+            events[i].kind      = entry->kind;
+            events[i].context   = entry->context;
+            events[i].readable  = ((ready[i].events & EPOLLIN) != 0);
+            events[i].hangup    = ((ready[i].events & (EPOLLHUP | EPOLLERR)) != 0);
+        }
+        return n;
+    }
+
+#else
+    Reactor::Reactor(): entries_(), wakeup_fd_(-1)
+    {
+        entries_.reserve(MAX_ENTRIES);
+        pipe_[0] = pipe_[1] = -1;
+    }
+
+    Reactor::~Reactor()
+    {
+#ifndef _WIN32
+        if (pipe_[0] >= 0) {
+            ::close(pipe_[0]);
+            ::close(pipe_[1]);
+        }
+#endif
+    }
+
+    bool Reactor::add(const socket_t& fd, void *context, const bool& readable)
+    {
+        // select(2) has no way to report hang-ups only
+        return readable && (push(Descriptor, fd, context, true) != 0);
+    }
+
+    bool Reactor::add_timer(const uint64_t& interval, void *context)
+    {
+#ifdef _WIN32
+        return false;
+#else
+        Entry *entry = push(Timer, static_cast<socket_t>(-1), context, false);
+        if (entry == 0) {
+            return false;
+        }
+        entry->interval = interval;
+        entry->next     = monotonic_now() + interval;
+        return true;
+#endif
+    }
+
+    bool Reactor::add_wakeup(void *context)
+    {
+#ifdef _WIN32
+        return false;
+#else
+        if (pipe(pipe_) != 0) {
+            return false;
+        }
+        fcntl(pipe_[0], F_SETFL, O_NONBLOCK);
+        fcntl(pipe_[1], F_SETFL, O_NONBLOCK);
+        if (push(Wakeup, pipe_[0], context, true) == 0) {
+            return false;
+        }
+        wakeup_fd_ = pipe_[1];
+        return true;
+#endif
+    }
+
+    void Reactor::wakeup()
+    {
+#ifndef _WIN32
+        if (wakeup_fd_ >= 0) {
+            char one = 1;
+            ssize_t ret = ::write(wakeup_fd_, &one, 1);
+            (void)ret;
+        }
+#endif
+    }
+
+    int Reactor::wait(Event *events, const int& max)
+    {
+        while (true) {
+            fd_set  fdread;
+            int     fdwatch = 0;
+            FD_ZERO(&fdread);
+
+            bool     has_timer = false;
+            uint64_t next      = 0;
+            for (std::vector<Entry>::iterator it=entries_.begin(); it!=entries_.end(); it++) {
+                if (!it->active) {
+                    continue;
+                } else if (it->kind == Timer) {
+                    if (!has_timer || (it->next < next)) {
+                        next = it->next;
+                    }
+                    has_timer = true;
+                } else {
+                    FD_SET(it->fd, &fdread);
+                    if (static_cast<int>(it->fd) + 1 > fdwatch) {
+                        fdwatch = static_cast<int>(it->fd) + 1;
+                    }
+                }
+            }
+
+            struct timeval  timeout;
+            struct timeval *ptimeout = 0;
+#ifndef _WIN32
+            if (has_timer) {
+                uint64_t now  = monotonic_now();
+                uint64_t wait = (next > now)? (next - now) : 0;
+                timeout.tv_sec  = wait / 1000000000ULL;
+                timeout.tv_usec = (wait % 1000000000ULL) / 1000;
+                ptimeout = &timeout;
+            }
+#endif
+            if (select(fdwatch, &fdread, NULL, NULL, ptimeout) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+
+            int n = 0;
+#ifndef _WIN32
+            uint64_t now = monotonic_now();
+#endif
+            for (std::vector<Entry>::iterator it=entries_.begin();
+                 (it!=entries_.end()) && (n<max); it++)
+            {
+                if (!it->active) {
+                    continue;
+                } else if (it->kind == Timer) {
+#ifndef _WIN32
+                    if (it->next > now) {
+                        continue;
+                    }
+                    while (it->next <= now) {
+                        it->next += it->interval;
+                    }
+#endif
+                } else if (!FD_ISSET(it->fd, &fdread)) {
+                    continue;
+                }
+#ifndef _WIN32
+                if (it->kind == Wakeup) {
+                    char buf[16];
+                    while (::read(it->fd, buf, sizeof(buf)) > 0) { }
+                }
+#endif
+                events[n].kind      = it->kind;
+                events[n].context   = it->context;
+                events[n].readable  = (it->kind == Descriptor);
+                events[n].hangup    = false;
+                n++;
+            }
+            if (n > 0) {
+                return n;
+            }
+        }
+    }
+#endif
+}
@@ -0,0 +1,497 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   rt.cpp -- see rt.h for description
+*/
+#include "rt.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#else
+#include <malloc.h>
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+namespace fastevent {
+    namespace rt {
+#ifdef __linux__
+        inline int native_policy(const Scheduling& scheduling)
+        {
+            switch (scheduling) {
+            case FIFO:  return SCHED_FIFO;
+            case RR:    return SCHED_RR;
+            case Other:
+            default:    return SCHED_OTHER;
+            }
+        }
+
+        /**
+        *   sets the scheduling policy of the calling thread.
+        *   returns 0, or the error number.
+        */
+        inline int set_scheduling(const Scheduling& scheduling, const int& priority)
+        {
+            struct sched_param param;
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = (scheduling == Other)? 0 : priority;
+            return pthread_setschedparam(pthread_self(), native_policy(scheduling), &param);
+        }
+
+        inline std::string describe_error(const int& err)
+        {
+            std::stringstream ss;
+            ss << strerror(err);
+            if (err == EPERM) {
+                ss << " (real-time scheduling requires root, CAP_SYS_NICE, or a sufficient RLIMIT_RTPRIO)";
+            }
+            return ss.str();
+        }
+#endif
+
+        ks::Result<ThreadPolicy> parse_policy(Config& cfg)
+        {
+            ThreadPolicy policy;
+            if (json::has(cfg, "cpus")) {
+                json::array cpus(json::get<json::array>(cfg, "cpus"));
+                for (json::iterator it=cpus.begin(); it!=cpus.end(); it++) {
+                    if (!it->is<double>()) {
+                        return ks::Result<ThreadPolicy>::failure("malformed 'cpus' attribute");
+                    }
+                    policy.cpus.push_back(static_cast<int>(it->get<double>()));
+                }
+            }
+
+            std::string name(json::get<std::string>(cfg, "policy", "inherit"));
+            if (name == "inherit") {
+                policy.scheduling = Inherit;
+            } else if ((name == "other") || (name == "SCHED_OTHER")) {
+                policy.scheduling = Other;
+            } else if ((name == "fifo") || (name == "SCHED_FIFO")) {
+                policy.scheduling = FIFO;
+            } else if ((name == "rr") || (name == "SCHED_RR")) {
+                policy.scheduling = RR;
+            } else {
+                return ks::Result<ThreadPolicy>::failure("unknown 'policy' '" + name + "'"
+                                                         " (must be one of 'other', 'fifo' or 'rr')");
+            }
+            policy.priority = json::get<int>(cfg, "priority", 0);
+
+#ifdef __linux__
+            if ((policy.scheduling == FIFO) || (policy.scheduling == RR)) {
+                const int lo = sched_get_priority_min(native_policy(policy.scheduling));
+                const int hi = sched_get_priority_max(native_policy(policy.scheduling));
+                if ((policy.priority < lo) || (policy.priority > hi)) {
+                    std::stringstream ss;
+                    ss << "'priority' must be in the range " << lo << "-" << hi
+                       << " for the '" << name << "' policy";
+                    return ks::Result<ThreadPolicy>::failure(ss.str());
+                }
+            }
+#endif
+            return ks::Result<ThreadPolicy>::success(policy);
+        }
+
+        ks::Result<bool> check(const ThreadPolicy& policy)
+        {
+            if (policy.is_default()) {
+                return ks::Result<bool>::success(true);
+            }
+#ifdef __linux__
+            if (policy.cpus.size() > 0) {
+                cpu_set_t allowed;
+                if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+                    return ks::Result<bool>::failure("failed to get the CPU affinity: " + ks::error_message());
+                }
+                for (std::vector<int>::const_iterator it=policy.cpus.begin(); it!=policy.cpus.end(); it++) {
+                    if ((*it < 0) || (*it >= CPU_SETSIZE) || (!CPU_ISSET(*it, &allowed))) {
+                        std::stringstream ss;
+                        ss << "CPU " << *it << " is not available to this process";
+                        return ks::Result<bool>::failure(ss.str());
+                    }
+                }
+            }
+
+            if (policy.scheduling != Inherit) {
+                // try it on the calling thread, and restore it
+                int                 original;
+                struct sched_param  param;
+                pthread_getschedparam(pthread_self(), &original, &param);
+                int err = set_scheduling(policy.scheduling, policy.priority);
+                pthread_setschedparam(pthread_self(), original, &param);
+                if (err != 0) {
+                    return ks::Result<bool>::failure("cannot set the scheduling policy: " + describe_error(err));
+                }
+            }
+            return ks::Result<bool>::success(true);
+#else
+            return ks::Result<bool>::failure("CPU affinity and scheduling policies are only supported on Linux");
+#endif
+        }
+
+        ks::Result<bool> apply(const ThreadPolicy& policy)
+        {
+            if (policy.cpus.size() > 0) {
+                ks::Result<bool> pinned = set_affinity(policy.cpus);
+                if (pinned.failed()) {
+                    return pinned;
+                }
+            }
+            if (policy.scheduling != Inherit) {
+#ifdef __linux__
+                int err = set_scheduling(policy.scheduling, policy.priority);
+                if (err != 0) {
+                    return ks::Result<bool>::failure("failed to set the scheduling policy: " + describe_error(err));
+                }
+#else
+                return ks::Result<bool>::failure("scheduling policies are only supported on Linux");
+#endif
+            }
+            return ks::Result<bool>::success(true);
+        }
+
+        /**
+        *   whether or not enable_realtime() has been called
+        */
+        bool realtime = false;
+
+        /**
+        *   the descriptor of /dev/cpu_dma_latency, held open
+        */
+        int  dma_latency = -1;
+
+#if defined(__GNUC__)
+        __attribute__((noinline))
+#endif
+        void prefault_stack()
+        {
+            volatile char region[PREFAULT_STACK_SIZE];
+            char          sum = 0;
+            for (size_t i=0; i<PREFAULT_STACK_SIZE; i+=1024) {
+                region[i] = 0;
+            }
+            // (read it back, so that the writes cannot be taken as unused)
+            for (size_t i=0; i<PREFAULT_STACK_SIZE; i+=1024) {
+                sum += region[i];
+            }
+            (void)sum;
+        }
+
+        void setup_thread(const ThreadPolicy& policy, const std::string& name)
+        {
+            if (realtime) {
+                prefault_stack();
+            }
+            if (policy.is_default()) {
+                return;
+            }
+            ks::Result<bool> applied = apply(policy);
+            if (applied.failed()) {
+                std::cerr << "***" << name << " thread: " << applied.what() << std::endl;
+            }
+        }
+
+        ks::Result<bool> enable_realtime()
+        {
+#ifdef _WIN32
+            return ks::Result<bool>::failure("the real-time mode is not supported on Windows");
+#else
+            if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+                return ks::Result<bool>::failure("failed to lock the memory: " + ks::error_message()
+                                                 + " (requires root, CAP_IPC_LOCK or a sufficient RLIMIT_MEMLOCK)");
+            }
+            realtime = true;
+            prefault_stack();
+
+            if (dma_latency < 0) {
+                dma_latency = ::open("/dev/cpu_dma_latency", O_WRONLY);
+                int32_t zero = 0;
+                if ((dma_latency < 0) || (::write(dma_latency, &zero, sizeof(zero)) != sizeof(zero))) {
+                    std::cerr << "***failed to hold /dev/cpu_dma_latency at 0: " << ks::error_message()
+                              << "; the CPUs may still enter deep C-states." << std::endl;
+                    if (dma_latency >= 0) {
+                        ::close(dma_latency);
+                        dma_latency = -1;
+                    }
+                }
+            }
+            return ks::Result<bool>::success(true);
+#endif
+        }
+
+        bool realtime_enabled()
+        {
+            return realtime;
+        }
+
+#ifdef __FE_ALLOC_GUARD__
+        /**
+        *   the innermost hot section of the calling thread, if any
+        */
+        thread_local const char *hot_section = 0;
+
+        std::atomic<uint64_t> allocations(0);
+        std::atomic<uint64_t> stream_writes(0);
+
+        /**
+        *   reports without allocating, nor going through iostream
+        */
+        void report_violation(const char *what, const char *section)
+        {
+            char msg[160];
+            int len = snprintf(msg, sizeof(msg), "***%s in %s\n", what, section);
+            if (len > 0) {
+#ifdef _WIN32
+                fputs(msg, stderr);
+#else
+                ssize_t ret = ::write(2, msg, (len < (int)sizeof(msg))? len : sizeof(msg)-1);
+                (void)ret;
+#endif
+            }
+        }
+
+        /**
+        *   a pass-through stream buffer that reports writes within hot sections
+        */
+        class GuardedBuffer: public std::streambuf
+        {
+        public:
+            explicit GuardedBuffer(std::streambuf *wrapped): wrapped_(wrapped) { }
+
+        protected:
+            int_type overflow(int_type c)
+            {
+                check();
+                return traits_type::eq_int_type(c, traits_type::eof())?
+                            traits_type::not_eof(c) : wrapped_->sputc(traits_type::to_char_type(c));
+            }
+
+            std::streamsize xsputn(const char *s, std::streamsize n)
+            {
+                check();
+                return wrapped_->sputn(s, n);
+            }
+
+            int sync() { return wrapped_->pubsync(); }
+
+        private:
+            void check()
+            {
+                if (hot_section != 0) {
+                    stream_writes.fetch_add(1, std::memory_order_relaxed);
+                    const char *section = hot_section;
+                    hot_section = 0;    // do not recurse
+                    report_violation("iostream usage", section);
+                    hot_section = section;
+                }
+            }
+
+            std::streambuf *wrapped_;
+        };
+
+        /**
+        *   installs the guarded buffers on the standard streams at startup
+        */
+        struct StreamGuard
+        {
+            StreamGuard():
+                out_(std::cout.rdbuf()), err_(std::cerr.rdbuf()), log_(std::clog.rdbuf())
+            {
+                std::cout.rdbuf(&out_);
+                std::cerr.rdbuf(&err_);
+                std::clog.rdbuf(&log_);
+            }
+
+            GuardedBuffer out_, err_, log_;
+        };
+
+        std::ios_base::Init stream_init;
+        StreamGuard         stream_guard;
+
+        HotSection::HotSection(const char *name): previous_(hot_section)
+        {
+            hot_section = name;
+        }
+
+        HotSection::~HotSection()
+        {
+            hot_section = previous_;
+        }
+
+        uint64_t hot_allocations()   { return allocations.load(std::memory_order_relaxed); }
+        uint64_t hot_stream_writes() { return stream_writes.load(std::memory_order_relaxed); }
+#else
+        uint64_t hot_allocations()   { return 0; }
+        uint64_t hot_stream_writes() { return 0; }
+#endif
+
+        ks::Result<bool> set_affinity(const std::vector<int>& cpus)
+        {
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (std::vector<int>::const_iterator it=cpus.begin(); it!=cpus.end(); it++) {
+                if ((*it < 0) || (*it >= CPU_SETSIZE)) {
+                    std::stringstream ss;
+                    ss << "invalid CPU number: " << *it;
+                    return ks::Result<bool>::failure(ss.str());
+                }
+                CPU_SET(*it, &set);
+            }
+            int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (err != 0) {
+                std::stringstream ss;
+                ss << "failed to set CPU affinity: " << strerror(err);
+                return ks::Result<bool>::failure(ss.str());
+            }
+            return ks::Result<bool>::success(true);
+#else
+            return ks::Result<bool>::failure("CPU affinity is only supported on Linux");
+#endif
+        }
+    }
+}
+
+#ifdef __FE_ALLOC_GUARD__
+/**
+*   the global allocation functions, reporting allocations within hot sections
+*/
+static inline void check_allocation()
+{
+    if (fastevent::rt::hot_section != 0) {
+        fastevent::rt::allocations.fetch_add(1, std::memory_order_relaxed);
+        const char *section = fastevent::rt::hot_section;
+        fastevent::rt::hot_section = 0;     // do not recurse
+        fastevent::rt::report_violation("heap allocation", section);
+        fastevent::rt::hot_section = section;
+    }
+}
+
+/**
+*   (out of line, so that the compiler does not pair the free() with the operator new)
+*/
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void deallocate(void *ptr)
+{
+    std::free(ptr);
+}
+
+void *operator new(size_t size)
+{
+    check_allocation();
+    void *ptr = std::malloc((size > 0)? size : 1);
+    if (ptr == 0) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    deallocate(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    deallocate(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+    deallocate(ptr);
+}
+
+void operator delete[](void *ptr, size_t size) noexcept
+{
+    deallocate(ptr);
+}
+
+#ifdef __cpp_aligned_new
+/**
+*   the same for the over-aligned types (e.g. the cache-line aligned ones)
+*/
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    check_allocation();
+    const size_t align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+    void *ptr = _aligned_malloc((size > 0)? size : 1, align);
+#else
+    void *ptr = 0;
+    if (posix_memalign(&ptr, (align < sizeof(void *))? sizeof(void *) : align, (size > 0)? size : 1) != 0) {
+        ptr = 0;
+    }
+#endif
+    if (ptr == 0) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void *ptr, std::align_val_t alignment) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    deallocate(ptr);
+#endif
+}
+
+void operator delete[](void *ptr, std::align_val_t alignment) noexcept
+{
+    operator delete(ptr, alignment);
+}
+
+void operator delete(void *ptr, size_t size, std::align_val_t alignment) noexcept
+{
+    operator delete(ptr, alignment);
+}
+
+void operator delete[](void *ptr, size_t size, std::align_val_t alignment) noexcept
+{
+    operator delete(ptr, alignment);
+}
+#endif
+#endif
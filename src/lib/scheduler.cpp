@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   scheduler.cpp -- see scheduler.h for description
+*/
+#include "scheduler.h"
+#include "service.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace fastevent {
+
+    const double Scheduler::DEFAULT_BURST = 8;
+
+    bool ClientClass::matches(const network::Address& address, const uint8_t& address_len) const
+    {
+        switch (kind) {
+        case Any:
+            return true;
+        case Network:
+            return (address_len > 0) && (address.any.sa_family == AF_INET)
+                    && (address.in.sin_addr.s_addr == host)
+                    && ((port == 0) || (address.in.sin_port == port));
+        case Connection:
+            return (address_len == 0);
+#ifndef _WIN32
+        case LocalPath:
+            {
+                const size_t offset = offsetof(struct sockaddr_un, sun_path);
+                if ((address_len <= offset) || (address.any.sa_family != AF_UNIX)) {
+                    return false;
+                }
+                const size_t len = strnlen(address.un.sun_path, address_len - offset);
+                return (len == path.size()) && (memcmp(address.un.sun_path, path.c_str(), len) == 0);
+            }
+        case SharedMemory:
+            return (address_len > 0) && (address.any.sa_family == AF_UNSPEC);
+#endif
+        default:
+            return false;
+        }
+    }
+
+    ks::Result<ClientClass> parse_client_class(Config& cfg)
+    {
+        ClientClass cls;
+        cls.match = json::get<std::string>(cfg, "match", "*");
+        if (cls.match == "*") {
+            cls.kind = ClientClass::Any;
+        } else if (cls.match == "seqpacket") {
+            cls.kind = ClientClass::Connection;
+        } else if (cls.match == "shm") {
+            cls.kind = ClientClass::SharedMemory;
+        } else if (cls.match[0] == '/') {
+            cls.kind = ClientClass::LocalPath;
+            cls.path = cls.match;
+        } else {
+            cls.kind = ClientClass::Network;
+            std::string host(cls.match);
+            const size_t colon = host.find(':');
+            if (colon != std::string::npos) {
+                const int port = atoi(host.c_str() + colon + 1);
+                if ((port <= 0) || (port > 65535)) {
+                    return ks::Result<ClientClass>::failure("malformed port in 'match': '" + cls.match + "'");
+                }
+                cls.port = htons(static_cast<uint16_t>(port));
+                host     = host.substr(0, colon);
+            }
+#ifdef _WIN32
+            cls.host = inet_addr(host.c_str());
+            const bool valid = (cls.host != INADDR_NONE);
+#else
+            struct in_addr addr;
+            const bool valid = (inet_pton(AF_INET, host.c_str(), &addr) == 1);
+            cls.host = addr.s_addr;
+#endif
+            if (!valid) {
+                return ks::Result<ClientClass>::failure("'match' must be an IPv4 address, a path, "
+                                                        "'seqpacket', 'shm' or '*' (got '" + cls.match + "')");
+            }
+        }
+
+        const int weight = json::get<int>(cfg, "weight", 1);
+        if (weight < 1) {
+            return ks::Result<ClientClass>::failure("'weight' must be positive");
+        }
+        cls.weight = static_cast<unsigned>(weight);
+        cls.rate   = json::get<double>(cfg, "rate_hz", 0);
+        cls.burst  = json::get<double>(cfg, "burst", Scheduler::DEFAULT_BURST);
+        if (cls.rate < 0) {
+            return ks::Result<ClientClass>::failure("'rate_hz' must not be negative");
+        }
+        if (cls.burst < 1) {
+            return ks::Result<ClientClass>::failure("'burst' must be at least 1");
+        }
+
+        const std::string ack(json::get<std::string>(cfg, "ack", "commit"));
+        if (ack == "commit") {
+            cls.ack = AckOnCommit;
+        } else if (ack == "receive") {
+            cls.ack = AckOnReceive;
+        } else if (ack == "none") {
+            cls.ack = NoAck;
+        } else {
+            return ks::Result<ClientClass>::failure("'ack' must be one of 'commit', 'receive' and 'none'");
+        }
+        return ks::Result<ClientClass>::success(cls);
+    }
+
+    Scheduler::Scheduler(SessionTable *sessions, const std::vector<ClientClass>& classes,
+                         const size_t& capacity, const size_t& client_depth):
+        sessions_(sessions), classes_(classes), default_class_(), client_depth_(client_depth),
+        nodes_(new Packet[capacity]()), next_(new uint32_t[capacity]), free_(NIL), queued_(0),
+        num_sessions_(sessions->size()),
+        head_(new uint32_t[num_sessions_]), tail_(new uint32_t[num_sessions_]),
+        count_(new uint32_t[num_sessions_]()), generation_(new uint32_t[num_sessions_]()),
+        class_(new const ClientClass *[num_sessions_]), deficit_(new uint32_t[num_sessions_]()),
+        visited_(new bool[num_sessions_]()), tokens_(new double[num_sessions_]()),
+        refilled_(new uint64_t[num_sessions_]()),
+        round_(new uint16_t[num_sessions_]), round_head_(0), round_size_(0),
+        limited_(0), overflow_(0)
+    {
+        for (size_t i=capacity; i>0; i--) {
+            next_[i-1] = free_;
+            free_      = static_cast<uint32_t>(i-1);
+        }
+        for (size_t i=0; i<num_sessions_; i++) {
+            head_[i]  = NIL;
+            tail_[i]  = NIL;
+            class_[i] = &default_class_;
+        }
+    }
+
+    Scheduler::~Scheduler()
+    {
+        delete[] nodes_;
+        delete[] next_;
+        delete[] head_;
+        delete[] tail_;
+        delete[] count_;
+        delete[] generation_;
+        delete[] class_;
+        delete[] deficit_;
+        delete[] visited_;
+        delete[] tokens_;
+        delete[] refilled_;
+        delete[] round_;
+    }
+
+    void Scheduler::assign(const uint16_t& handle, const uint64_t& now)
+    {
+        // (the previous client of the session has no request left)
+        const network::Address& address = sessions_->address(handle);
+        const uint8_t           len     = sessions_->address_len(handle);
+        generation_[handle] = sessions_->generation(handle);
+        class_[handle]      = &default_class_;
+        for (size_t i=0; i<classes_.size(); i++) {
+            if (classes_[i].matches(address, len)) {
+                class_[handle] = &(classes_[i]);
+                break;
+            }
+        }
+        deficit_[handle]  = 0;
+        visited_[handle]  = false;
+        tokens_[handle]   = class_[handle]->burst;
+        refilled_[handle] = now;
+    }
+
+    bool Scheduler::push(const Packet& packet, const uint64_t& now)
+    {
+        const uint16_t handle = packet.session;
+        if (generation_[handle] != sessions_->generation(handle)) {
+            assign(handle, now);
+        }
+
+        if ((count_[handle] >= client_depth_) || (free_ == NIL)) {
+            overflow_.fetch_add(1, std::memory_order_relaxed);
+            sessions_->release(handle, true);
+            return false;
+        }
+
+        const ClientClass& cls = *(class_[handle]);
+        if (cls.rate > 0) {
+            tokens_[handle] += (now - refilled_[handle]) * cls.rate / 1e9;
+            if (tokens_[handle] > cls.burst) {
+                tokens_[handle] = cls.burst;
+            }
+            refilled_[handle] = now;
+            if (tokens_[handle] < 1.0) {
+                limited_.fetch_add(1, std::memory_order_relaxed);
+                sessions_->release(handle, true);
+                return false;
+            }
+            tokens_[handle] -= 1.0;
+        }
+
+        const uint32_t index = free_;
+        free_         = next_[index];
+        nodes_[index] = packet;
+        next_[index]  = NIL;
+        if (count_[handle] == 0) {
+            head_[handle] = index;
+            // the client joins the round
+            round_[(round_head_ + round_size_) % num_sessions_] = handle;
+            round_size_++;
+        } else {
+            next_[tail_[handle]] = index;
+        }
+        tail_[handle] = index;
+        count_[handle]++;
+        queued_++;
+        return true;
+    }
+
+    void Scheduler::take(const uint16_t& handle, Packet *packet)
+    {
+        const uint32_t index = head_[handle];
+        *packet       = nodes_[index];
+        head_[handle] = next_[index];
+        if (head_[handle] == NIL) {
+            tail_[handle] = NIL;
+        }
+        count_[handle]--;
+        queued_--;
+        next_[index]  = free_;
+        free_         = index;
+    }
+
+    void Scheduler::retire_head()
+    {
+        round_head_ = (round_head_ + 1) % num_sessions_;
+        round_size_--;
+    }
+
+    bool Scheduler::pop(Packet *packet)
+    {
+        while (round_size_ > 0) {
+            const uint16_t handle = round_[round_head_];
+            if (!visited_[handle]) {
+                // the turn of the client begins
+                visited_[handle] = true;
+                deficit_[handle] += class_[handle]->weight;
+            }
+            if (deficit_[handle] > 0) {
+                deficit_[handle]--;
+                take(handle, packet);
+                if (count_[handle] == 0) {
+                    // an idle client keeps no credit
+                    deficit_[handle] = 0;
+                    visited_[handle] = false;
+                    retire_head();
+                }
+                return true;
+            }
+
+            // the turn is over; to the back of the round
+            visited_[handle] = false;
+            retire_head();
+            round_[(round_head_ + round_size_) % num_sessions_] = handle;
+            round_size_++;
+        }
+        return false;
+    }
+
+    bool Scheduler::pop_listener(const uint8_t& listener, Packet *packet)
+    {
+        for (size_t i=0; i<round_size_; i++) {
+            const size_t   position = (round_head_ + i) % num_sessions_;
+            const uint16_t handle   = round_[position];
+            if (nodes_[head_[handle]].listener != listener) {
+                continue;
+            }
+            take(handle, packet);
+            if (count_[handle] == 0) {
+                deficit_[handle] = 0;
+                visited_[handle] = false;
+                // close the gap in the round
+                for (size_t j=i; j+1<round_size_; j++) {
+                    round_[(round_head_ + j) % num_sessions_] = round_[(round_head_ + j + 1) % num_sessions_];
+                }
+                round_size_--;
+            }
+            return true;
+        }
+        return false;
+    }
+}
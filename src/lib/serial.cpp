@@ -28,6 +28,8 @@
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 #include <string.h>
 #endif
 
@@ -125,6 +127,35 @@ namespace fastevent
             return Success;
         }
 
+        Status get(serial_t port, char* c, const int& timeout_ms)
+        {
+            DWORD count = 0;
+
+            // as in get() above, but the completion is waited on
+            // through an event object that can time out.
+            OVERLAPPED event;
+            SecureZeroMemory(&event,sizeof(event));
+            if ((event.hEvent = CreateEvent(0, TRUE, FALSE, 0)) == 0) {
+                return Error;
+            }
+
+            Status status = Success;
+            if (ReadFile(port, c, 1, 0, &event) == 0)
+            {
+                if (GetLastError() != ERROR_IO_PENDING) {
+                    status = Error;
+                } else if (WaitForSingleObject(event.hEvent, timeout_ms) == WAIT_TIMEOUT) {
+                    // cancel the read operation (it may still have completed in the meantime)
+                    CancelIo(port);
+                    status = (GetOverlappedResult(port, &event, &count, TRUE) && (count == 1))? Success : Timeout;
+                } else if (!GetOverlappedResult(port, &event, &count, TRUE) || (count == 0)) {
+                    status = Error;
+                }
+            }
+            CloseHandle(event.hEvent);
+            return status;
+        }
+
 
         Status put(serial_t port, const char* c)
         {
@@ -236,6 +267,38 @@ namespace fastevent
             return Success;
         }
 
+        Status get(serial_t port, char* c, const int& timeout_ms)
+        {
+            struct pollfd fds;
+            fds.fd      = port;
+            fds.events  = POLLIN;
+            fds.revents = 0;
+
+            switch (::poll(&fds, 1, timeout_ms))
+            {
+            case 0:
+                return Timeout;
+            case -1:
+                return (errno == EINTR)? Timeout : Error;
+            default:
+                break;
+            }
+            if (fds.revents & POLLNVAL) {
+                return Error;
+            }
+
+            // read even on POLLHUP/POLLERR, so that the bytes before a hang-up are not lost
+            switch (::read(port, c, 1))
+            {
+            case 1:
+                return Success;
+            case 0:
+                return Closed;
+            default:
+                return ((errno == EAGAIN) || (errno == EINTR))? Timeout : Error;
+            }
+        }
+
         Status put(serial_t port, const char* c)
         {
             int resp;
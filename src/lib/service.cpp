@@ -21,6 +21,8 @@
 */
 #include "service.h"
 #include "dummydriver.h"
+#include "rt.h"
+#include "uring.h"
 
 #ifdef _WIN32
 typedef int             socketlen_t;
@@ -30,11 +32,22 @@ typedef char *          optionvalue_t;
 #include <unistd.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#endif
 const int INVALID_SOCKET = -1;
 const int SOCKET_ERROR  = -1;
 
 typedef socklen_t       socketlen_t;
 typedef void *          optionvalue_t;
+
+#ifndef MSG_NOSIGNAL
+// SIGPIPE is ignored by the main routine instead
+#define MSG_NOSIGNAL    0
+#endif
 #endif
 
 #include <iostream>
@@ -49,6 +62,10 @@ namespace fastevent {
 
 #define IsShutdown(BUF) has_shutdown(BUF[protocol::STATUS_BYTE])
 
+    static_assert(protocol::V2_REQUEST_MAX <= Service::MAX_MSG_SIZE, "a version 2 request must fit in MAX_MSG_SIZE");
+    static_assert(protocol::V2_RESPONSE_MAX <= Service::MAX_MSG_SIZE, "a version 2 ack must fit in MAX_MSG_SIZE");
+    static_assert(protocol::V2_COMMANDS_MAX <= 0xFF, "the command count must fit in a byte");
+
     namespace network {
         bool initialized = false;
 
@@ -86,6 +103,166 @@ namespace fastevent {
                             (optionvalue_t)&enable, sizeof(enable));
         }
 
+        /**
+        *   lets multiple sockets bind to the same port, sharing the datagrams.
+        */
+        inline int set_reuse_port(socket_t sock, int enable=1)
+        {
+#if defined(__linux__) && defined(SO_REUSEPORT)
+          return setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+                            (optionvalue_t)&enable, sizeof(enable));
+#else
+          return SOCKET_ERROR;
+#endif
+        }
+
+        /**
+        *   makes the socket non-blocking
+        */
+        inline int set_nonblocking(socket_t sock)
+        {
+#ifdef _WIN32
+            u_long enable = 1;
+            return ioctlsocket(sock, FIONBIO, &enable);
+#else
+            int flags = fcntl(sock, F_GETFL, 0);
+            return (flags < 0)? SOCKET_ERROR : fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+#endif
+        }
+
+        /**
+        *   whether or not the last socket call failed only because it would block
+        */
+        inline bool would_block()
+        {
+#ifdef _WIN32
+            return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+            return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+#endif
+        }
+
+        /**
+        *   lets the kernel busy-poll the device queue for up to `usec` when
+        *   the socket has no data (and prefer busy-polling over interrupts,
+        *   where available). returns SOCKET_ERROR if it is not supported.
+        */
+        inline int set_busy_poll(socket_t sock, int usec)
+        {
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+            if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL,
+                           (optionvalue_t)&usec, sizeof(usec)) == SOCKET_ERROR) {
+                return SOCKET_ERROR;
+            }
+#ifdef SO_PREFER_BUSY_POLL
+            int enable = 1;
+            // only a hint: older kernels do not know it
+            setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+                       (optionvalue_t)&enable, sizeof(enable));
+#endif
+            return 0;
+#else
+            return SOCKET_ERROR;
+#endif
+        }
+
+        /**
+        *   makes the kernel timestamp the arrival of each datagram.
+        *   returns SOCKET_ERROR if it is not supported.
+        */
+        inline int set_rx_timestamp(socket_t sock, const Socket::Timestamping& mode)
+        {
+            switch (mode) {
+            case Socket::KernelTimestamp:
+#if defined(__linux__) && defined(SO_TIMESTAMPNS)
+                {
+                    int enable = 1;
+                    return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS,
+                                      (optionvalue_t)&enable, sizeof(enable));
+                }
+#else
+                return SOCKET_ERROR;
+#endif
+            case Socket::SoftwareTimestamp:
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+                {
+                    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+                    return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING,
+                                      (optionvalue_t)&flags, sizeof(flags));
+                }
+#else
+                return SOCKET_ERROR;
+#endif
+            default:
+                // nothing to do in the kernel
+                return 0;
+            }
+        }
+
+        /**
+        *   whether or not the last send failed because the local client
+        *   is not there (anymore), or cannot take the datagram right now
+        */
+        inline bool peer_unavailable()
+        {
+#ifdef _WIN32
+            return false;
+#else
+            switch (errno) {
+            case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+#endif
+            case ENOENT:
+            case ECONNREFUSED:
+            case ECONNRESET:
+            case ENOTCONN:
+            case EPIPE:
+                return true;
+            default:
+                return false;
+            }
+#endif
+        }
+
+        /**
+        *   whether or not the last send failed because of its destination
+        *   (e.g. a remote client that cannot be reached), so that the socket
+        *   can still be used for the other clients
+        */
+        inline bool destination_unreachable()
+        {
+#ifdef _WIN32
+            switch (WSAGetLastError()) {
+            case WSAEHOSTUNREACH:
+            case WSAENETUNREACH:
+            case WSAENETDOWN:
+            case WSAEACCES:
+            case WSAEADDRNOTAVAIL:
+            case WSAECONNRESET:
+                return true;
+            default:
+                return false;
+            }
+#else
+            switch (errno) {
+            case EHOSTUNREACH:
+            case ENETUNREACH:
+#ifdef EHOSTDOWN
+            case EHOSTDOWN:
+#endif
+            case ENETDOWN:
+            case EPERM:         // (e.g. a firewall rule)
+            case EACCES:        // (e.g. a broadcast address)
+            case EADDRNOTAVAIL:
+            case ECONNREFUSED:
+                return true;
+            default:
+                return false;
+            }
+#endif
+        }
+
         /**
         *   handle differences in names for closing socket
         */
@@ -103,299 +280,2490 @@ namespace fastevent {
 
     network::Manager Service::_network;
 
-    Socket::Socket(const socket_t& sock):
-        socket_(sock), lock_() { }
-
-    Socket::~Socket() { }
-
-    int Socket::recv(char *buf, const int& len,
-                        struct sockaddr_in* sender) {
-        ks::MutexLocker locker(&lock_);
-        socketlen_t addr = sizeof(struct sockaddr_in);
-        return ::recvfrom(socket_, buf, len, 0,
-                            (struct sockaddr*)sender, &addr);
-    }
-
-    int Socket::send(const char *buf, const int& len,
-                        struct sockaddr_in* client) {
-        ks::MutexLocker locker(&lock_);
-        return ::sendto(socket_, buf, len, 0,
-                            (struct sockaddr*)client, sizeof(struct sockaddr_in));
-    }
+    const size_t Service::MAX_MSG_SIZE;
+    const size_t Service::DEFAULT_RECV_BATCH;
+    const size_t Service::DEFAULT_SEND_BATCH;
+    const unsigned Service::DEFAULT_SPIN_US;
+    const unsigned Service::DEFAULT_BUSY_POLL_US;
+
+    /**
+    *   reads a datagram of `len` bytes into `packet` (see protocol.h).
+    *   returns false if it is malformed.
+    */
+    inline bool decode(const char *buf, const size_t& len, Packet *packet)
+    {
+        if (!protocol::is_v2(buf, len)) {
+            if (len < static_cast<size_t>(protocol::MSG_SIZE)) {
+                return false;
+            }
+            memcpy(packet->payload, buf, protocol::MSG_SIZE);
+            packet->count    = 0;
+            packet->sequence = 0;
+            packet->flags    = 0;
+            return true;
+        }
 
-    void Socket::close() {
-        ks::MutexLocker locker(&lock_);
-        if( network::close_socket(socket_) ){
-            std::cerr << "***an error seem to have occurred while closing the listening socket, but ignored: ";
-            std::cerr << ks::error_message() << std::endl;
+        // (the reserved flags are ignored)
+        const uint8_t count     = static_cast<uint8_t>(buf[protocol::V2_COUNT_BYTE]);
+        const uint8_t flags     = static_cast<uint8_t>(buf[protocol::V2_FLAGS_BYTE])
+                                  & (protocol::V2_FLAG_SCHEDULED | protocol::V2_FLAG_ACK_RECEIVE
+                                     | protocol::V2_FLAG_NO_ACK | protocol::V2_FLAG_MAX_AGE);
+        const bool    scheduled = ((flags & protocol::V2_FLAG_SCHEDULED) != 0);
+        const size_t  offset    = protocol::v2_commands_offset(flags);
+        if ((count == 0) || (count > protocol::V2_COMMANDS_MAX) || (len < offset + count)) {
+            return false;
         }
+        packet->count    = count;
+        packet->sequence = protocol::get_v2_sequence(buf);
+        packet->flags    = flags;
+        packet->target   = scheduled? protocol::get_v2_time(buf + protocol::V2_HEADER_SIZE) : 0;
+        packet->max_age  = (flags & protocol::V2_FLAG_MAX_AGE)?
+                                protocol::get_v2_age(buf + offset - protocol::V2_AGE_SIZE) : 0;
+        packet->issued   = 0;
+        memcpy(packet->commands, buf + offset, count);
+        // the index/status bytes stand for the last command
+        packet->payload[protocol::INDEX_BYTE]  = static_cast<char>((packet->sequence + count - 1) & 0xFF);
+        packet->payload[protocol::STATUS_BYTE] = packet->commands[count - 1];
+        return true;
     }
 
-    IOBuffer::IOBuffer() {}
-    IOBuffer::~IOBuffer()
+    /**
+    *   writes the response to `packet` into `buf` (of protocol::V2_RESPONSE_MAX bytes):
+    *   the echo of a legacy request, or the ack of a version 2 one.
+    *   returns its size.
+    */
+    inline size_t encode_response(const Packet& packet, char *buf)
     {
-        update_.set();
-        update_.notifyAll();
+        if (packet.count == 0) {
+            memcpy(buf, packet.payload, protocol::MSG_SIZE);
+            return protocol::MSG_SIZE;
+        }
+        protocol::put_v2_header(buf, packet.count, packet.flags,
+                                static_cast<uint16_t>(packet.sequence + packet.count - 1));
+        buf[protocol::V2_HEADER_SIZE] = packet.payload[protocol::STATUS_BYTE];
+        if (packet.flags & protocol::V2_FLAG_SCHEDULED) {
+            protocol::put_v2_time(buf + protocol::V2_ACK_SIZE, packet.issued);
+            return protocol::V2_RESPONSE_MAX;
+        }
+        return protocol::V2_ACK_SIZE;
     }
 
-    bool IOBuffer::read(struct sockaddr_in* client, char *buffer)
+    /**
+    *   when `packet` is to be acknowledged: as the request says, or as set for the client
+    */
+    inline AckMode ack_mode(const Packet& packet, const SessionTable& sessions)
     {
-        if (is_eof_) {
-            return false;
+        if (packet.flags & protocol::V2_FLAG_NO_ACK) {
+            return NoAck;
         }
-
-        update_.lock();
-        if (!update_.isset()) {
-            update_.wait();
-        }
-        if (is_eof_) {
-            // do not reset the flag, but only release the lock
-            update_.unlock();
-            return false;
+        if (packet.flags & protocol::V2_FLAG_ACK_RECEIVE) {
+            return AckOnReceive;
         }
-        memcpy(client, &client_, sizeof(client_));
-        memcpy(buffer, packet_, protocol::MSG_SIZE);
-        update_.unset();
-        update_.unlock();
-        return true;
+        return sessions.ack(packet.session);
     }
 
-    void IOBuffer::write(const struct sockaddr_in* client,
-                         const char *buffer,
-                         const bool& is_eof)
+    /**
+    *   whether or not any of the commands of `packet` is a shutdown request
+    */
+    inline bool is_shutdown(const Packet& packet)
     {
-        update_.lock();
-        if (!is_eof) {
-            memcpy(&client_, client, sizeof(client_));
-            memcpy(packet_, buffer, protocol::MSG_SIZE);
+        if (packet.count == 0) {
+            return IsShutdown(packet.payload);
         }
-        is_eof_ = is_eof;
-        update_.set();
-        update_.notifyAll();
-        update_.unlock();
+        for (uint8_t i=0; i<packet.count; i++) {
+            if (has_shutdown(packet.commands[i])) {
+                return true;
+            }
+        }
+        return false;
     }
 
-
-    IOBuffer *DriverThread::getInputBufferRef() { return &input_; };
-
-    IOBuffer *DriverThread::getOutputBufferRef() { return &output_; };
-
-    void DriverThread::run()
+    /**
+    *   calls `handler(i)` on the `n` listeners in turn, until none of them has
+    *   received anything for `budget` nanoseconds, or until `stopping` is set
+    *   (see Service::spin()).
+    */
+    template <typename Handler>
+    inline Service::Status spin_loop(const size_t& n, const uint64_t& budget, const std::atomic<bool>& stopping,
+                                     uint64_t *received, uint64_t *spun, Handler handler)
     {
-        while(true) {
-            if (!input_.read(&client_, buffer_)) {
-                // shutdown
-                goto FINALLY;
+        ks::nanostamp   clock;
+        uint64_t        last, now;
+        clock.get(&last);
+
+        while (!stopping.load(std::memory_order_relaxed)) {
+            const uint64_t before = *received;
+            for (size_t i=0; i<n; i++) {
+                Service::Status status = handler(i);
+                if (status != Service::Acqknowledge) {
+                    *spun += (*received - before);
+                    return status;
+                }
             }
 
-            // send command to the driver
-            switch (buffer_[protocol::STATUS_BYTE]) {
-
-            // newline characters
-            case '\r':
-            case '\n':
-                // do nothing
-                break;
-
-            // other characters are treated as a command
-            default:
-                driver_->update(RipCommands(buffer_));
+            clock.get(&now);
+            if (*received != before) {
+                *spun += (*received - before);
+                last   = now;
+            } else if (now - last >= budget) {
                 break;
+            } else {
+                cpu_relax();
             }
+        }
+        return Service::Idle;
+    }
 
-            output_.write(&client_, buffer_);
+#ifdef __linux__
+    /**
+    *   the room for the control messages of a datagram
+    *   (enough for either SCM_TIMESTAMPNS or SCM_TIMESTAMPING)
+    */
+    const size_t RECV_CTRL_SIZE = CMSG_SPACE(sizeof(struct timespec) * 3);
+
+    /**
+     * the kernel receive timestamp in the control messages (0 if there is none)
+     */
+    inline uint64_t kernel_arrival(struct msghdr *hdr)
+    {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET) {
+                continue;
+            }
+            // SCM_TIMESTAMPING carries [software, (deprecated), hardware];
+            // the software one comes first, as in SCM_TIMESTAMPNS
+            if ((cmsg->cmsg_type == SCM_TIMESTAMPNS) || (cmsg->cmsg_type == SCM_TIMESTAMPING)) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                return static_cast<uint64_t>(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+            }
         }
-FINALLY:
-        output_.write_eof();
-        shutdown();
+        return 0;
     }
 
-    void DriverThread::shutdown() {
-        // shut down the output driver
-        driver_->shutdown();
-        delete driver_;
+    /**
+     * the buffers of the multishot receive: the header, the address,
+     * the control messages and the payload (or its head) of a datagram
+     */
+    const unsigned URING_BUFFER_SIZE = 256;
+    const uint16_t URING_BUFFER_GROUP = 0;
+#endif
+
+    const uint64_t Socket::UNSENT_LOG_INTERVAL_NS;
+
+    Socket::Socket(const socket_t& sock, const size_t& recv_batch, const size_t& send_batch,
+                   const Timestamping& timestamping, const Transport& transport):
+        socket_(sock), send_socket_(sock), recv_batch_(recv_batch), send_batch_(send_batch),
+        timestamping_(timestamping), transport_(transport), hung_up_(false), released_(false),
+        unsent_(0), unsent_logged_(0), recv_names_(new network::Address[recv_batch]()), recv_name_lens_(new uint8_t[recv_batch]()),
+        recv_bufs_(new char[recv_batch * Service::MAX_MSG_SIZE]()),
+        send_bufs_(new char[send_batch * Service::MAX_MSG_SIZE]()),
+        recv_ring_(0), send_ring_(0)
+    {
+#ifndef _WIN32
+        // a descriptor of its own for the send path;
+        // Winsock calls on a single socket are thread-safe anyway
+        socket_t dup = ::fcntl(sock, F_DUPFD_CLOEXEC, 0);
+        if (dup != INVALID_SOCKET) {
+            send_socket_ = dup;
+        } else {
+            std::cerr << "***failed to duplicate the listening socket for sending (using it as it is): "
+                      << ks::error_message() << std::endl;
+        }
+#endif
+#ifdef __linux__
+        recv_msgs_ = new struct mmsghdr[recv_batch_];
+        recv_iovs_ = new struct iovec[recv_batch_];
+        recv_ctrl_ = new char[RECV_CTRL_SIZE * recv_batch_]();
+        memset(recv_msgs_, 0, sizeof(struct mmsghdr)*recv_batch_);
+        send_msgs_ = new struct mmsghdr[send_batch_];
+        send_iovs_ = new struct iovec[send_batch_];
+        memset(send_msgs_, 0, sizeof(struct mmsghdr)*send_batch_);
+        send_slots_ = 0;
+        free_slots_ = 0;
+        num_slots_  = 0;
+        num_free_   = 0;
+        send_error_ = 0;
+#endif
     }
 
-    void ResponseThread::run()
+    Socket::~Socket()
     {
-        while(true) {
-            if (!(input_->read(&client_, buffer_))) {
-                // shutdown
-                goto FINALLY;
-            }
+        drop_uring();
+        delete[] recv_names_;
+        delete[] recv_name_lens_;
+        delete[] recv_bufs_;
+        delete[] send_bufs_;
+#ifdef __linux__
+        delete[] recv_msgs_;
+        delete[] recv_iovs_;
+        delete[] recv_ctrl_;
+        delete[] send_msgs_;
+        delete[] send_iovs_;
+#endif
+    }
 
-            // send the command back to the client
-            while (true) {
-                switch (socket_->send(buffer_, protocol::MSG_SIZE, &client_))
-                {
+    int Socket::recv(char *buf, const int& len,
+                        network::Address* sender, uint8_t* sender_len) {
+        socketlen_t addr = sizeof(network::Address);
+        int ret = ::recvfrom(socket_, buf, len, 0,
+                            (transport_ == LocalConnection)? NULL : &(sender->any),
+                            (transport_ == LocalConnection)? NULL : &addr);
+        *sender_len = (transport_ == LocalConnection)? 0 : static_cast<uint8_t>(addr);
+        return ret;
+    }
 
-                case protocol::MSG_SIZE:
-                    // success
-                    goto DONE_SENDING;
+    int Socket::send(const char *buf, const int& len,
+                        const network::Address* client, const uint8_t& client_len) {
+        return ::sendto(send_socket_, buf, len,
+                            (transport_ == Network)? 0 : MSG_NOSIGNAL,
+                            (client_len == 0)? NULL : &(client->any), client_len);
+    }
 
-                case 0:
-                    // waiting
-                    continue;
+    int Socket::recv_batch(Packet *packets) {
+#ifdef __linux__
+        if (recv_ring_ != 0) {
+            return recv_uring(packets);
+        }
+        for (size_t i=0; i<recv_batch_; i++) {
+            recv_iovs_[i].iov_base              = recv_bufs_ + Service::MAX_MSG_SIZE * i;
+            recv_iovs_[i].iov_len               = Service::MAX_MSG_SIZE;
+            recv_msgs_[i].msg_hdr.msg_iov       = recv_iovs_ + i;
+            recv_msgs_[i].msg_hdr.msg_iovlen    = 1;
+            if (transport_ == LocalConnection) {
+                recv_msgs_[i].msg_hdr.msg_name      = NULL;
+                recv_msgs_[i].msg_hdr.msg_namelen   = 0;
+            } else {
+                recv_msgs_[i].msg_hdr.msg_name      = recv_names_ + i;
+                recv_msgs_[i].msg_hdr.msg_namelen   = sizeof(network::Address);
+            }
+            if (timestamping_ >= KernelTimestamp) {
+                recv_msgs_[i].msg_hdr.msg_control    = recv_ctrl_ + RECV_CTRL_SIZE * i;
+                recv_msgs_[i].msg_hdr.msg_controllen = RECV_CTRL_SIZE;
+            }
+        }
 
-                case SOCKET_ERROR:
-                default:
-                    std::cerr << "***failed to send a packet: "
-                              << ks::error_message() << std::endl;
-                    goto FINALLY;
+        int received = ::recvmmsg(socket_, recv_msgs_, recv_batch_, MSG_DONTWAIT, NULL);
+        if (received < 0) {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK))? 0 : SOCKET_ERROR;
+        }
+        stamp(packets, received);
+
+        // decode and compact the packets, skipping the malformed ones
+        int count = 0;
+        for (int i=0; i<received; i++) {
+            if (!decode(recv_bufs_ + Service::MAX_MSG_SIZE * i, recv_msgs_[i].msg_len, packets + i)) {
+                if ((recv_msgs_[i].msg_len == 0) && (transport_ == LocalConnection)) {
+                    // the end of the connection
+                    hung_up_ = true;
                 }
+                continue;
+            }
+            if (count != i) {
+                packets[count]    = packets[i];
+                recv_names_[count] = recv_names_[i];
             }
-DONE_SENDING:
-            // continue the loop
-            continue;
+            recv_name_lens_[count]    = static_cast<uint8_t>(recv_msgs_[i].msg_hdr.msg_namelen);
+            packets[count].is_eof     = false;
+            packets[count].is_close   = false;
+            count++;
         }
-FINALLY:
-        return;
+        return count;
+#else
+        int received = recv(recv_bufs_, static_cast<int>(Service::MAX_MSG_SIZE),
+                            recv_names_, recv_name_lens_);
+        if (received == SOCKET_ERROR) {
+            // the socket is non-blocking in the busy-poll mode
+            return network::would_block()? 0 : SOCKET_ERROR;
+        }
+        packets[0].is_eof   = false;
+        packets[0].is_close = false;
+        if (!decode(recv_bufs_, static_cast<size_t>(received), packets)) {
+            if ((received == 0) && (transport_ == LocalConnection)) {
+                // the end of the connection
+                hung_up_ = true;
+            }
+            return 0;
+        }
+        stamp(packets, 1);
+        return 1;
+#endif
     }
 
-    Service::Service(socket_t listening, OutputDriver *driver):
-        socket_desc_(listening), socket_(listening),
-        fdwatch_(static_cast<int>(listening+1))
+    void Socket::stamp(Packet *packets, const size_t& n)
     {
-        FD_ZERO(&fdread_);
-        FD_SET(socket_desc_, &fdread_);
+        if (timestamping_ == NoTimestamp) {
+            for (size_t i=0; i<n; i++) {
+                packets[i].arrival  = 0;
+                packets[i].received = 0;
+            }
+            return;
+        }
 
-        driver_     = new DriverThread(driver);
-        response_   = new ResponseThread(&socket_, driver_->getOutputBufferRef());
-        output_     = driver_->getInputBufferRef();
+        const uint64_t now = wallclock_ns();
+        for (size_t i=0; i<n; i++) {
+            packets[i].arrival  = now;
+            packets[i].received = now;
+#ifdef __linux__
+            if (timestamping_ < KernelTimestamp) {
+                continue;
+            }
+            struct msghdr *hdr = &(recv_msgs_[i].msg_hdr);
+            const uint64_t arrival = kernel_arrival(hdr);
+            if (arrival != 0) {
+                packets[i].arrival = arrival;
+            }
+            // the control buffer has to be re-armed for the next call
+            hdr->msg_controllen = RECV_CTRL_SIZE;
+#endif
+        }
     }
 
-    ks::Result<Service *> Service::configure(Config& cfg, const bool& verbose)
+    ks::Result<bool> Socket::use_uring(const UringOptions& options, const Uring *share)
     {
-        // json::dump(cfg);
-        uint16_t port = json::get<uint16_t>(cfg, "port");
-        json::dict d;
-        std::string drivername(json::get<std::string>(cfg, "driver"));
-        json::dict options(json::get<json::dict>(cfg, "options"));
-        if (verbose) {
-            std::cerr << "port=" << port << ", driver=" << drivername << std::endl;
+#ifdef __linux__
+        if (transport_ != Network) {
+            return ks::Result<bool>::failure("io_uring is only used for the UDP sockets");
         }
-
-        // initialize driver
-        OutputDriver *driver = get_driver(drivername, options, verbose);
-
-        // initialize server
-        ks::Result<socket_t> servicesetup = Service::bind(port);
-        if (servicesetup.failed()) {
-            driver->shutdown();
-            delete driver;
-            return ks::Result<Service *>::failure(servicesetup.what());
+        ks::Result<Uring *> recv_ring = Uring::create(options, share);
+        if (recv_ring.failed()) {
+            return ks::Result<bool>::failure(recv_ring.what());
+        }
+        recv_ring_ = recv_ring.get();
+        ks::Result<bool> buffers = recv_ring_->provide_buffers(URING_BUFFER_GROUP, options.entries, URING_BUFFER_SIZE);
+        if (buffers.failed()) {
+            drop_uring();
+            return buffers;
+        }
+        ks::Result<Uring *> send_ring = Uring::create(options, (share != 0)? share : recv_ring_);
+        if (send_ring.failed()) {
+            drop_uring();
+            return ks::Result<bool>::failure(send_ring.what());
+        }
+        send_ring_ = send_ring.get();
+
+        num_slots_  = options.entries;
+        num_free_   = num_slots_;
+        send_error_ = 0;
+        send_slots_ = new SendSlot[num_slots_]();
+        free_slots_ = new unsigned[num_slots_];
+        for (unsigned i=0; i<num_slots_; i++) {
+            send_slots_[i].iov.iov_base    = send_slots_[i].payload;
+            send_slots_[i].hdr.msg_iov     = &(send_slots_[i].iov);
+            send_slots_[i].hdr.msg_iovlen  = 1;
+            free_slots_[i] = i;
         }
-        socket_t sock = servicesetup.get();
 
-        return ks::Result<Service *>::success(new Service(sock, driver));
+        // the ring takes care of the waiting (a non-blocking socket would end the multishot receive)
+        int flags = fcntl(socket_, F_GETFL, 0);
+        if (flags >= 0) {
+            fcntl(socket_, F_SETFL, flags & ~O_NONBLOCK);
+        }
+        memset(&recv_template_, 0, sizeof(recv_template_));
+        recv_template_.msg_namelen    = sizeof(network::Address);
+        recv_template_.msg_controllen = (timestamping_ >= KernelTimestamp)? RECV_CTRL_SIZE : 0;
+        if (!arm_uring()) {
+            std::string message("failed to submit the receive: " + ks::error_message());
+            drop_uring();
+            return ks::Result<bool>::failure(message);
+        }
+        return ks::Result<bool>::success(true);
+#else
+        return ks::Result<bool>::failure("io_uring is only available on Linux");
+#endif
     }
 
-    OutputDriver* Service::get_driver(const std::string& name, Config& options, const bool& verbose)
+    socket_t Socket::poll_descriptor() const
     {
-        ks::Result<OutputDriver *> driversetup = OutputDriver::setup(name, options, verbose);
-
-        if (driversetup.successful()) {
-            std::cout << ">>> driver: " << name << std::endl;
-            return driversetup.get();
-        } else {
-            std::cerr << "***failed to initialize the output driver: " << driversetup.what() << "; "
-                      << "falling back to using a dummy output driver." << std::endl;
-            std::cout << ">>> driver: " << fastevent::driver::DummyDriver::identifier() << std::endl;
-            return new fastevent::driver::DummyDriver(options);
+#ifdef __linux__
+        if (recv_ring_ != 0) {
+            return recv_ring_->descriptor();
         }
+#endif
+        return socket_;
     }
 
-    ks::Result<socket_t> Service::bind(uint16_t port, const bool& verbose)
+    void Socket::drop_uring()
     {
-        // create a socket to listen to
-        socket_t listening = socket(AF_INET, SOCK_DGRAM, 0);
-        if (listening == INVALID_SOCKET) {
-            return ks::Result<socket_t>::failure("network error: could not initialize the listening socket");
-        }
+#ifdef __linux__
+        delete recv_ring_;
+        delete send_ring_;
+        delete[] send_slots_;
+        delete[] free_slots_;
+        send_slots_ = 0;
+        free_slots_ = 0;
+#endif
+        recv_ring_ = 0;
+        send_ring_ = 0;
+    }
 
-        // configure socket option
-        if( network::set_reuse_address(listening) == SOCKET_ERROR ){
-            return ks::Result<socket_t>::failure("network error: configuration failed for the listening socket");
+#ifdef __linux__
+    bool Socket::arm_uring()
+    {
+        struct io_uring_sqe *sqe = recv_ring_->next_sqe();
+        if (sqe == NULL) {
+            errno = EBUSY;
+            return false;
         }
+        sqe->opcode     = IORING_OP_RECVMSG;
+        sqe->fd         = socket_;
+        sqe->addr       = reinterpret_cast<uint64_t>(&recv_template_);
+        sqe->len        = 1;
+        sqe->ioprio     = IORING_RECV_MULTISHOT;
+        sqe->flags      = IOSQE_BUFFER_SELECT;
+        sqe->buf_group  = URING_BUFFER_GROUP;
+        return (recv_ring_->submit() == 0);
+    }
 
-        // address/port settings
-        struct sockaddr_in service;
-        memset(&service, 0, sizeof(service));
-        service.sin_family      = AF_INET;
-        service.sin_port        = htons(port);
-        service.sin_addr.s_addr = htonl(INADDR_ANY);
+    int Socket::recv_uring(Packet *packets)
+    {
+        const uint64_t now    = (timestamping_ == NoTimestamp)? 0 : wallclock_ns();
+        const size_t   header = sizeof(struct io_uring_recvmsg_out)
+                                + recv_template_.msg_namelen + recv_template_.msg_controllen;
+        bool           rearm  = false;
+        size_t         count  = 0;
+
+        struct io_uring_cqe *cqe;
+        while ((count < recv_batch_) && ((cqe = recv_ring_->peek()) != NULL)) {
+            const int      res   = cqe->res;
+            const unsigned flags = cqe->flags;
+            recv_ring_->consume();
+
+            if (!(flags & IORING_CQE_F_MORE)) {
+                // the multishot receive has ended (e.g. out of buffers)
+                rearm = true;
+            }
+            if (!(flags & IORING_CQE_F_BUFFER)) {
+                if ((res < 0) && (res != -ENOBUFS)) {
+                    errno = -res;
+                    return SOCKET_ERROR;
+                }
+                continue;
+            }
 
-        // binding
-        if( ::bind( listening, (struct sockaddr *)&service, sizeof(service) ) == SOCKET_ERROR ){
-            std::stringstream ss;
-            ss << "network error: failed to bind to port " << port << " (" << ks::error_message() << ")";
-            return ks::Result<socket_t>::failure(ss.str());
+            const uint16_t id  = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            char          *buf = recv_ring_->buffer(id);
+            struct io_uring_recvmsg_out *out = reinterpret_cast<struct io_uring_recvmsg_out *>(buf);
+            // (the payload is cut off at the end of the buffer)
+            const size_t   length = (res >= static_cast<int>(header))? (res - header) : 0;
+            char          *name   = buf + sizeof(struct io_uring_recvmsg_out);
+            char          *control = name + recv_template_.msg_namelen;
+            if ((res >= static_cast<int>(header)) &&
+                decode(control + recv_template_.msg_controllen,
+                       (out->payloadlen < length)? out->payloadlen : length, packets + count)) {
+                const unsigned namelen = (out->namelen < recv_template_.msg_namelen)?
+                                            out->namelen : recv_template_.msg_namelen;
+                memcpy(recv_names_ + count, name, namelen);
+                recv_name_lens_[count] = static_cast<uint8_t>(namelen);
+
+                Packet& packet    = packets[count++];
+                packet.is_eof     = false;
+                packet.is_close   = false;
+                packet.arrival    = now;
+                packet.received   = now;
+                if (timestamping_ >= KernelTimestamp) {
+                    struct msghdr hdr;
+                    memset(&hdr, 0, sizeof(hdr));
+                    hdr.msg_control    = control;
+                    hdr.msg_controllen = out->controllen;
+                    const uint64_t arrival = kernel_arrival(&hdr);
+                    if (arrival != 0) {
+                        packet.arrival = arrival;
+                    }
+                }
+            }
+            recv_ring_->recycle(id);
         }
-
-        // do not start listening here,
-        // as it is not a TCP socket...
-
-        if (verbose) {
-            std::cout << ">>> port: " << port << std::endl;
+        if (rearm && (!arm_uring())) {
+            return SOCKET_ERROR;
         }
-
-        return ks::Result<socket_t>::success(listening);
+        return static_cast<int>(count);
     }
 
-    void Service::run(const bool& verbose)
+    void Socket::reap_sends()
     {
-        driver_->start();
-        response_->start();
-
-        // perform select(2)
-        fd_set              _mask;
-
-        while(true){
-            memcpy(&_mask, &fdread_, sizeof(fdread_));
-            select(fdwatch_, &_mask, NULL, NULL, NULL);
-
-            // in case there is an input in the socket:
-            if (FD_ISSET(socket_desc_, &_mask)) {
-                switch(handle()) {
-                case HandlingError:
-                case ShutdownRequest:
-                    goto FINALLY;
-                default:
-                    continue;
+        struct io_uring_cqe *cqe;
+        while ((cqe = send_ring_->peek()) != NULL) {
+            if (cqe->res < 0) {
+                errno = -(cqe->res);
+                if ((!skip_unsendable()) && (send_error_ == 0)) {
+                    send_error_ = -(cqe->res);
                 }
             }
-
-            // should not reach (as there must be no timeout)
-            std::cerr << "***service error: select() timeout" << std::endl;
-            output_->write_eof();
-            goto FINALLY;
+            free_slots_[num_free_++] = static_cast<unsigned>(cqe->user_data);
+            send_ring_->consume();
         }
-FINALLY:
-        shutdown();
     }
 
-    Service::Status Service::handle()
+    int Socket::send_uring(const Packet *packets, const size_t& n, const SessionTable& sessions)
     {
-        char                buf[protocol::MSG_SIZE];
-        struct sockaddr_in  sender;
+        // a failure of the earlier responses surfaces here
+        reap_sends();
+        if (send_error_ != 0) {
+            errno       = send_error_;
+            send_error_ = 0;
+            return SOCKET_ERROR;
+        }
 
-        // read a UDP packet
-        switch (socket_.recv(buf, protocol::MSG_SIZE, &sender)) {
-        case 0:
-            // do nothing
-            break;
-        case SOCKET_ERROR:
-            std::cerr << "***failed to receive a packet: " << ks::error_message() << std::endl;
+        size_t sent = 0;
+        while (sent < n) {
+            struct io_uring_sqe *sqe = (num_free_ > 0)? send_ring_->next_sqe() : NULL;
+            if (sqe == NULL) {
+                // wait for some of the responses in flight
+                if (send_ring_->submit(1) != 0) {
+                    return SOCKET_ERROR;
+                }
+                reap_sends();
+                continue;
+            }
+
+            const Packet&  packet = packets[sent++];
+            const uint8_t  len    = sessions.address_len(packet.session);
+            const unsigned index  = free_slots_[--num_free_];
+            SendSlot&      slot   = send_slots_[index];
+            slot.iov.iov_len     = encode_response(packet, slot.payload);
+            memcpy(&(slot.client), &(sessions.address(packet.session)), len);
+            slot.hdr.msg_name    = (len == 0)? NULL : &(slot.client);
+            slot.hdr.msg_namelen = len;
+
+            sqe->opcode     = IORING_OP_SENDMSG;
+            sqe->fd         = send_socket_;
+            sqe->addr       = reinterpret_cast<uint64_t>(&(slot.hdr));
+            sqe->len        = 1;
+            sqe->user_data  = index;
+        }
+        if (send_ring_->submit() != 0) {
+            return SOCKET_ERROR;
+        }
+        return static_cast<int>(sent);
+    }
+#endif
+
+    int Socket::send_batch(const Packet *packets, const size_t& n, const SessionTable& sessions) {
+        size_t sent = 0;
+#ifdef __linux__
+        if (send_ring_ != 0) {
+            return send_uring(packets, n, sessions);
+        }
+        while (sent < n) {
+            size_t count = n - sent;
+            if (count > send_batch_) {
+                count = send_batch_;
+            }
+            for (size_t i=0; i<count; i++) {
+                const Packet& packet = packets[sent+i];
+                const uint8_t len    = sessions.address_len(packet.session);
+                char         *buf    = send_bufs_ + Service::MAX_MSG_SIZE * i;
+                send_iovs_[i].iov_base              = buf;
+                send_iovs_[i].iov_len               = encode_response(packet, buf);
+                send_msgs_[i].msg_hdr.msg_iov       = send_iovs_ + i;
+                send_msgs_[i].msg_hdr.msg_iovlen    = 1;
+                send_msgs_[i].msg_hdr.msg_name      = (len == 0)? NULL :
+                                                        const_cast<network::Address *>(&(sessions.address(packet.session)));
+                send_msgs_[i].msg_hdr.msg_namelen   = len;
+            }
+
+            // never block on (or get signaled by) a local client
+            int done = ::sendmmsg(send_socket_, send_msgs_, count,
+                                  (transport_ == Network)? 0 : (MSG_DONTWAIT | MSG_NOSIGNAL));
+            if (done < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (skip_unsendable()) {
+                    // drop the response to this client, and go on with the rest
+                    sent++;
+                    continue;
+                } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                    // the socket is non-blocking in the busy-poll mode
+                    cpu_relax();
+                    continue;
+                }
+                return SOCKET_ERROR;
+            }
+            sent += done;
+        }
+#else
+        while (sent < n) {
+            const Packet& packet = packets[sent];
+            const int     len    = static_cast<int>(encode_response(packet, send_bufs_));
+            const int     ret    = send(send_bufs_, len,
+                                        &(sessions.address(packet.session)), sessions.address_len(packet.session));
+            if (ret == len) {
+                sent++;
+            } else if (ret == 0) {
+                // waiting
+            } else if (ret != SOCKET_ERROR) {
+                return SOCKET_ERROR;
+            } else if (skip_unsendable()) {
+                // drop the response to this client
+                sent++;
+            } else if (!network::would_block()) {
+                // (the socket is non-blocking in the busy-poll mode)
+                return SOCKET_ERROR;
+            }
+        }
+#endif
+        return static_cast<int>(sent);
+    }
+
+    bool Socket::skip_unsendable()
+    {
+        if (transport_ != Network) {
+            if (!network::peer_unavailable()) {
+                return false;
+            }
+            unsent_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        if (!network::destination_unreachable()) {
+            return false;
+        }
+
+        const uint64_t unsent = unsent_.fetch_add(1, std::memory_order_relaxed) + 1;
+        const uint64_t now    = monotonic_ns();
+        if ((unsent_logged_ == 0) || (now - unsent_logged_ >= UNSENT_LOG_INTERVAL_NS)) {
+            std::cerr << "***failed to send a response (" << unsent << " so far; dropped): "
+                      << ks::error_message() << std::endl;
+            unsent_logged_ = now;
+        }
+        return true;
+    }
+
+    void Socket::close_receive() {
+        if (socket_ == INVALID_SOCKET) {
+            return;
+        }
+        if (send_socket_ != socket_) {
+            network::close_socket(socket_);
+        }
+        socket_ = INVALID_SOCKET;
+    }
+
+    void Socket::release() {
+        if (send_socket_ != INVALID_SOCKET) {
+            network::close_socket(send_socket_);
+            send_socket_ = INVALID_SOCKET;
+        }
+        released_.store(true, std::memory_order_release);
+    }
+
+    void Socket::close() {
+        drop_uring();
+        if( (send_socket_ != INVALID_SOCKET) && (send_socket_ != socket_) &&
+            network::close_socket(send_socket_) ){
+            std::cerr << "***an error seem to have occurred while closing the sending socket, but ignored: ";
+            std::cerr << ks::error_message() << std::endl;
+        }
+        if( (socket_ != INVALID_SOCKET) && network::close_socket(socket_) ){
+            std::cerr << "***an error seem to have occurred while closing the listening socket, but ignored: ";
+            std::cerr << ks::error_message() << std::endl;
+        }
+        socket_      = INVALID_SOCKET;
+        send_socket_ = INVALID_SOCKET;
+    }
+
+    const size_t IOBuffer::DEFAULT_DEPTH;
+
+    IOBuffer::IOBuffer(const size_t& depth, const size_t& lanes, const Waiter::Strategy& strategy):
+        num_lanes_(lanes), next_lane_(0), open_lanes_(lanes),
+        is_eof_(false), overflow_(0), signalled_(false), waiter_(strategy)
+    {
+        lanes_    = new Ring<Packet> *[num_lanes_];
+        lane_eof_ = new bool[num_lanes_];
+        for (size_t i=0; i<num_lanes_; i++) {
+            lanes_[i]    = new Ring<Packet>(depth);
+            lane_eof_[i] = false;
+        }
+    }
+
+    IOBuffer::~IOBuffer()
+    {
+        for (size_t i=0; i<num_lanes_; i++) {
+            delete lanes_[i];
+        }
+        delete[] lanes_;
+        delete[] lane_eof_;
+    }
+
+    IOBuffer::PopStatus IOBuffer::pop(Packet* packet)
+    {
+        for (size_t visited=0; visited<num_lanes_; visited++) {
+            const size_t lane = next_lane_;
+            next_lane_ = (next_lane_ + 1 == num_lanes_)? 0 : next_lane_ + 1;
+
+            if (lane_eof_[lane] || (!lanes_[lane]->pop(packet))) {
+                continue;
+            }
+            if (!packet->is_eof) {
+                return Popped;
+            }
+
+            lane_eof_[lane] = true;
+            if (--open_lanes_ == 0) {
+                is_eof_ = true;
+                return AtEOF;
+            }
+        }
+        return Empty;
+    }
+
+    bool IOBuffer::empty() const
+    {
+        for (size_t i=0; i<num_lanes_; i++) {
+            if ((!lane_eof_[i]) && (!lanes_[i]->empty())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool IOBuffer::read(Packet* packet)
+    {
+        while (!is_eof_) {
+            switch (pop(packet)) {
+            case Popped:
+                return true;
+            case AtEOF:
+                return false;
+            case Empty:
+            default:
+                wait();
+                break;
+            }
+        }
+        return false;
+    }
+
+    bool IOBuffer::write(const Packet& packet, const size_t& lane)
+    {
+        if (!lanes_[lane]->push(packet)) {
+            overflow_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        waiter_.notify();
+        return true;
+    }
+
+    bool IOBuffer::try_write(const Packet& packet, const size_t& lane)
+    {
+        if (!lanes_[lane]->push(packet)) {
+            return false;
+        }
+        waiter_.notify();
+        return true;
+    }
+
+    size_t IOBuffer::read_available(Packet* packets, const size_t& max)
+    {
+        size_t count = 0;
+        while ((count < max) && (!is_eof_)) {
+            if (pop(packets + count) != Popped) {
+                break;
+            }
+            count++;
+        }
+        return count;
+    }
+
+    size_t IOBuffer::write_batch(const Packet *packets, const size_t& n, const size_t& lane)
+    {
+        Ring<Packet>& ring = *(lanes_[lane]);
+        size_t count = n;
+        while ((count > 0) && (!ring.reserve(count))) {
+            count--;
+        }
+        if (count < n) {
+            overflow_.fetch_add(n - count, std::memory_order_relaxed);
+        }
+        if (count == 0) {
+            return 0;
+        }
+
+        for (size_t i=0; i<count; i++) {
+            ring.slot(i) = packets[i];
+        }
+        ring.publish(count);
+        waiter_.notify();
+        return count;
+    }
+
+    void IOBuffer::write_eof(const size_t& lane)
+    {
+        Packet eof;
+        memset(&eof, 0, sizeof(eof));
+        eof.is_eof = true;
+        write_wait(eof, lane);
+    }
+
+    void IOBuffer::write_wait(const Packet& packet, const size_t& lane)
+    {
+        while (!lanes_[lane]->push(packet)) {
+            cpu_relax();
+        }
+        waiter_.notify();
+    }
+
+    void IOBuffer::wait()
+    {
+        waiter_.wait([this]() { return !empty(); });
+    }
+
+    bool IOBuffer::wait_until(const uint64_t& deadline)
+    {
+        return waiter_.wait_until([this]() {
+            return !empty() || signalled_.exchange(false, std::memory_order_acq_rel);
+        }, deadline);
+    }
+
+    void IOBuffer::signal()
+    {
+        signalled_.store(true, std::memory_order_release);
+        waiter_.notify();
+    }
+
+    void CompletionQueue::completed(const uint64_t& tag, const bool& ok)
+    {
+        Entry entry;
+        entry.tag = tag;
+        entry.ok  = ok;
+        // (there is always a room for the outstanding ones)
+        while (!ring_.push(entry)) {
+            cpu_relax();
+        }
+        waiter_.notify();
+        wakeup_->signal();
+    }
+
+    bool CompletionQueue::pop(uint64_t *tag, bool *ok)
+    {
+        Entry entry;
+        if (!ring_.pop(&entry)) {
+            return false;
+        }
+        *tag = entry.tag;
+        *ok  = entry.ok;
+        return true;
+    }
+
+    bool CompletionQueue::wait_until(const uint64_t& deadline)
+    {
+        return waiter_.wait_until([this]() { return !ring_.empty(); }, deadline);
+    }
+
+
+    const uint64_t DriverThread::ASYNC_TIMEOUT_NS;
+
+    IOBuffer *DriverThread::getInputBufferRef() { return &input_; };
+
+    IOBuffer *DriverThread::getOutputBufferRef() { return &output_; };
+
+    void DriverThread::run()
+    {
+        rt::setup_thread(policy_, "driver");
+
+        while(true) {
+            if ((async_depth_ > 0) && (reap() == 0) && (submitted_ != retired_) &&
+                (monotonic_ns() - progress_ > ASYNC_TIMEOUT_NS)) {
+                // the driver has stalled
+                pending_status_[retired_ & pending_mask_] = Failed;
+                reap();
+            }
+            const bool idle    = (scheduler_ == 0) || scheduler_->empty();
+            const bool waiting = (submitted_ != retired_);
+            if (idle && timers_->empty() && ((!waiting) || input_.eof())) {
+                if (!input_.read(&packet_)) {
+                    // shutdown
+                    goto FINALLY;
+                }
+                admit(packet_);
+            } else if (idle) {
+                // sleep until the final spin before the next scheduled request,
+                // unless another request (or a completion) arrives in the meantime
+                const uint64_t next = release();
+                uint64_t deadline   = (next != 0)? (next - timer_options_.spin) : 0;
+                if (submitted_ != retired_) {
+                    const uint64_t timeout = progress_ + ASYNC_TIMEOUT_NS;
+                    if ((deadline == 0) || (timeout < deadline)) {
+                        deadline = timeout;
+                    }
+                }
+                if (deadline != 0) {
+                    input_.wait_until(deadline);
+                }
+            }
+
+            // let the clients compete in the scheduler, rather than in the input lanes
+            rt::HotSection hot("DriverThread::run");
+            const size_t count = input_.read_available(intake_, intake_size_);
+            for (size_t i=0; i<count; i++) {
+                admit(intake_[i]);
+            }
+            if (input_.eof()) {
+                // the scheduled requests are not waited for
+                cancel_timers();
+            }
+            release();
+            if (scheduler_ != 0) {
+                if (coalesce_options_.enabled && (async_depth_ == 0) && (scheduler_->size() > 1)) {
+                    // the driver has fallen behind
+                    coalesce();
+                } else if (scheduler_->pop(&packet_)) {
+                    process(packet_);
+                }
+            }
+        }
+FINALLY:
+        if (async_depth_ > 0) {
+            wait_outstanding(0);
+        }
+        // (the other writers have all stopped by now, having sent the EOF to the input side)
+        for (size_t i=0; i<output_.lanes(); i++) {
+            output_.write_eof(i);
+        }
+        shutdown();
+    }
+
+    void DriverThread::admit(Packet& packet)
+    {
+        if (packet.is_close) {
+            // no command; just pass it on, after the requests through the connection
+            Packet flushed;
+            while ((scheduler_ != 0) && scheduler_->pop_listener(packet.listener, &flushed)) {
+                process(flushed);
+            }
+            // (no one is there for the scheduled ones)
+            while (timers_->pop_listener(packet.listener, &flushed)) {
+                timer_cancelled_++;
+                if (sessions_ != 0) {
+                    sessions_->release(flushed.session, true);
+                }
+            }
+            if (async_depth_ > 0) {
+                wait_outstanding(0);
+            }
+            output_.write_wait(packet);
+            return;
+        }
+        if (scheduler_ == 0) {
+            process(packet);
+            return;
+        }
+        uint64_t now;
+        clock_.get(&now);
+        scheduler_->push(packet, now);
+    }
+
+    void DriverThread::set_timers(const TimerOptions& options)
+    {
+        timer_options_ = options;
+        delete timers_;
+        timers_ = new TimerQueue(options.depth);
+    }
+
+    uint64_t DriverThread::lead() const
+    {
+        return (timer_options_.lead >= 0)? static_cast<uint64_t>(timer_options_.lead)
+                                         : update_ns_.load(std::memory_order_relaxed);
+    }
+
+    void DriverThread::process(Packet& packet)
+    {
+        if (packet.flags & protocol::V2_FLAG_SCHEDULED) {
+            const uint64_t lead = this->lead();
+            const uint64_t due  = (packet.target > lead)? (packet.target - lead) : 0;
+            if (due > monotonic_ns()) {
+                if (!timers_->push(packet)) {
+                    timer_overflow_++;
+                    if (sessions_ != 0) {
+                        sessions_->release(packet.session, true);
+                    }
+                }
+                return;
+            }
+            packet.flags |= protocol::V2_FLAG_LATE;
+            late_++;
+        }
+        issue(packet);
+    }
+
+    uint64_t DriverThread::release()
+    {
+        Packet packet;
+        while (!timers_->empty()) {
+            const uint64_t lead   = this->lead();
+            const uint64_t target = timers_->next();
+            const uint64_t due    = (target > lead)? (target - lead) : 0;
+            uint64_t       now    = monotonic_ns();
+            if (due > now + timer_options_.spin) {
+                return due;
+            }
+            // the final spin
+            while (now < due) {
+                cpu_relax();
+                now = monotonic_ns();
+            }
+            timers_->pop(&packet);
+            release_latency_.add(due, now);
+            issue(packet);
+        }
+        return 0;
+    }
+
+    void DriverThread::cancel_timers()
+    {
+        Packet packet;
+        while (!timers_->empty()) {
+            timers_->pop(&packet);
+            timer_cancelled_++;
+            if (sessions_ != 0) {
+                sessions_->release(packet.session, true);
+            }
+        }
+    }
+
+    void DriverThread::issue(Packet& packet)
+    {
+        rt::HotSection hot("DriverThread::run");
+
+        if (!expire(packet)) {
+            if (packet.flags & protocol::V2_FLAG_SCHEDULED) {
+                packet.issued = monotonic_ns();
+            }
+            if (async_depth_ > 0) {
+                // completed in reap()
+                submit(packet);
+                return;
+            }
+            execute(packet);
+        }
+        complete(packet);
+    }
+
+    bool DriverThread::commit(Packet& packet)
+    {
+        rt::HotSection hot("DriverThread::commit");
+
+        if (!expire(packet)) {
+            if (packet.flags & protocol::V2_FLAG_SCHEDULED) {
+                // (no waiting for the target time)
+                packet.issued = monotonic_ns();
+                if (packet.target < packet.issued) {
+                    packet.flags |= protocol::V2_FLAG_LATE;
+                    late_++;
+                }
+            }
+            execute(packet);
+        }
+
+        if (packet.arrival != 0) {
+            receive_latency_.add(packet.arrival, packet.received);
+            driver_latency_.add(packet.arrival, wallclock_ns());
+        }
+        return (packet.ack == AckOnCommit);
+    }
+
+    void DriverThread::coalesce()
+    {
+        rt::HotSection hot("DriverThread::run");
+
+        // take out the waiting requests (but the scheduled ones, which go on to the TimerQueue).
+        // a legacy request ends the run, and is issued on its own after it:
+        // its echo has no room for the mark of being coalesced.
+        size_t count  = 0;
+        bool   legacy = false;
+        while ((count < intake_size_) && scheduler_->pop(&run_[count])) {
+            if (run_[count].flags & protocol::V2_FLAG_SCHEDULED) {
+                process(run_[count]);
+            } else if (expire(run_[count])) {
+                complete(run_[count]);
+            } else if (run_[count].count == 0) {
+                legacy = true;
+                break;
+            } else {
+                count++;
+            }
+        }
+        if (count > 0) {
+            fold(count);
+        }
+        if (legacy) {
+            issue(run_[count]);
+        }
+    }
+
+    void DriverThread::fold(const size_t& count)
+    {
+        // follow the state through the commands, and the bits raised on the way
+        char state   = state_;
+        char raised  = 0;
+        bool changed = false;
+        for (size_t i=0; i<count; i++) {
+            const Packet& packet = run_[i];
+            for (uint8_t j=0; j<packet.count; j++) {
+                if ((packet.commands[j] == '\r') || (packet.commands[j] == '\n')) {
+                    continue;
+                }
+                const char command = packet.commands[j] & MASK_COMMANDS;
+                raised  |= command & ~state;
+                state    = command;
+                changed  = true;
+            }
+        }
+
+        // the bits that would otherwise be lost
+        const char pulse = raised & ~state & coalesce_options_.pulse_mask();
+        if (pulse != 0) {
+            const uint64_t start = monotonic_ns();
+            update(state | pulse);
+            while (monotonic_ns() - start < coalesce_options_.pulse) {
+                cpu_relax();
+            }
+            pulses_++;
+        }
+        if (changed) {
+            update(state);
+        }
+
+        for (size_t i=0; i<count; i++) {
+            Packet& packet = run_[i];
+            if (i + 1 < count) {
+                packet.flags |= protocol::V2_FLAG_COALESCED;
+                coalesced_++;
+            }
+            complete(packet);
+        }
+    }
+
+    bool DriverThread::expire(Packet& packet)
+    {
+        const uint64_t max_age = (packet.flags & protocol::V2_FLAG_MAX_AGE)?
+                                    (static_cast<uint64_t>(packet.max_age) * 1000) : max_age_;
+        if (max_age == 0) {
+            return false;
+        }
+        // (a scheduled request is as old as it is past its target time)
+        const uint64_t since = (packet.flags & protocol::V2_FLAG_SCHEDULED)? packet.target : packet.stamped;
+        if (monotonic_ns() <= since + max_age) {
+            return false;
+        }
+
+        if (packet.count != 0) {
+            packet.flags |= protocol::V2_FLAG_EXPIRED;
+        } else if (packet.ack == AckOnCommit) {
+            // the legacy echo has no room for the mark: no echo at all,
+            // rather than one that looks as if the command had been issued
+            packet.ack = NoAck;
+        }
+        expired_.store(expired_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void DriverThread::complete(Packet& packet)
+    {
+        if (packet.arrival != 0) {
+            receive_latency_.add(packet.arrival, packet.received);
+            driver_latency_.add(packet.arrival, wallclock_ns());
+        }
+        if (packet.ack != AckOnCommit) {
+            // (acknowledged already, or never)
+            if (sessions_ != 0) {
+                sessions_->release(packet.session);
+            }
+            return;
+        }
+        if ((!output_.write(packet)) && (sessions_ != 0)) {
+            sessions_->release(packet.session, true);
+        }
+    }
+
+    void DriverThread::execute(const Packet& packet)
+    {
+        if (packet.count == 0) {
+            update(packet.payload + protocol::STATUS_BYTE, 1);
+        } else {
+            update(packet.commands, packet.count);
+        }
+    }
+
+    void DriverThread::update(const char& state)
+    {
+        update(&state, 1);
+    }
+
+    void DriverThread::update(const char *commands, const size_t& count)
+    {
+        rt::HotSection hot("OutputDriver::update");
+        const uint64_t start  = monotonic_ns();
+        const size_t   passed = loop_(driver_, commands, count, &state_);
+        account(start, passed);
+    }
+
+    void DriverThread::account(const uint64_t& start, const size_t& passed)
+    {
+        if (passed == 0) {
+            return;
+        }
+        // the lead of the scheduled commands follows the mean (per command) by 1/8
+        const int64_t  elapsed = static_cast<int64_t>(monotonic_ns() - start) / static_cast<int64_t>(passed);
+        const int64_t  mean    = static_cast<int64_t>(update_ns_.load(std::memory_order_relaxed));
+        update_ns_.store(static_cast<uint64_t>((mean == 0)? elapsed : (mean + (elapsed - mean) / 8)),
+                         std::memory_order_relaxed);
+    }
+
+    void DriverThread::setup_async()
+    {
+        pending_mask_ = 0;
+        if (async_depth_ == 0) {
+            return;
+        }
+        const size_t capacity = ceil_pow2(async_depth_);
+        pending_mask_   = capacity - 1;
+        pending_        = new Packet[capacity]();
+        pending_status_ = new char[capacity]();
+        completions_    = new CompletionQueue(capacity, &input_);
+        driver_->set_completion(completions_);
+    }
+
+    void DriverThread::submit(Packet& packet)
+    {
+        if (submitted_ - retired_ >= async_depth_) {
+            wait_outstanding(async_depth_ - 1);
+        }
+
+        const uint64_t tag  = submitted_++;
+        pending_[tag & pending_mask_]        = packet;
+        pending_status_[tag & pending_mask_] = Outstanding;
+
+        Command commands[protocol::V2_COMMANDS_MAX];
+        const size_t count = (packet.count == 0)?
+                                decode_commands(packet.payload + protocol::STATUS_BYTE, 1, commands) :
+                                decode_commands(packet.commands, packet.count, commands);
+        if (count == 0) {
+            // nothing to wait for (but it still comes out in order)
+            pending_status_[tag & pending_mask_] = Completed;
+            return;
+        }
+
+        rt::HotSection hot("OutputDriver::submit");
+        const uint64_t start = monotonic_ns();
+        progress_ = start;
+        if (driver_->submit(commands, count, tag)) {
+            state_ = commands[count-1];
+            account(start, count);
+        } else {
+            pending_status_[tag & pending_mask_] = Failed;
+        }
+    }
+
+    size_t DriverThread::reap(const bool& wait, const uint64_t& timeout)
+    {
+        const uint64_t deadline = wait? (monotonic_ns() + timeout) : 0;
+        size_t         done     = 0;
+        uint64_t       tag;
+        bool           ok;
+        while (true) {
+            while (completions_->pop(&tag, &ok)) {
+                if ((tag < retired_) || (tag >= submitted_)) {
+                    // (given up on already)
+                    continue;
+                }
+                pending_status_[tag & pending_mask_] = ok? Completed : Failed;
+            }
+
+            // in the order of submission
+            while ((retired_ != submitted_) && (pending_status_[retired_ & pending_mask_] != Outstanding)) {
+                Packet& packet = pending_[retired_ & pending_mask_];
+                if ((pending_status_[retired_ & pending_mask_] == Failed) && (packet.ack == AckOnCommit)) {
+                    // no acknowledgement for what did not reach the output
+                    failed_++;
+                    if (sessions_ != 0) {
+                        sessions_->release(packet.session, true);
+                    }
+                } else {
+                    complete(packet);
+                }
+                retired_++;
+                done++;
+            }
+
+            if (done > 0) {
+                progress_ = monotonic_ns();
+            }
+            if ((done > 0) || (!wait) || (retired_ == submitted_)) {
+                return done;
+            }
+            if (!completions_->wait_until(deadline)) {
+                return 0;
+            }
+        }
+    }
+
+    void DriverThread::wait_outstanding(const size_t& limit)
+    {
+        while (submitted_ - retired_ > limit) {
+            if (reap(true, ASYNC_TIMEOUT_NS) == 0) {
+                // the driver has stalled
+                pending_status_[retired_ & pending_mask_] = Failed;
+                progress_ = monotonic_ns();
+            }
+        }
+    }
+
+    void DriverThread::shutdown() {
+        // shut down the output driver
+        driver_->shutdown();
+        delete driver_;
+
+        if ((input_.overflow() > 0) || (output_.overflow() > 0)) {
+            std::cerr << "***packets dropped due to buffer overflow: "
+                      << input_.overflow() << " (service->driver), "
+                      << output_.overflow() << " (driver->response)" << std::endl;
+        }
+        if ((timer_overflow_ > 0) || (timer_cancelled_ > 0)) {
+            std::cerr << "***scheduled commands dropped: "
+                      << timer_overflow_ << " (timer queue full), "
+                      << timer_cancelled_ << " (at shutdown)" << std::endl;
+        }
+        if (late_ > 0) {
+            std::cerr << "***scheduled commands issued after their target times: " << late_ << std::endl;
+        }
+        if (expired() > 0) {
+            std::cerr << "***requests expired before reaching the driver: " << expired() << std::endl;
+        }
+        if (failed_ > 0) {
+            std::cerr << "***requests that the driver failed to pass to the output: " << failed_ << std::endl;
+        }
+        if (coalesced_ > 0) {
+            std::cerr << "***requests coalesced into the later ones: " << coalesced_
+                      << " (with " << pulses_ << " pulse(s) kept)" << std::endl;
+        }
+        if ((scheduler_ != 0) && ((scheduler_->overflow() > 0) || (scheduler_->limited() > 0))) {
+            std::cerr << "***packets dropped by the scheduler: "
+                      << scheduler_->overflow() << " (client queue full), "
+                      << scheduler_->limited() << " (rate limit)" << std::endl;
+        }
+    }
+
+    size_t ResponseThread::collect()
+    {
+        if (!(input_->read(batch_))) {
+            return 0;
+        }
+        size_t count = 1 + input_->read_available(batch_+1, batch_size_-1);
+        if ((hold_ == 0) || (count == batch_size_) || input_->eof()) {
+            return count;
+        }
+
+        // hold the batch for a while, waiting for the others
+        uint64_t start, now;
+        clock_.get(&start);
+        do {
+            count += input_->read_available(batch_+count, batch_size_-count);
+            if ((count == batch_size_) || input_->eof()) {
+                break;
+            }
+            cpu_relax();
+            clock_.get(&now);
+        } while (now - start < hold_);
+        return count;
+    }
+
+    void ResponseThread::run()
+    {
+        rt::setup_thread(policy_, "response");
+
+        // after a fatal send error, the service is stopped, and the responses
+        // through the sockets are only drained until EOF (so that the driver
+        // side never blocks on a full lane). the errors of a single client
+        // are taken care of by Socket::send_batch() itself.
+        bool broken = false;
+
+        while(true) {
+            size_t count = collect();
+            rt::HotSection hot("ResponseThread::run");
+
+            // send the commands back to the clients,
+            // through the socket each of them arrived at
+            size_t begin = 0;
+            while (begin < count) {
+                const uint8_t listener = batch_[begin].listener;
+                if ((listener == SHM_LISTENER) && (shm_ != 0)) {
+                    size_t end = begin + 1;
+                    while ((end < count) && (batch_[end].listener == listener)) {
+                        end++;
+                    }
+                    shm_->respond(batch_+begin, end-begin, *sessions_);
+                    begin = end;
+                    continue;
+                }
+                if (batch_[begin].is_close) {
+                    // all the responses through this connection have been sent
+                    sockets_[listener]->release();
+                    begin++;
+                    continue;
+                }
+                size_t end = begin + 1;
+                while ((end < count) && (batch_[end].listener == listener) && (!batch_[end].is_close)) {
+                    end++;
+                }
+                if ((!broken) &&
+                    (sockets_[listener]->send_batch(batch_+begin, end-begin, *sessions_) == SOCKET_ERROR)) {
+                    std::cerr << "***failed to send a packet: "
+                              << ks::error_message() << std::endl;
+                    std::cerr << "***stopping the service (the rest of the responses will be discarded)." << std::endl;
+                    broken = true;
+                    if (service_ != 0) {
+                        service_->stop();
+                    }
+                }
+                if (broken) {
+                    for (size_t i=begin; i<end; i++) {
+                        if (batch_[i].session != SessionTable::NO_SESSION) {
+                            sessions_->release(batch_[i].session);
+                            batch_[i].session = SessionTable::NO_SESSION;
+                        }
+                    }
+                }
+                begin = end;
+            }
+            // (a close marker carries neither a session nor a timestamp)
+            const uint64_t now = ((count > 0) && ((batch_[0].arrival != 0) || (batch_[count-1].arrival != 0)))?
+                                    wallclock_ns() : 0;
+            for (size_t i=0; i<count; i++) {
+                const Packet& packet = batch_[i];
+                if (packet.session == SessionTable::NO_SESSION) {
+                    continue;
+                }
+                response_latency_.add(packet.arrival, now);
+                sessions_->complete(packet.session,
+                                    ((packet.arrival != 0) && (now > packet.arrival))? (now - packet.arrival) : 0);
+            }
+
+            if (input_->eof()) {
+                // shutdown
+                goto FINALLY;
+            }
+        }
+FINALLY:
+        return;
+    }
+
+    Service::Service(const std::vector<socket_t>& listening, const std::vector<socket_t>& local,
+                     shm::Region *region, OutputDriver *driver, const Options& options):
+        num_listeners_(listening.size()), num_acceptors_(0), local_paths_(),
+        recv_batch_(options.recv_batch), send_batch_(options.send_batch),
+        reactor_(), serial_desc_(driver->descriptor()),
+        receiver_policy_(options.receiver_policy),
+        received_(0), spun_(0), busy_poll_(options.busy_poll), spin_budget_(options.spin_budget),
+        timestamping_(options.timestamping), stopping_(false),
+        inline_(options.inline_pipeline), response_latency_(), receivers_(), shm_(0),
+        sessions_(0), scheduler_(0), response_(0)
+    {
+        // with ReceiverThread's, the thread in run() only needs
+        // a lane of its own for the AF_UNIX sockets, if any.
+        // the shared-memory thread always comes with its own lane.
+        const bool sharded = (options.receivers > 1);
+        has_lane_   = (!sharded) || (local.size() > 0);
+        lane_       = sharded? num_listeners_ : 0;
+        const size_t lanes = sharded? (num_listeners_ + (has_lane_? 1:0)) : 1;
+        const size_t inputs = lanes + ((region != 0)? 1:0);
+        sessions_   = new SessionTable(inputs);
+        scheduler_  = new Scheduler(sessions_, options.clients, options.depth * (inputs + 1), options.client_depth);
+        driver_     = new DriverThread(driver, options.depth, inputs,
+                                       options.driver_wait, options.response_wait);
+        driver_->set_policy(options.driver_policy);
+        driver_->set_sessions(sessions_);
+        driver_->set_scheduler(scheduler_);
+        driver_->set_timers(options.timers);
+        driver_->set_coalesce(options.coalesce);
+        driver_->set_max_age(options.max_age);
+        output_     = driver_->getInputBufferRef();
+        acks_       = driver_->getOutputBufferRef();
+        sessions_->set_classes(options.clients);
+        batch_      = new Packet[options.recv_batch]();
+
+        const Uring *shared = 0;
+        for (size_t i=0; i<num_listeners_; i++) {
+            listeners_[i].desc  = listening[i];
+            listeners_[i].index = static_cast<uint8_t>(i);
+            listeners_[i].kind  = Listener::Datagram;
+            sockets_[i]         = new Socket(listening[i], options.recv_batch, options.send_batch,
+                                                    options.timestamping);
+            if (options.uring) {
+                // all the rings share the polling thread of the first one (with SQPOLL)
+                ks::Result<bool> ring = sockets_[i]->use_uring(options.uring_options, shared);
+                if (ring.failed()) {
+                    std::cerr << "***io_uring is not available (falling back to the default backend): "
+                              << ring.what() << std::endl;
+                } else if (shared == 0) {
+                    shared = sockets_[i]->uring();
+                }
+            }
+            if (sharded) {
+                rt::ThreadPolicy policy(options.receiver_policy);
+                if (options.receiver_cpus.size() > 0) {
+                    policy.cpus = std::vector<int>(1, options.receiver_cpus[i % options.receiver_cpus.size()]);
+                }
+                receivers_.push_back(new ReceiverThread(this, sockets_[i], listeners_[i].index,
+                                                        output_, acks_, i, sessions_, policy,
+                                                        options.busy_poll? options.spin_budget : 0));
+            } else if (!reactor_.add(sockets_[i]->poll_descriptor(), listeners_ + i)) {
+                std::cerr << "***failed to watch the listening socket: " << ks::error_message() << std::endl;
+            }
+        }
+
+        // the AF_UNIX sockets are served by the thread in run()
+        for (size_t i=0; i<local.size(); i++) {
+            Listener *listener;
+            local_paths_.push_back(options.local_ports[i].path);
+            if (options.local_ports[i].transport == Socket::LocalConnection) {
+                listener        = acceptors_ + (num_acceptors_++);
+                listener->index = 0;
+                listener->kind  = Listener::Acceptor;
+            } else {
+                listener        = listeners_ + num_listeners_;
+                listener->index = static_cast<uint8_t>(num_listeners_);
+                listener->kind  = Listener::Datagram;
+                sockets_[num_listeners_++] = new Socket(local[i], options.recv_batch, options.send_batch,
+                                                        options.timestamping, Socket::LocalDatagram);
+            }
+            listener->desc = local[i];
+            if (!reactor_.add(local[i], listener)) {
+                std::cerr << "***failed to watch the local socket: " << ks::error_message() << std::endl;
+            }
+        }
+        for (int i=0; i<CONN_MAX; i++) {
+            sockets_[LISTEN_MAX + i] = 0;
+        }
+
+        if (!reactor_.add_wakeup(this)) {
+            std::cerr << "***stop requests are not available: " << ks::error_message() << std::endl;
+        }
+        if ((options.stats_interval > 0) && (!reactor_.add_timer(options.stats_interval, this))) {
+            std::cerr << "***status reports are not available: " << ks::error_message() << std::endl;
+        }
+        if ((serial_desc_ >= 0) && (!reactor_.add(serial_desc_, &serial_desc_, false))) {
+            // some platforms cannot watch the device only for hang-ups
+            serial_desc_ = -1;
+        }
+
+        if (inline_) {
+            // no other threads (and no shared memory)
+            return;
+        }
+        response_   = new ResponseThread(sockets_, sessions_, driver_->getOutputBufferRef(),
+                                         options.send_batch, options.send_hold);
+        response_->set_policy(options.response_policy);
+        response_->set_service(this);
+
+#ifndef _WIN32
+        if (region != 0) {
+            shm_ = new SharedMemoryThread(this, region, options.shm_name, output_, acks_, lanes, sessions_,
+                                          options.receiver_policy, options.spin_budget,
+                                          options.shm_doorbell, options.timestamping);
+            response_->set_shared_memory(shm_);
+        }
+#endif
+    }
+
+    ks::Result<Service *> Service::configure(Config& cfg, const bool& verbose)
+    {
+        // json::dump(cfg);
+        Options opts;
+        if (json::has(cfg, "port") && cfg["port"].is<json::array>()) {
+            json::array ports(json::get<json::array>(cfg, "port"));
+            for (json::iterator it=ports.begin(); it!=ports.end(); it++) {
+                if (!it->is<double>()) {
+                    return ks::Result<Service *>::failure("malformed 'port' attribute");
+                }
+                opts.ports.push_back(static_cast<uint16_t>(it->get<double>()));
+            }
+        } else {
+            opts.ports.push_back(json::get<uint16_t>(cfg, "port"));
+        }
+        if (json::has(cfg, "unix")) {
+            json::array locals;
+            if (cfg["unix"].is<json::array>()) {
+                locals = json::get<json::array>(cfg, "unix");
+            } else {
+                locals.push_back(cfg["unix"]);
+            }
+            for (json::iterator it=locals.begin(); it!=locals.end(); it++) {
+                if (!it->is<json::dict>()) {
+                    return ks::Result<Service *>::failure("malformed 'unix' attribute");
+                }
+                json::dict entry(it->get<json::dict>());
+                LocalPort local;
+                local.path = json::get<std::string>(entry, "path", "");
+                std::string type(json::get<std::string>(entry, "type", "dgram"));
+                if (type == "dgram") {
+                    local.transport = Socket::LocalDatagram;
+                } else if (type == "seqpacket") {
+                    local.transport = Socket::LocalConnection;
+                } else {
+                    return ks::Result<Service *>::failure("'unix/type' must be either 'dgram' or 'seqpacket'");
+                }
+                opts.local_ports.push_back(local);
+            }
+        }
+        opts.shm_doorbell = true;
+        if (json::has(cfg, "shm")) {
+            if (!cfg["shm"].is<json::dict>()) {
+                return ks::Result<Service *>::failure("malformed 'shm' attribute");
+            }
+            json::dict entry(json::get<json::dict>(cfg, "shm"));
+            opts.shm_name     = json::get<std::string>(entry, "name", "/fastevent");
+            opts.shm_doorbell = json::get<bool>(entry, "doorbell", true);
+            opts.shm_group    = json::get<std::string>(entry, "group", "");
+            if ((opts.shm_name.size() < 2) || (opts.shm_name[0] != '/') ||
+                (opts.shm_name.find('/', 1) != std::string::npos)) {
+                return ks::Result<Service *>::failure("'shm/name' must be of the form '/name'");
+            }
+        }
+        opts.depth      = json::get<unsigned int>(cfg, "buffer_depth", IOBuffer::DEFAULT_DEPTH);
+        opts.recv_batch = json::get<unsigned int>(cfg, "recv_batch", DEFAULT_RECV_BATCH);
+        opts.send_batch = json::get<unsigned int>(cfg, "send_batch", DEFAULT_SEND_BATCH);
+        opts.send_hold  = static_cast<uint64_t>(json::get<unsigned int>(cfg, "send_hold_us", 0)) * 1000;
+        opts.stats_interval = static_cast<uint64_t>(json::get<unsigned int>(cfg, "stats_interval_s", 0)) * 1000000000ULL;
+        opts.receivers  = json::get<unsigned int>(cfg, "receivers", 1);
+        std::string mode(json::get<std::string>(cfg, "receive_mode", "block"));
+        if ((mode != "block") && (mode != "busy_poll")) {
+            return ks::Result<Service *>::failure("'receive_mode' must be either 'block' or 'busy_poll'");
+        }
+        opts.busy_poll      = (mode == "busy_poll");
+        opts.spin_budget    = static_cast<uint64_t>(json::get<unsigned int>(cfg, "spin_us", DEFAULT_SPIN_US)) * 1000;
+        opts.busy_poll_us   = json::get<unsigned int>(cfg, "busy_poll_us", DEFAULT_BUSY_POLL_US);
+        opts.driver_wait    = Waiter::Hybrid;
+        opts.response_wait  = Waiter::Hybrid;
+        if (json::has(cfg, "wait")) {
+            json::dict wait(json::get<json::dict>(cfg, "wait"));
+            const char *stages[] = { "driver", "response" };
+            Waiter::Strategy *strategies[] = { &opts.driver_wait, &opts.response_wait };
+            for (int i=0; i<2; i++) {
+                if (!json::has(wait, stages[i])) {
+                    continue;
+                }
+                ks::Result<Waiter::Strategy> strategy = Waiter::parse(json::get<std::string>(wait, stages[i]));
+                if (strategy.failed()) {
+                    return ks::Result<Service *>::failure("'wait/" + std::string(stages[i]) + "': " + strategy.what());
+                }
+                *(strategies[i]) = strategy.get();
+            }
+        }
+        if (json::has(cfg, "threads")) {
+            json::dict threads(json::get<json::dict>(cfg, "threads"));
+            const bool strict = json::get<bool>(cfg, "threads_strict", false);
+            const char *names[] = { "receiver", "driver", "response" };
+            rt::ThreadPolicy *policies[] = { &opts.receiver_policy, &opts.driver_policy, &opts.response_policy };
+            for (int i=0; i<3; i++) {
+                if (!json::has(threads, names[i])) {
+                    continue;
+                }
+                json::dict entry(json::get<json::dict>(threads, names[i]));
+                ks::Result<rt::ThreadPolicy> policy = rt::parse_policy(entry);
+                if (policy.failed()) {
+                    return ks::Result<Service *>::failure("'threads/" + std::string(names[i]) + "': " + policy.what());
+                }
+                ks::Result<bool> available = rt::check(policy.get());
+                if (available.failed()) {
+                    if (strict) {
+                        return ks::Result<Service *>::failure("'threads/" + std::string(names[i]) + "': " + available.what());
+                    }
+                    std::cerr << "***'threads/" << names[i] << "' may not take effect: " << available.what() << std::endl;
+                }
+                *(policies[i]) = policy.get();
+            }
+        }
+        std::string stamp(json::get<std::string>(cfg, "rx_timestamp", "ns"));
+        if (stamp == "none") {
+            opts.timestamping = Socket::NoTimestamp;
+        } else if (stamp == "user") {
+            opts.timestamping = Socket::UserTimestamp;
+        } else if (stamp == "ns") {
+            opts.timestamping = Socket::KernelTimestamp;
+        } else if (stamp == "software") {
+            opts.timestamping = Socket::SoftwareTimestamp;
+        } else {
+            return ks::Result<Service *>::failure("'rx_timestamp' must be one of 'none', 'user', 'ns' and 'software'");
+        }
+        std::string backend(json::get<std::string>(cfg, "io_backend", "default"));
+        if ((backend != "default") && (backend != "uring")) {
+            return ks::Result<Service *>::failure("'io_backend' must be either 'default' or 'uring'");
+        }
+        opts.uring = (backend == "uring");
+        if (json::has(cfg, "io_uring")) {
+            json::dict entry(json::get<json::dict>(cfg, "io_uring"));
+            opts.uring_options.entries     = json::get<unsigned int>(entry, "entries", opts.uring_options.entries);
+            opts.uring_options.sqpoll      = json::get<bool>(entry, "sqpoll", opts.uring_options.sqpoll);
+            opts.uring_options.sqpoll_cpu  = json::get<int>(entry, "sqpoll_cpu", opts.uring_options.sqpoll_cpu);
+            opts.uring_options.sqpoll_idle = json::get<unsigned int>(entry, "sqpoll_idle_ms", opts.uring_options.sqpoll_idle);
+            const unsigned entries = opts.uring_options.entries;
+            if ((entries < 2) || (entries > 4096) || ((entries & (entries - 1)) != 0)) {
+                return ks::Result<Service *>::failure("'io_uring/entries' must be a power of two, from 2 to 4096");
+            }
+        }
+#ifndef __linux__
+        if (opts.uring) {
+            return ks::Result<Service *>::failure("'io_backend': 'uring' is only supported on Linux");
+        }
+        if (opts.timestamping >= Socket::KernelTimestamp) {
+            // the kernel timestamps are Linux-only
+            opts.timestamping = Socket::UserTimestamp;
+            stamp = "user";
+        }
+#endif
+        if (json::has(cfg, "clients")) {
+            json::array clients(json::get<json::array>(cfg, "clients"));
+            for (json::iterator it=clients.begin(); it!=clients.end(); it++) {
+                if (!it->is<json::dict>()) {
+                    return ks::Result<Service *>::failure("malformed 'clients' attribute");
+                }
+                json::dict entry(it->get<json::dict>());
+                ks::Result<ClientClass> client = parse_client_class(entry);
+                if (client.failed()) {
+                    return ks::Result<Service *>::failure(std::string("'clients': ") + client.what());
+                }
+                opts.clients.push_back(client.get());
+            }
+        }
+        opts.client_depth = json::get<unsigned int>(cfg, "client_queue_depth", opts.depth);
+        if (json::has(cfg, "timed_output")) {
+            if (!cfg["timed_output"].is<json::dict>()) {
+                return ks::Result<Service *>::failure("malformed 'timed_output' attribute");
+            }
+            json::dict entry(json::get<json::dict>(cfg, "timed_output"));
+            opts.timers.depth = json::get<unsigned int>(entry, "depth", TimerOptions::DEFAULT_DEPTH);
+            opts.timers.lead  = static_cast<int64_t>(json::get<int>(entry, "lead_us", -1)) * 1000;
+            opts.timers.spin  = static_cast<uint64_t>(json::get<unsigned int>(entry, "spin_us",
+                                                       TimerOptions::DEFAULT_SPIN_NS / 1000)) * 1000;
+            if (opts.timers.depth == 0) {
+                return ks::Result<Service *>::failure("'timed_output/depth' must be positive");
+            }
+        }
+        opts.max_age = static_cast<uint64_t>(json::get<unsigned int>(cfg, "max_age_us", 0)) * 1000;
+        const std::string pipeline(json::get<std::string>(cfg, "pipeline", "threaded"));
+        if ((pipeline != "threaded") && (pipeline != "inline")) {
+            return ks::Result<Service *>::failure("'pipeline' must be either 'threaded' or 'inline'");
+        }
+        opts.inline_pipeline = (pipeline == "inline");
+        if (json::has(cfg, "coalesce")) {
+            if (!cfg["coalesce"].is<json::dict>()) {
+                return ks::Result<Service *>::failure("malformed 'coalesce' attribute");
+            }
+            json::dict entry(json::get<json::dict>(cfg, "coalesce"));
+            opts.coalesce.enabled = json::get<bool>(entry, "enabled", true);
+            opts.coalesce.pulse   = static_cast<uint64_t>(json::get<unsigned int>(entry, "pulse_us", 0)) * 1000;
+            const char                *bits[]     = { "event", "sync" };
+            CoalesceOptions::Policy   *policies[] = { &(opts.coalesce.event), &(opts.coalesce.sync) };
+            for (int i=0; i<2; i++) {
+                if (!json::has(entry, bits[i])) {
+                    continue;
+                }
+                const std::string policy(json::get<std::string>(entry, bits[i]));
+                if (policy == "pulse") {
+                    *(policies[i]) = CoalesceOptions::Pulse;
+                } else if (policy == "fold") {
+                    *(policies[i]) = CoalesceOptions::Fold;
+                } else {
+                    return ks::Result<Service *>::failure(std::string("'coalesce/") + bits[i]
+                                                          + "' must be either 'pulse' or 'fold'");
+                }
+            }
+        }
+        if (json::has(cfg, "receiver_cpus")) {
+            json::array cpus(json::get<json::array>(cfg, "receiver_cpus"));
+            for (json::iterator it=cpus.begin(); it!=cpus.end(); it++) {
+                if (!it->is<double>()) {
+                    return ks::Result<Service *>::failure("malformed 'receiver_cpus' attribute");
+                }
+                opts.receiver_cpus.push_back(static_cast<int>(it->get<double>()));
+            }
+        }
+        json::dict d;
+        std::string drivername(json::get<std::string>(cfg, "driver"));
+        json::dict options(json::get<json::dict>(cfg, "options"));
+        if (opts.receivers == 0) {
+            return ks::Result<Service *>::failure("'receivers' must be positive");
+        }
+        if ((opts.ports.size() == 0) || (opts.ports.size() * opts.receivers > LISTEN_MAX)) {
+            std::stringstream ss;
+            ss << "'port' must list 1 to " << (LISTEN_MAX / opts.receivers) << " ports"
+               << " (with " << opts.receivers << " receiver(s) per port)";
+            return ks::Result<Service *>::failure(ss.str());
+        }
+        if (opts.ports.size() * opts.receivers + opts.local_ports.size() > LISTEN_MAX) {
+            std::stringstream ss;
+            ss << "too many sockets: at most " << LISTEN_MAX << " sockets (UDP and AF_UNIX) can be opened";
+            return ks::Result<Service *>::failure(ss.str());
+        }
+#ifdef _WIN32
+        if (opts.local_ports.size() > 0) {
+            return ks::Result<Service *>::failure("'unix' sockets are not supported on Windows");
+        }
+        if (opts.shm_name.size() > 0) {
+            return ks::Result<Service *>::failure("'shm' is not supported on Windows");
+        }
+#endif
+#if !(defined(__linux__) && defined(SO_REUSEPORT))
+        if (opts.receivers > 1) {
+            return ks::Result<Service *>::failure("multiple 'receivers' are only supported on Linux");
+        }
+#endif
+        if (opts.inline_pipeline && ((opts.receivers > 1) || (opts.shm_name.size() > 0))) {
+            return ks::Result<Service *>::failure("the 'inline' pipeline supports neither multiple 'receivers' nor 'shm'");
+        }
+        if (opts.depth == 0) {
+            return ks::Result<Service *>::failure("'buffer_depth' must be positive");
+        }
+        if (opts.client_depth == 0) {
+            return ks::Result<Service *>::failure("'client_queue_depth' must be positive");
+        }
+        if (opts.recv_batch == 0) {
+            return ks::Result<Service *>::failure("'recv_batch' must be positive");
+        }
+        if (opts.send_batch == 0) {
+            return ks::Result<Service *>::failure("'send_batch' must be positive");
+        }
+        if (verbose) {
+            std::cerr << "port=";
+            for (size_t i=0; i<opts.ports.size(); i++) {
+                std::cerr << ((i>0)? ",":"") << opts.ports[i];
+            }
+            std::cerr << ", driver=" << drivername
+                      << ", buffer_depth=" << opts.depth
+                      << ", recv_batch=" << opts.recv_batch
+                      << ", send_batch=" << opts.send_batch
+                      << ", send_hold=" << (opts.send_hold/1000) << "us"
+                      << ", receivers=" << opts.receivers
+                      << ", receive_mode=" << mode
+                      << ", rx_timestamp=" << stamp
+                      << ", io_backend=" << backend << ((opts.uring && opts.uring_options.sqpoll)? " (sqpoll)" : "")
+                      << ", shm=" << ((opts.shm_name.size() > 0)? opts.shm_name : "none")
+                      << ", pipeline=" << pipeline
+                      << ", client classes=" << opts.clients.size()
+                      << ", wait=" << Waiter::name(opts.driver_wait)
+                      << "/" << Waiter::name(opts.response_wait) << std::endl;
+        }
+
+        // initialize driver
+        OutputDriver *driver = get_driver(drivername, options, verbose);
+
+        // initialize server
+        std::vector<socket_t> sockets;
+        for (size_t i=0; i<opts.ports.size() * opts.receivers; i++) {
+            ks::Result<socket_t> servicesetup = Service::bind(opts.ports[i / opts.receivers], opts, verbose);
+            if (servicesetup.failed()) {
+                for (size_t j=0; j<sockets.size(); j++) {
+                    network::close_socket(sockets[j]);
+                }
+                driver->shutdown();
+                delete driver;
+                return ks::Result<Service *>::failure(servicesetup.what());
+            }
+            sockets.push_back(servicesetup.get());
+        }
+        std::vector<socket_t> locals;
+        for (size_t i=0; i<opts.local_ports.size(); i++) {
+            ks::Result<socket_t> localsetup = Service::bind_local(opts.local_ports[i], opts, verbose);
+            if (localsetup.failed()) {
+                for (size_t j=0; j<sockets.size(); j++) {
+                    network::close_socket(sockets[j]);
+                }
+                for (size_t j=0; j<locals.size(); j++) {
+                    network::close_socket(locals[j]);
+#ifndef _WIN32
+                    ::unlink(opts.local_ports[j].path.c_str());
+#endif
+                }
+                driver->shutdown();
+                delete driver;
+                return ks::Result<Service *>::failure(localsetup.what());
+            }
+            locals.push_back(localsetup.get());
+        }
+        shm::Region *region = 0;
+#ifndef _WIN32
+        if (opts.shm_name.size() > 0) {
+            ks::Result<shm::Region *> shmsetup = SharedMemoryThread::create(opts.shm_name, opts.shm_group);
+            if (shmsetup.failed()) {
+                for (size_t j=0; j<sockets.size(); j++) {
+                    network::close_socket(sockets[j]);
+                }
+                for (size_t j=0; j<locals.size(); j++) {
+                    network::close_socket(locals[j]);
+                    ::unlink(opts.local_ports[j].path.c_str());
+                }
+                driver->shutdown();
+                delete driver;
+                return ks::Result<Service *>::failure(shmsetup.what());
+            }
+            region = shmsetup.get();
+            if (verbose) {
+                std::cout << ">>> shm: " << opts.shm_name
+                          << (opts.shm_doorbell? " (doorbell)" : " (polling)") << std::endl;
+            }
+        }
+#endif
+
+        return ks::Result<Service *>::success(new Service(sockets, locals, region, driver, opts));
+    }
+
+    OutputDriver* Service::get_driver(const std::string& name, Config& options, const bool& verbose)
+    {
+        ks::Result<OutputDriver *> driversetup = OutputDriver::setup(name, options, verbose);
+
+        if (driversetup.successful()) {
+            std::cout << ">>> driver: " << name << std::endl;
+            return driversetup.get();
+        } else {
+            std::cerr << "***failed to initialize the output driver: " << driversetup.what() << "; "
+                      << "falling back to using a dummy output driver." << std::endl;
+            std::cout << ">>> driver: " << fastevent::driver::DummyDriver::identifier() << std::endl;
+            return OutputDriver::specialize(new fastevent::driver::DummyDriver(options));
+        }
+    }
+
+    ks::Result<socket_t> Service::bind(uint16_t port, const Options& options, const bool& verbose)
+    {
+        // create a socket to listen to
+        socket_t listening = socket(AF_INET, SOCK_DGRAM, 0);
+        if (listening == INVALID_SOCKET) {
+            return ks::Result<socket_t>::failure("network error: could not initialize the listening socket");
+        }
+
+        // configure socket option
+        if( network::set_reuse_address(listening) == SOCKET_ERROR ){
+            network::close_socket(listening);
+            return ks::Result<socket_t>::failure("network error: configuration failed for the listening socket");
+        }
+        if( (options.receivers > 1) && (network::set_reuse_port(listening) == SOCKET_ERROR) ){
+            network::close_socket(listening);
+            return ks::Result<socket_t>::failure("network error: SO_REUSEPORT failed for the listening socket");
+        }
+        if (options.busy_poll) {
+            if( network::set_nonblocking(listening) == SOCKET_ERROR ){
+                network::close_socket(listening);
+                return ks::Result<socket_t>::failure("network error: could not make the listening socket non-blocking");
+            }
+            if( (options.busy_poll_us > 0) &&
+                (network::set_busy_poll(listening, options.busy_poll_us) == SOCKET_ERROR) ){
+                // spinning in the user space still works
+                std::cerr << "***SO_BUSY_POLL is not available on the listening socket: "
+                          << ks::error_message() << std::endl;
+            }
+        }
+        if( network::set_rx_timestamp(listening, options.timestamping) == SOCKET_ERROR ){
+            std::stringstream ss;
+            ss << "network error: could not enable the receive timestamps (" << ks::error_message() << ")";
+            network::close_socket(listening);
+            return ks::Result<socket_t>::failure(ss.str());
+        }
+
+        // address/port settings
+        struct sockaddr_in service;
+        memset(&service, 0, sizeof(service));
+        service.sin_family      = AF_INET;
+        service.sin_port        = htons(port);
+        service.sin_addr.s_addr = htonl(INADDR_ANY);
+
+        // binding
+        if( ::bind( listening, (struct sockaddr *)&service, sizeof(service) ) == SOCKET_ERROR ){
+            std::stringstream ss;
+            ss << "network error: failed to bind to port " << port << " (" << ks::error_message() << ")";
+            network::close_socket(listening);
+            return ks::Result<socket_t>::failure(ss.str());
+        }
+
+        // do not start listening here,
+        // as it is not a TCP socket...
+
+        if (verbose) {
+            std::cout << ">>> port: " << port << std::endl;
+        }
+
+        return ks::Result<socket_t>::success(listening);
+    }
+
+    ks::Result<socket_t> Service::bind_local(const LocalPort& local, const Options& options, const bool& verbose)
+    {
+#ifdef _WIN32
+        return ks::Result<socket_t>::failure("AF_UNIX sockets are not supported on Windows");
+#else
+        struct sockaddr_un service;
+        memset(&service, 0, sizeof(service));
+        service.sun_family = AF_UNIX;
+        if ((local.path.size() == 0) || (local.path.size() >= sizeof(service.sun_path))) {
+            std::stringstream ss;
+            ss << "the path of a 'unix' socket must have 1 to " << (sizeof(service.sun_path) - 1) << " characters";
+            return ks::Result<socket_t>::failure(ss.str());
+        }
+        strncpy(service.sun_path, local.path.c_str(), sizeof(service.sun_path) - 1);
+
+        const bool seqpacket = (local.transport == Socket::LocalConnection);
+        socket_t listening = socket(AF_UNIX, seqpacket? SOCK_SEQPACKET : SOCK_DGRAM, 0);
+        if (listening == INVALID_SOCKET) {
+            return ks::Result<socket_t>::failure("network error: could not initialize the local socket ("
+                                                 + ks::error_message() + ")");
+        }
+        fcntl(listening, F_SETFD, FD_CLOEXEC);
+
+        // remove the socket file left by a previous run (but nothing else)
+        struct stat st;
+        if ((lstat(service.sun_path, &st) == 0) && S_ISSOCK(st.st_mode)) {
+            ::unlink(service.sun_path);
+        }
+
+        if( ::bind( listening, (struct sockaddr *)&service, sizeof(service) ) == SOCKET_ERROR ){
+            std::stringstream ss;
+            ss << "network error: failed to bind to " << local.path << " (" << ks::error_message() << ")";
+            network::close_socket(listening);
+            return ks::Result<socket_t>::failure(ss.str());
+        }
+        if( seqpacket && (::listen(listening, CONN_MAX) == SOCKET_ERROR) ){
+            std::stringstream ss;
+            ss << "network error: failed to listen to " << local.path << " (" << ks::error_message() << ")";
+            network::close_socket(listening);
+            ::unlink(service.sun_path);
+            return ks::Result<socket_t>::failure(ss.str());
+        }
+        if( options.busy_poll && (network::set_nonblocking(listening) == SOCKET_ERROR) ){
+            network::close_socket(listening);
+            ::unlink(service.sun_path);
+            return ks::Result<socket_t>::failure("network error: could not make the local socket non-blocking");
+        }
+        // Socket stamps the requests in the user space
+        // if the kernel does not timestamp them
+        network::set_rx_timestamp(listening, options.timestamping);
+
+        if (verbose) {
+            std::cout << ">>> unix: " << local.path << (seqpacket? " (seqpacket)" : " (dgram)") << std::endl;
+        }
+        return ks::Result<socket_t>::success(listening);
+#endif
+    }
+
+    void Service::run(const bool& verbose)
+    {
+        if (receivers_.size() == 0) {
+            rt::setup_thread(receiver_policy_, "receiver");
+        }
+        if (!inline_) {
+            driver_->start();
+            response_->start();
+        }
+        for (size_t i=0; i<receivers_.size(); i++) {
+            receivers_[i]->start();
+        }
+        if (shm_ != 0) {
+            shm_->start();
+        }
+
+        Reactor::Event events[LISTEN_MAX + CONN_MAX + 3];
+
+        while(true){
+            if (busy_poll_ && (receivers_.size() == 0)) {
+                const Status status = inline_?
+                    spin_loop(num_listeners_, spin_budget_, stopping_, &received_, &spun_,
+                              [this](const size_t& i) { return serve(listeners_[i]); }) :
+                    spin(sockets_, listeners_, num_listeners_, batch_, output_, acks_, lane_, sessions_,
+                         spin_budget_, stopping_, &received_, &spun_);
+                switch (status) {
+                case HandlingError:
+                    close_input();
+                    goto FINALLY;
+                case ShutdownRequest:
+                    goto FINALLY;
+                default:
+                    // fall back to blocking
+                    break;
+                }
+            }
+
+            int n = reactor_.wait(events, LISTEN_MAX + CONN_MAX + 3);
+            if (n < 0) {
+                std::cerr << "***service error: failed to wait for events: " << ks::error_message() << std::endl;
+                close_input();
+                goto FINALLY;
+            }
+
+            for (int i=0; i<n; i++) {
+                switch (events[i].kind) {
+                case Reactor::Wakeup:
+                    if (verbose) {
+                        std::cerr << "stop requested." << std::endl;
+                    }
+                    close_input();
+                    goto FINALLY;
+
+                case Reactor::Timer:
+                    report();
+                    break;
+
+                case Reactor::Descriptor:
+                default:
+                    if (events[i].context == &serial_desc_) {
+                        // the output device
+                        std::cerr << "***the output device has hung up" << std::endl;
+                        close_input();
+                        goto FINALLY;
+                    }
+
+                    {
+                        Listener *listener = static_cast<Listener *>(events[i].context);
+                        if (listener->kind == Listener::Acceptor) {
+                            accept(*listener);
+                            break;
+                        }
+
+                        // in case there is an input in the socket
+                        // (drain a closing connection completely)
+                        const bool closing = (listener->kind == Listener::Connection) && events[i].hangup;
+                        uint64_t   before;
+                        do {
+                            before = received_;
+                            switch(handle(*listener)) {
+                            case HandlingError:
+                                close_input();
+                                goto FINALLY;
+                            case ShutdownRequest:
+                                // the EOF has been sent through the own lane
+                                stop_receivers();
+                                goto FINALLY;
+                            default:
+                                break;
+                            }
+                        } while (closing && (received_ != before));
+
+                        if (closing || ((listener->kind == Listener::Connection) &&
+                                        sockets_[listener->index]->hung_up())) {
+                            disconnect(*listener);
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+FINALLY:
+        shutdown();
+    }
+
+    void Service::stop()
+    {
+        stopping_.store(true, std::memory_order_relaxed);
+        reactor_.wakeup();
+    }
+
+    void Service::count(uint64_t *received, uint64_t *spun)
+    {
+        *received   = received_;
+        *spun       = spun_;
+        for (size_t i=0; i<receivers_.size(); i++) {
+            *received   += receivers_[i]->received();
+            *spun       += receivers_[i]->spun();
+        }
+        if (shm_ != 0) {
+            *received   += shm_->received();
+        }
+    }
+
+    void Service::report()
+    {
+        uint64_t received, spun;
+        count(&received, &spun);
+        uint64_t unsent = 0;
+        for (size_t i=0; i<num_listeners_; i++) {
+            unsent += sockets_[i]->unsent();
+        }
+        std::cerr << "status: received=" << received
+                  << ", dropped=" << output_->overflow();
+        if (unsent > 0) {
+            std::cerr << ", responses unsent=" << unsent;
+        }
+        if (driver_->expired() > 0) {
+            std::cerr << ", expired=" << driver_->expired();
+        }
+        if ((shm_ != 0) && (shm_->dropped() > 0)) {
+            std::cerr << ", shm responses dropped=" << shm_->dropped();
+        }
+        if (busy_poll_) {
+            std::cerr << " (while spinning=" << spun
+                      << ", after sleeping=" << (received - spun) << ")";
+        }
+        std::cerr << std::endl;
+
+        if (timestamping_ != Socket::NoTimestamp) {
+            const Latency *stages[]  = { &(driver_->receive_latency()),
+                                         &(driver_->driver_latency()),
+                                         inline_? &response_latency_ : &(response_->response_latency()) };
+            const char    *names[]   = { "receive", "driver", "response" };
+            std::cerr << "latency since arrival (mean/max us):";
+            for (int i=0; i<3; i++) {
+                std::cerr << ((i>0)? ",":"") << " " << names[i] << "="
+                          << stages[i]->mean_us() << "/" << stages[i]->max_us();
+            }
+            std::cerr << std::endl;
+        }
+        const Latency& release = driver_->release_latency();
+        if (release.count() > 0) {
+            std::cerr << "scheduled commands: " << release.count() << " issued, "
+                      << "delay (mean/max us)=" << release.mean_us() << "/" << release.max_us()
+                      << ", lead=" << (driver_->lead() / 1000.0) << "us" << std::endl;
+        }
+    }
+
+    void Service::report_sessions()
+    {
+        std::vector<SessionTable::Stats> clients(sessions_->snapshot());
+        for (size_t i=0; i<clients.size(); i++) {
+            const SessionTable::Stats& client = clients[i];
+            std::cerr << "client " << client.client << " (listener #" << static_cast<int>(client.listener) << "):"
+                      << " packets=" << client.packets
+                      << ", drops=" << client.drops
+                      << ", duplicates=" << client.duplicates
+                      << ", reordered=" << client.reordered;
+            if (client.last_rtt > 0) {
+                std::cerr << ", last_rtt=" << (client.last_rtt / 1000.0) << "us";
+            }
+            std::cerr << std::endl;
+        }
+        if (sessions_->exhausted() > 0) {
+            std::cerr << "***packets refused for the lack of client sessions: "
+                      << sessions_->exhausted() << std::endl;
+        }
+    }
+
+    void Service::close_input()
+    {
+        if (has_lane_) {
+            output_->write_eof(lane_);
+        }
+        stop_receivers();
+    }
+
+    void Service::stop_receivers()
+    {
+        for (size_t i=0; i<receivers_.size(); i++) {
+            receivers_[i]->stop();
+        }
+        if (shm_ != 0) {
+            shm_->stop();
+        }
+    }
+
+    Service::Status Service::handle(const Listener& listener)
+    {
+        if (inline_) {
+            return serve(listener);
+        }
+        return forward(sockets_[listener.index], listener.index, batch_, output_, acks_, lane_, sessions_, &received_);
+    }
+
+    Service::Status Service::serve(const Listener& listener)
+    {
+        rt::HotSection hot("Service::serve");
+
+        Socket *socket = sockets_[listener.index];
+        int ret = socket->recv_batch(batch_);
+        if (ret == SOCKET_ERROR) {
+            std::cerr << "***failed to receive a packet: " << ks::error_message() << std::endl;
             return HandlingError;
-        default:
-            // message received
-            if (IsShutdown(buf)) {
-                output_->write_eof();
+        }
+        received_ += static_cast<size_t>(ret);
+
+        const uint64_t now = monotonic_ns();
+        for (int i=0; i<ret; i++) {
+            Packet& packet = batch_[i];
+            const uint16_t session = sessions_->open(lane_, listener.index, socket->sender(i), socket->sender_len(i),
+                                                     static_cast<uint8_t>(packet.payload[protocol::INDEX_BYTE]));
+            if (session == SessionTable::NO_SESSION) {
+                continue;
+            }
+            packet.session  = session;
+            packet.listener = listener.index;
+            if (is_shutdown(packet)) {
+                // (the shutdown request itself gets no response)
+                sessions_->release(session);
                 return ShutdownRequest;
+            }
+
+            packet.stamped  = now;
+            packet.ack      = ack_mode(packet, *sessions_);
+            if (packet.ack == AckOnReceive) {
+                sessions_->hold(session);
+                respond(socket, packet);
+            }
+            if (driver_->commit(packet)) {
+                respond(socket, packet);
             } else {
-                output_->write(&sender, buf);
+                // (acknowledged already, or never)
+                sessions_->release(session);
+            }
+        }
+        return Acqknowledge;
+    }
+
+    void Service::respond(Socket *socket, const Packet& packet)
+    {
+        if (socket->send_batch(&packet, 1, *sessions_) == SOCKET_ERROR) {
+            std::cerr << "***failed to send a packet (dropped): " << ks::error_message() << std::endl;
+            sessions_->release(packet.session, true);
+            return;
+        }
+        const uint64_t now = (packet.arrival != 0)? wallclock_ns() : 0;
+        response_latency_.add(packet.arrival, now);
+        sessions_->complete(packet.session, (now > packet.arrival)? (now - packet.arrival) : 0);
+    }
+
+    void Service::accept(const Listener& acceptor)
+    {
+#ifndef _WIN32
+        socket_t conn = ::accept(acceptor.desc, NULL, NULL);
+        if (conn == INVALID_SOCKET) {
+            if ((!network::would_block()) && (errno != EINTR)) {
+                std::cerr << "***failed to accept a local connection: " << ks::error_message() << std::endl;
+            }
+            return;
+        }
+        fcntl(conn, F_SETFD, FD_CLOEXEC);
+
+        // a slot is free once ResponseThread has released its previous connection
+        int slot = -1;
+        for (int i=0; i<CONN_MAX; i++) {
+            Socket *previous = sockets_[LISTEN_MAX + i];
+            if ((previous == 0) || previous->released()) {
+                delete previous;
+                sockets_[LISTEN_MAX + i] = 0;
+                slot = i;
+                break;
+            }
+        }
+        if (slot < 0) {
+            std::cerr << "***refused a local connection: there are already "
+                      << CONN_MAX << " connections" << std::endl;
+            network::close_socket(conn);
+            return;
+        }
+
+        network::set_rx_timestamp(conn, timestamping_);
+        const size_t index  = LISTEN_MAX + slot;
+        // the slot is a new client now
+        network::Address none;
+        memset(&none, 0, sizeof(none));
+        sessions_->retire(lane_, static_cast<uint8_t>(index), none, 0);
+        listeners_[index].desc  = conn;
+        listeners_[index].index = static_cast<uint8_t>(index);
+        listeners_[index].kind  = Listener::Connection;
+        sockets_[index]         = new Socket(conn, recv_batch_, send_batch_,
+                                             timestamping_, Socket::LocalConnection);
+        if (!reactor_.add(conn, listeners_ + index)) {
+            std::cerr << "***failed to watch a local connection: " << ks::error_message() << std::endl;
+            sockets_[index]->close();
+            delete sockets_[index];
+            sockets_[index] = 0;
+        }
+#endif
+    }
+
+    void Service::disconnect(Listener& connection)
+    {
+        reactor_.remove(connection.desc);
+        sockets_[connection.index]->close_receive();
+        if (inline_) {
+            // all the responses have been sent already
+            sockets_[connection.index]->release();
+            return;
+        }
+
+        // let ResponseThread release the socket, after it has sent
+        // the responses that are still in the pipeline
+        Packet closing;
+        memset(&closing, 0, sizeof(closing));
+        closing.is_close = true;
+        closing.listener = connection.index;
+        closing.session  = SessionTable::NO_SESSION;
+        output_->write_wait(closing, lane_);
+    }
+
+    Service::Status Service::spin(Socket **sockets, const Listener *listeners, const size_t& n,
+                                  Packet *batch, IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions,
+                                  const uint64_t& budget, const std::atomic<bool>& stopping,
+                                  uint64_t *received, uint64_t *spun)
+    {
+        return spin_loop(n, budget, stopping, received, spun, [&](const size_t& i) {
+            return forward(sockets[i], listeners[i].index, batch, output, acks, lane, sessions, received);
+        });
+    }
+
+    Service::Status Service::forward(Socket *socket, const uint8_t& listener, Packet *batch,
+                                     IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions,
+                                     uint64_t *received)
+    {
+        rt::HotSection hot("Service::handle");
+
+        // read the pending UDP packets
+        int ret = socket->recv_batch(batch);
+        if (ret == SOCKET_ERROR) {
+            std::cerr << "***failed to receive a packet: " << ks::error_message() << std::endl;
+            return HandlingError;
+        }
+
+        // replace the senders with their sessions, skipping the packets
+        // from the new clients that the table has no room for
+        *received += static_cast<size_t>(ret);
+        size_t count = 0;
+        for (int i=0; i<ret; i++) {
+            const uint16_t session = sessions->open(lane, listener, socket->sender(i), socket->sender_len(i),
+                                                    static_cast<uint8_t>(batch[i].payload[protocol::INDEX_BYTE]));
+            if (session == SessionTable::NO_SESSION) {
+                continue;
+            }
+            if (count != static_cast<size_t>(i)) {
+                batch[count] = batch[i];
+            }
+            batch[count].session  = session;
+            batch[count].listener = listener;
+            count++;
+        }
+        return dispatch(batch, count, output, acks, lane, sessions);
+    }
+
+    Service::Status Service::dispatch(Packet *batch, const size_t& count,
+                                      IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions)
+    {
+        // messages received: everything before a shutdown request goes downstream
+        // (a version 2 request with a shutdown command is a shutdown request as a whole)
+        size_t end = count;
+        for (size_t i=0; i<count; i++) {
+            if (is_shutdown(batch[i])) {
+                end = i;
+                break;
+            }
+        }
+
+        // the acknowledgements on receipt go straight to ResponseThread
+        // (or after all on commit, if there is no room for them)
+        const uint64_t now = monotonic_ns();
+        for (size_t i=0; i<end; i++) {
+            Packet& packet = batch[i];
+            packet.stamped = now;
+            packet.ack     = ack_mode(packet, *sessions);
+            if (packet.ack == AckOnReceive) {
+                sessions->hold(packet.session);
+                if (!acks->try_write(packet, lane + 1)) {
+                    sessions->release(packet.session);
+                    packet.ack = AckOnCommit;
+                }
             }
-            break;
+        }
+
+        const size_t written = (end > 0)? output->write_batch(batch, end, lane) : 0;
+        for (size_t i=written; i<count; i++) {
+            // (the shutdown request itself gets no response, but is no drop)
+            sessions->release(batch[i].session, (i != end));
+        }
+        if (end < count) {
+            output->write_eof(lane);
+            return ShutdownRequest;
         }
         return Acqknowledge;
     }
@@ -406,13 +2774,133 @@ FINALLY:
             std::cerr << "shutting down the server..." << std::endl;
         }
 
-        driver_->join();
-        response_->join();
+        if (inline_) {
+            driver_->shutdown();
+        } else {
+            driver_->join();
+            response_->join();
+        }
+        if (verbose && (busy_poll_ || (timestamping_ != Socket::NoTimestamp))) {
+            // the final counts
+            report();
+        }
+        for (size_t i=0; i<receivers_.size(); i++) {
+            receivers_[i]->join();
+            delete receivers_[i];
+        }
+        if (shm_ != 0) {
+            shm_->join();
+            delete shm_;
+        }
+
+        // close the listening sockets
+        for (size_t i=0; i<num_listeners_; i++) {
+            sockets_[i]->close();
+            delete sockets_[i];
+        }
+        for (int i=0; i<CONN_MAX; i++) {
+            if (sockets_[LISTEN_MAX + i] != 0) {
+                sockets_[LISTEN_MAX + i]->close();
+                delete sockets_[LISTEN_MAX + i];
+            }
+        }
+        for (size_t i=0; i<num_acceptors_; i++) {
+            network::close_socket(acceptors_[i].desc);
+        }
+#ifndef _WIN32
+        for (size_t i=0; i<local_paths_.size(); i++) {
+            ::unlink(local_paths_[i].c_str());
+        }
+#endif
 
-        // close the listening socket
-        socket_.close();
+        if (verbose) {
+            report_sessions();
+        }
 
         delete driver_;
         delete response_;
+        delete scheduler_;
+        delete sessions_;
+        delete[] batch_;
+    }
+
+    ReceiverThread::ReceiverThread(Service *service, Socket *socket, const uint8_t& listener,
+                                   IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions,
+                                   const rt::ThreadPolicy& policy, const uint64_t& spin_budget):
+        ks::Thread(), service_(service), socket_(socket),
+        output_(output), acks_(acks), lane_(lane), sessions_(sessions), policy_(policy), reactor_(),
+        batch_(new Packet[socket->recv_batch_size()]()), spin_budget_(spin_budget),
+        stopping_(false), received_(0), spun_(0)
+    {
+        listener_.desc  = socket->descriptor();
+        listener_.index = listener;
+        listener_.kind  = Service::Listener::Datagram;
+        reactor_.add(socket->poll_descriptor(), socket);
+        reactor_.add_wakeup(this);
+    }
+
+    ReceiverThread::~ReceiverThread()
+    {
+        delete[] batch_;
+    }
+
+    void ReceiverThread::stop()
+    {
+        stopping_.store(true, std::memory_order_relaxed);
+        reactor_.wakeup();
+    }
+
+    void ReceiverThread::run()
+    {
+        std::stringstream name;
+        name << "receiver " << lane_;
+        rt::setup_thread(policy_, name.str());
+
+        Reactor::Event events[2];
+        uint64_t       received = 0;
+        uint64_t       spun     = 0;
+        while (true) {
+            if (spin_budget_ > 0) {
+                Service::Status status = Service::spin(&socket_, &listener_, 1, batch_, output_, acks_, lane_, sessions_,
+                                                       spin_budget_, stopping_, &received, &spun);
+                received_.store(received, std::memory_order_relaxed);
+                spun_.store(spun, std::memory_order_relaxed);
+                switch (status) {
+                case Service::HandlingError:
+                    goto FAILED;
+                case Service::ShutdownRequest:
+                    service_->stop();
+                    return;
+                default:
+                    break;
+                }
+            }
+
+            int n = reactor_.wait(events, 2);
+            if (n < 0) {
+                std::cerr << "***receiver error: failed to wait for events: " << ks::error_message() << std::endl;
+                goto FAILED;
+            }
+            for (int i=0; i<n; i++) {
+                if (events[i].kind == Reactor::Wakeup) {
+                    goto STOPPED;
+                }
+                switch (Service::forward(socket_, listener_.index, batch_, output_, acks_, lane_, sessions_, &received)) {
+                case Service::HandlingError:
+                    goto FAILED;
+                case Service::ShutdownRequest:
+                    received_.store(received, std::memory_order_relaxed);
+                    service_->stop();
+                    return;
+                default:
+                    break;
+                }
+                received_.store(received, std::memory_order_relaxed);
+            }
+        }
+FAILED:
+        service_->stop();
+STOPPED:
+        output_->write_eof(lane_);
     }
 }
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   session.cpp -- the client sessions (see SessionTable in service.h)
+*/
+#include "service.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+#include <sstream>
+#include <stddef.h>
+#include <string.h>
+
+namespace fastevent {
+
+    static_assert((SESSION_SLOTS & (SESSION_SLOTS - 1)) == 0, "SESSION_SLOTS must be a power of two");
+    static_assert((LISTEN_MAX + 2) * SESSION_SLOTS < SessionTable::NO_SESSION, "too many session slots for a handle");
+
+    namespace network {
+        std::string describe(const Address& address, const uint8_t& len)
+        {
+            std::stringstream ss;
+            if (len == 0) {
+                ss << "connection";
+                return ss.str();
+            }
+            switch (address.any.sa_family) {
+            case AF_INET:
+                {
+#ifdef _WIN32
+                    ss << inet_ntoa(address.in.sin_addr);
+#else
+                    char host[INET_ADDRSTRLEN];
+                    ss << ((inet_ntop(AF_INET, &(address.in.sin_addr), host, sizeof(host)) != NULL)? host : "?");
+#endif
+                    ss << ":" << ntohs(address.in.sin_port);
+                }
+                break;
+#ifndef _WIN32
+            case AF_UNIX:
+                {
+                    // an unbound client has no path
+                    const size_t offset = offsetof(struct sockaddr_un, sun_path);
+                    if ((len > offset) && (address.un.sun_path[0] != '\0')) {
+                        ss << std::string(address.un.sun_path, strnlen(address.un.sun_path, len - offset));
+                    } else {
+                        ss << "(unnamed)";
+                    }
+                }
+                break;
+            case AF_UNSPEC:
+                ss << "shm channel " << address.channel.index << " (pid " << address.channel.owner << ")";
+                break;
+#endif
+            default:
+                ss << "(family " << address.any.sa_family << ")";
+                break;
+            }
+            return ss.str();
+        }
+    }
+
+    /**
+     * FNV-1a over the listener and the address
+     */
+    inline uint32_t session_hash(const uint8_t& listener, const network::Address& address, const uint8_t& len)
+    {
+        uint32_t hash = 2166136261U;
+        hash = (hash ^ listener) * 16777619U;
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&address);
+        for (uint8_t i=0; i<len; i++) {
+            hash = (hash ^ bytes[i]) * 16777619U;
+        }
+        return hash;
+    }
+
+    SessionTable::SessionTable(const size_t& partitions):
+        partitions_(partitions), classes_(),
+        slots_(new Slot[partitions * SESSION_SLOTS]),
+        ticks_(new uint64_t[partitions]()),
+        exhausted_(0)
+    {
+        for (size_t i=0; i<partitions_ * SESSION_SLOTS; i++) {
+            Slot& slot = slots_[i];
+            slot.state       = Empty;
+            slot.listener    = 0;
+            slot.address_len = 0;
+            memset(&(slot.address), 0, sizeof(slot.address));
+            slot.generation  = 0;
+            slot.ack         = AckOnCommit;
+            slot.last_seen   = 0;
+            slot.has_index   = false;
+            slot.last_index  = 0;
+            slot.window      = 0;
+            slot.in_flight.store(0, std::memory_order_relaxed);
+            slot.packets.store(0, std::memory_order_relaxed);
+            slot.drops.store(0, std::memory_order_relaxed);
+            slot.duplicates.store(0, std::memory_order_relaxed);
+            slot.reordered.store(0, std::memory_order_relaxed);
+            slot.last_rtt.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    SessionTable::~SessionTable()
+    {
+        delete[] slots_;
+        delete[] ticks_;
+    }
+
+    int SessionTable::find(const size_t& partition, const uint8_t& listener,
+                           const network::Address& address, const uint8_t& address_len) const
+    {
+        const Slot    *base = slots_ + partition * SESSION_SLOTS;
+        const uint32_t home = session_hash(listener, address, address_len);
+        for (int i=0; i<SESSION_SLOTS; i++) {
+            const int   index = static_cast<int>((home + i) & (SESSION_SLOTS - 1));
+            const Slot& slot  = base[index];
+            if (slot.state == Empty) {
+                // the end of the probe sequence
+                break;
+            }
+            if ((slot.state == Active) && (slot.listener == listener) && (slot.address_len == address_len)
+                    && (memcmp(&(slot.address), &address, address_len) == 0)) {
+                return index;
+            }
+        }
+        return -1;
+    }
+
+    uint16_t SessionTable::open(const size_t& partition, const uint8_t& listener,
+                                const network::Address& address, const uint8_t& address_len,
+                                const uint8_t& index)
+    {
+        Slot          *base = slots_ + partition * SESSION_SLOTS;
+        const uint64_t tick = ++ticks_[partition];
+
+        int found = find(partition, listener, address, address_len);
+        if (found < 0) {
+            // the first free slot on the probe sequence. the slots never become
+            // Empty again, so that once the partition has filled up, any slot
+            // is on the probe sequence, and the least recently seen one is replaced
+            // (preferably a retired one), unless it still has requests in the pipeline.
+            const uint32_t home = session_hash(listener, address, address_len);
+            int      victim  = -1;
+            bool     retired = false;
+            uint64_t oldest  = 0;
+            for (int i=0; i<SESSION_SLOTS; i++) {
+                const int   candidate = static_cast<int>((home + i) & (SESSION_SLOTS - 1));
+                const Slot& slot      = base[candidate];
+                if (slot.state == Empty) {
+                    victim = candidate;
+                    break;
+                }
+                if (slot.in_flight.load(std::memory_order_acquire) != 0) {
+                    continue;
+                }
+                const bool is_retired = (slot.state == Retired);
+                if ((victim < 0) || (is_retired && (!retired))
+                        || ((is_retired == retired) && (slot.last_seen < oldest))) {
+                    victim  = candidate;
+                    retired = is_retired;
+                    oldest  = slot.last_seen;
+                }
+            }
+            if (victim < 0) {
+                exhausted_.fetch_add(1, std::memory_order_relaxed);
+                return NO_SESSION;
+            }
+
+            Slot& slot = base[victim];
+            slot.state       = Active;
+            slot.listener    = listener;
+            slot.address_len = address_len;
+            memset(&(slot.address), 0, sizeof(slot.address));
+            memcpy(&(slot.address), &address, address_len);
+            slot.generation++;
+            slot.ack         = AckOnCommit;
+            for (size_t i=0; i<classes_.size(); i++) {
+                if (classes_[i].matches(address, address_len)) {
+                    slot.ack = classes_[i].ack;
+                    break;
+                }
+            }
+            slot.has_index   = false;
+            slot.window      = 0;
+            slot.packets.store(0, std::memory_order_relaxed);
+            slot.drops.store(0, std::memory_order_relaxed);
+            slot.duplicates.store(0, std::memory_order_relaxed);
+            slot.reordered.store(0, std::memory_order_relaxed);
+            slot.last_rtt.store(0, std::memory_order_relaxed);
+            found = victim;
+        }
+
+        Slot& slot = base[found];
+        slot.last_seen = tick;
+        slot.packets.fetch_add(1, std::memory_order_relaxed);
+        slot.in_flight.fetch_add(1, std::memory_order_relaxed);
+        track(slot, index);
+        return static_cast<uint16_t>(partition * SESSION_SLOTS + found);
+    }
+
+    void SessionTable::track(Slot& slot, const uint8_t& index)
+    {
+        if (!slot.has_index) {
+            slot.has_index  = true;
+            slot.last_index = index;
+            slot.window     = 1;
+            return;
+        }
+
+        // the index byte wraps around; within half of its range,
+        // a later one is ahead of the last one, and an earlier one behind.
+        // the bits of `window` are the indices seen, counting back from the last one.
+        const int delta = static_cast<int8_t>(static_cast<uint8_t>(index - slot.last_index));
+        if (delta > 0) {
+            slot.window     = (delta < 64)? ((slot.window << delta) | 1) : 1;
+            slot.last_index = index;
+            return;
+        }
+
+        const int      age = -delta;
+        const uint64_t bit = (age < 64)? (1ULL << age) : 0;
+        if ((slot.window & bit) != 0) {
+            slot.duplicates.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            slot.reordered.fetch_add(1, std::memory_order_relaxed);
+            slot.window |= bit;
+        }
+    }
+
+    void SessionTable::retire(const size_t& partition, const uint8_t& listener,
+                              const network::Address& address, const uint8_t& address_len)
+    {
+        const int found = find(partition, listener, address, address_len);
+        if (found >= 0) {
+            slots_[partition * SESSION_SLOTS + found].state = Retired;
+        }
+    }
+
+    void SessionTable::release(const uint16_t& handle, const bool& dropped)
+    {
+        Slot& slot = slots_[handle];
+        if (dropped) {
+            slot.drops.fetch_add(1, std::memory_order_relaxed);
+        }
+        // the slot may be replaced from here on
+        slot.in_flight.fetch_sub(1, std::memory_order_release);
+    }
+
+    void SessionTable::complete(const uint16_t& handle, const uint64_t& rtt)
+    {
+        Slot& slot = slots_[handle];
+        if (rtt > 0) {
+            slot.last_rtt.store(rtt, std::memory_order_relaxed);
+        }
+        slot.in_flight.fetch_sub(1, std::memory_order_release);
+    }
+
+    std::vector<SessionTable::Stats> SessionTable::snapshot() const
+    {
+        std::vector<Stats> stats;
+        for (size_t i=0; i<partitions_ * SESSION_SLOTS; i++) {
+            const Slot& slot = slots_[i];
+            if (slot.state == Empty) {
+                continue;
+            }
+            Stats entry;
+            entry.client     = network::describe(slot.address, slot.address_len);
+            entry.listener   = slot.listener;
+            entry.packets    = slot.packets.load(std::memory_order_relaxed);
+            entry.drops      = slot.drops.load(std::memory_order_relaxed);
+            entry.duplicates = slot.duplicates.load(std::memory_order_relaxed);
+            entry.reordered  = slot.reordered.load(std::memory_order_relaxed);
+            entry.last_rtt   = slot.last_rtt.load(std::memory_order_relaxed);
+            stats.push_back(entry);
+        }
+        return stats;
+    }
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   shm.cpp -- the server side of the shared-memory transport (see shm.h)
+*/
+#include "service.h"
+#include "shm.h"
+#include "rt.h"
+
+#include <iostream>
+
+#ifndef _WIN32
+#include <grp.h>
+#include <stdlib.h>
+#endif
+
+namespace fastevent {
+#ifndef _WIN32
+    /**
+    *   how long the thread sleeps on the doorbell at a time, so that
+    *   the requests in a missed wakeup (if any) are not held for long
+    */
+    const uint64_t SHM_SLEEP_NS = 100000000ULL;
+
+    /**
+    *   the ID of `group` (a name or a number). returns false if there is no such group.
+    */
+    inline bool lookup_group(const std::string& group, gid_t *gid)
+    {
+        char *end = 0;
+        const unsigned long id = strtoul(group.c_str(), &end, 10);
+        if ((end != group.c_str()) && (*end == '\0')) {
+            *gid = static_cast<gid_t>(id);
+            return true;
+        }
+        struct group *entry = ::getgrnam(group.c_str());
+        if (entry == 0) {
+            return false;
+        }
+        *gid = entry->gr_gid;
+        return true;
+    }
+
+    ks::Result<shm::Region *> SharedMemoryThread::create(const std::string& name, const std::string& group)
+    {
+        gid_t gid = 0;
+        if ((group.size() > 0) && (!lookup_group(group, &gid))) {
+            return ks::Result<shm::Region *>::failure("shm error: unknown group '" + group + "'");
+        }
+
+        // a region left by a crashed server has to be replaced
+        ::shm_unlink(name.c_str());
+        // (any process that can write to the region can pass commands to the driver)
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            return ks::Result<shm::Region *>::failure("shm error: could not create '" + name + "': " + ks::error_message());
+        }
+        if ((group.size() > 0) && ((::fchown(fd, (uid_t)-1, gid) != 0) || (::fchmod(fd, 0660) != 0))) {
+            std::string message("shm error: could not give '" + name + "' to group '" + group + "': " + ks::error_message());
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            return ks::Result<shm::Region *>::failure(message);
+        }
+        if (::ftruncate(fd, sizeof(shm::Region)) != 0) {
+            std::string message("shm error: could not allocate '" + name + "': " + ks::error_message());
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            return ks::Result<shm::Region *>::failure(message);
+        }
+        void *addr = ::mmap(0, sizeof(shm::Region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            std::string message("shm error: could not map '" + name + "': " + ks::error_message());
+            ::shm_unlink(name.c_str());
+            return ks::Result<shm::Region *>::failure(message);
+        }
+
+        // the new region is zero-filled, i.e. all the channels are free and empty.
+        // the clients only accept it once the magic number is there.
+        shm::Region *region = static_cast<shm::Region *>(addr);
+        region->version  = shm::VERSION;
+        region->channels = shm::CHANNELS_MAX;
+        region->slots    = shm::SLOTS;
+        region->magic.store(shm::MAGIC, std::memory_order_release);
+        return ks::Result<shm::Region *>::success(region);
+    }
+
+    SharedMemoryThread::SharedMemoryThread(Service *service, shm::Region *region, const std::string& name,
+                                           IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions,
+                                           const rt::ThreadPolicy& policy, const uint64_t& spin_budget,
+                                           const bool& doorbell, const Socket::Timestamping& timestamping):
+        ks::Thread(), service_(service), region_(region), name_(name),
+        output_(output), acks_(acks), lane_(lane), sessions_(sessions), policy_(policy), spin_budget_(spin_budget),
+        doorbell_(doorbell), timestamping_(timestamping),
+        batch_(new Packet[shm::SLOTS]()), stopping_(false), received_(0), dropped_(0)
+    {
+        for (uint32_t i=0; i<shm::SLOTS; i++) {
+            batch_[i].listener = static_cast<uint8_t>(SHM_LISTENER);
+        }
+    }
+
+    SharedMemoryThread::~SharedMemoryThread()
+    {
+        // the clients that still have the region mapped simply stop getting responses
+        region_->magic.store(0, std::memory_order_release);
+        ::munmap(region_, sizeof(shm::Region));
+        ::shm_unlink(name_.c_str());
+        delete[] batch_;
+    }
+
+    void SharedMemoryThread::stop()
+    {
+        stopping_.store(true, std::memory_order_relaxed);
+        region_->doorbell.fetch_add(1, std::memory_order_seq_cst);
+        shm::futex_wake(&(region_->doorbell));
+    }
+
+    size_t SharedMemoryThread::poll(Packet *packets, const size_t& max)
+    {
+        size_t count = 0;
+        network::Address client;
+        memset(&client, 0, sizeof(client));
+        client.channel.family = AF_UNSPEC;
+        for (uint32_t i=0; (i<shm::CHANNELS_MAX) && (count<max); i++) {
+            // (the requests that a client has left before closing are still served;
+            // the next owner of the channel discards the responses).
+            // a new process on the channel is a new client.
+            shm::Channel& channel = region_->channel[i];
+            client.channel.index  = static_cast<uint16_t>(i);
+            client.channel.owner  = channel.owner.load(std::memory_order_acquire);
+            while ((count < max) && channel.requests.pop(packets[count].payload)) {
+                Packet& packet  = packets[count];
+                packet.session  = sessions_->open(lane_, packet.listener, client, sizeof(client.channel),
+                                                  static_cast<uint8_t>(packet.payload[protocol::INDEX_BYTE]));
+                if (packet.session == SessionTable::NO_SESSION) {
+                    continue;
+                }
+                packet.count    = 0;
+                packet.flags    = 0;
+                packet.is_eof   = false;
+                packet.is_close = false;
+                count++;
+            }
+        }
+
+        const uint64_t now = (timestamping_ == Socket::NoTimestamp)? 0 : wallclock_ns();
+        for (size_t i=0; i<count; i++) {
+            packets[i].arrival  = now;
+            packets[i].received = now;
+        }
+        return count;
+    }
+
+    void SharedMemoryThread::sleep()
+    {
+        const uint32_t bell = region_->doorbell.load(std::memory_order_relaxed);
+        region_->server_sleeping.store(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // a client that has pushed before seeing `server_sleeping` does not ring
+        bool pending = stopping_.load(std::memory_order_relaxed);
+        for (uint32_t i=0; (i<shm::CHANNELS_MAX) && (!pending); i++) {
+            pending = !(region_->channel[i].requests.empty());
+        }
+        if (!pending) {
+            shm::futex_wait(&(region_->doorbell), bell, SHM_SLEEP_NS);
+        }
+        region_->server_sleeping.store(0, std::memory_order_relaxed);
+    }
+
+    void SharedMemoryThread::run()
+    {
+        rt::setup_thread(policy_, "shm");
+
+        ks::nanostamp   clock;
+        uint64_t        last, now;
+        uint64_t        received = 0;
+        clock.get(&last);
+
+        while (!stopping_.load(std::memory_order_relaxed)) {
+            size_t count = poll(batch_, shm::SLOTS);
+            if (count > 0) {
+                rt::HotSection hot("SharedMemoryThread::run");
+                received += count;
+                received_.store(received, std::memory_order_relaxed);
+                if (Service::dispatch(batch_, count, output_, acks_, lane_, sessions_) == Service::ShutdownRequest) {
+                    // the EOF has been sent through the own lane
+                    service_->stop();
+                    return;
+                }
+                clock.get(&last);
+                continue;
+            }
+
+            clock.get(&now);
+            if (doorbell_ && (now - last >= spin_budget_)) {
+                sleep();
+                clock.get(&last);
+            } else {
+                cpu_relax();
+            }
+        }
+        output_->write_eof(lane_);
+    }
+
+    void SharedMemoryThread::respond(const Packet *packets, const size_t& n, const SessionTable& sessions)
+    {
+        uint32_t touched = 0;
+        for (size_t i=0; i<n; i++) {
+            const uint16_t index = sessions.address(packets[i].session).channel.index;
+            if (index >= shm::CHANNELS_MAX) {
+                continue;
+            }
+            if (region_->channel[index].responses.push(packets[i].payload)) {
+                touched |= (1U << index);
+            } else {
+                // the client is not taking its responses
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (touched == 0) {
+            return;
+        }
+
+        // only the clients asleep need a system call
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (uint32_t i=0; i<shm::CHANNELS_MAX; i++) {
+            shm::Channel& channel = region_->channel[i];
+            if ((touched & (1U << i)) && (channel.client_sleeping.load(std::memory_order_relaxed) != 0)) {
+                channel.response_bell.fetch_add(1, std::memory_order_seq_cst);
+                shm::futex_wake(&(channel.response_bell));
+            }
+        }
+    }
+
+#else
+    ks::Result<shm::Region *> SharedMemoryThread::create(const std::string& name, const std::string& group)
+    {
+        return ks::Result<shm::Region *>::failure("shm error: the shared-memory transport is not supported on Windows");
+    }
+
+    SharedMemoryThread::SharedMemoryThread(Service *service, shm::Region *region, const std::string& name,
+                                           IOBuffer *output, IOBuffer *acks, const size_t& lane, SessionTable *sessions,
+                                           const rt::ThreadPolicy& policy, const uint64_t& spin_budget,
+                                           const bool& doorbell, const Socket::Timestamping& timestamping):
+        ks::Thread(), service_(service), region_(region), name_(name),
+        output_(output), acks_(acks), lane_(lane), sessions_(sessions), policy_(policy), spin_budget_(spin_budget),
+        doorbell_(doorbell), timestamping_(timestamping),
+        batch_(0), stopping_(false), received_(0), dropped_(0) { }
+
+    SharedMemoryThread::~SharedMemoryThread() { }
+
+    void SharedMemoryThread::stop() { }
+
+    size_t SharedMemoryThread::poll(Packet *packets, const size_t& max) { return 0; }
+
+    void SharedMemoryThread::sleep() { }
+
+    void SharedMemoryThread::run() { output_->write_eof(lane_); }
+
+    void SharedMemoryThread::respond(const Packet *packets, const size_t& n, const SessionTable& sessions) { }
+#endif
+}
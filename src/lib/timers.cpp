@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   timers.cpp -- see timers.h for description
+*/
+#include "timers.h"
+#include "service.h"
+
+namespace fastevent {
+
+    const size_t   TimerOptions::DEFAULT_DEPTH;
+    const uint64_t TimerOptions::DEFAULT_SPIN_NS;
+
+    TimerQueue::TimerQueue(const size_t& capacity):
+        capacity_(capacity), packets_(new Packet[capacity]()), free_(new uint32_t[capacity]),
+        heap_(new Entry[capacity]), size_(0), serial_(0)
+    {
+        for (size_t i=0; i<capacity_; i++) {
+            free_[i] = static_cast<uint32_t>(i);
+        }
+    }
+
+    TimerQueue::~TimerQueue()
+    {
+        delete[] packets_;
+        delete[] free_;
+        delete[] heap_;
+    }
+
+    bool TimerQueue::push(const Packet& packet)
+    {
+        if (size_ == capacity_) {
+            return false;
+        }
+        // (the free slots are the ones past the heap in `free_`)
+        const uint32_t slot = free_[size_];
+        packets_[slot] = packet;
+
+        Entry entry;
+        entry.target = packet.target;
+        entry.serial = serial_++;
+        entry.slot   = slot;
+
+        place(size_++, entry);
+        return true;
+    }
+
+    void TimerQueue::pop(Packet *packet)
+    {
+        *packet = packets_[heap_[0].slot];
+        remove(0);
+    }
+
+    bool TimerQueue::pop_listener(const uint8_t& listener, Packet *packet)
+    {
+        for (size_t i=0; i<size_; i++) {
+            if (packets_[heap_[i].slot].listener == listener) {
+                *packet = packets_[heap_[i].slot];
+                remove(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void TimerQueue::remove(const size_t& index)
+    {
+        free_[--size_] = heap_[index].slot;
+        if (index < size_) {
+            // the last one takes the place
+            const Entry last = heap_[size_];
+            place(index, last);
+        }
+    }
+
+    void TimerQueue::place(size_t i, const Entry& entry)
+    {
+        // sift up
+        while (i > 0) {
+            const size_t parent = (i - 1) / 2;
+            if (!earlier(entry, heap_[parent])) {
+                break;
+            }
+            heap_[i] = heap_[parent];
+            i = parent;
+        }
+        // sift down
+        while (true) {
+            size_t child = 2*i + 1;
+            if (child >= size_) {
+                break;
+            }
+            if ((child + 1 < size_) && earlier(heap_[child + 1], heap_[child])) {
+                child++;
+            }
+            if (!earlier(heap_[child], entry)) {
+                break;
+            }
+            heap_[i] = heap_[child];
+            i = child;
+        }
+        heap_[i] = entry;
+    }
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   uring.cpp -- see uring.h for description
+*/
+#include "uring.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <sstream>
+
+namespace fastevent {
+
+    /**
+    *   the system calls (not wrapped by glibc)
+    */
+    inline int uring_setup(const unsigned& entries, struct io_uring_params *params)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    inline int uring_enter(const int& fd, const unsigned& to_submit, const unsigned& wait, const unsigned& flags)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, wait, flags, NULL, 0));
+    }
+
+    inline int uring_register(const int& fd, const unsigned& opcode, void *arg, const unsigned& nargs)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nargs));
+    }
+
+    Uring::Uring():
+        fd_(-1), sqpoll_(false),
+        sq_ring_(MAP_FAILED), sq_ring_size_(0), cq_ring_(MAP_FAILED), cq_ring_size_(0),
+        sqes_(static_cast<struct io_uring_sqe *>(MAP_FAILED)), sqes_size_(0),
+        sq_local_tail_(0),
+        buf_ring_(static_cast<struct io_uring_buf_ring *>(MAP_FAILED)), buf_ring_size_(0),
+        buffers_(static_cast<char *>(MAP_FAILED)), buffer_size_(0), buf_count_(0), buf_tail_(0)
+    { }
+
+    ks::Result<Uring *> Uring::create(const UringOptions& options, const Uring *share)
+    {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        // room for the completions of a multishot receive while the SQ is busy
+        params.flags        = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+        params.cq_entries   = options.entries * 4;
+        if (options.sqpoll) {
+            params.flags         |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = options.sqpoll_idle;
+            if (options.sqpoll_cpu >= 0) {
+                params.flags        |= IORING_SETUP_SQ_AFF;
+                params.sq_thread_cpu = static_cast<unsigned>(options.sqpoll_cpu);
+            }
+            if (share != 0) {
+                params.flags |= IORING_SETUP_ATTACH_WQ;
+                params.wq_fd  = static_cast<unsigned>(share->fd_);
+            }
+        }
+
+        Uring *ring  = new Uring();
+        ring->sqpoll_ = options.sqpoll;
+        ring->fd_     = uring_setup(options.entries, &params);
+        if (ring->fd_ < 0) {
+            std::string message("io_uring_setup() failed: " + ks::error_message());
+            delete ring;
+            return ks::Result<Uring *>::failure(message);
+        }
+
+        // map the rings (a single mapping for both, where the kernel supports it)
+        ring->sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring->cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        const bool single = ((params.features & IORING_FEAT_SINGLE_MMAP) != 0);
+        if (single && (ring->cq_ring_size_ > ring->sq_ring_size_)) {
+            ring->sq_ring_size_ = ring->cq_ring_size_;
+        }
+        ring->sq_ring_ = mmap(0, ring->sq_ring_size_, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_SQ_RING);
+        if (ring->sq_ring_ != MAP_FAILED) {
+            ring->cq_ring_ = single? ring->sq_ring_ :
+                             mmap(0, ring->cq_ring_size_, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_CQ_RING);
+        }
+        if (ring->cq_ring_ != MAP_FAILED) {
+            ring->sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+            ring->sqes_ = static_cast<struct io_uring_sqe *>(
+                            mmap(0, ring->sqes_size_, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_SQES));
+        }
+        if (ring->sqes_ == MAP_FAILED) {
+            std::string message("failed to map the io_uring: " + ks::error_message());
+            delete ring;
+            return ks::Result<Uring *>::failure(message);
+        }
+
+        char *sq = static_cast<char *>(ring->sq_ring_);
+        char *cq = static_cast<char *>(ring->cq_ring_);
+        ring->sq_head_    = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        ring->sq_tail_    = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        ring->sq_flags_   = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+        ring->sq_array_   = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        ring->sq_mask_    = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        ring->sq_entries_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+        ring->cq_head_    = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        ring->cq_tail_    = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        ring->cq_mask_    = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        ring->cqes_       = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        // the SQ slots are used in order
+        for (unsigned i=0; i<ring->sq_entries_; i++) {
+            ring->sq_array_[i] = i;
+        }
+        ring->sq_local_tail_ = *(ring->sq_tail_);
+        return ks::Result<Uring *>::success(ring);
+    }
+
+    Uring::~Uring()
+    {
+        // closing the ring cancels the pending requests
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        if (buffers_ != MAP_FAILED) {
+            munmap(buffers_, buffer_size_ * buf_count_);
+        }
+        if (buf_ring_ != MAP_FAILED) {
+            munmap(buf_ring_, buf_ring_size_);
+        }
+        if (sqes_ != MAP_FAILED) {
+            munmap(sqes_, sqes_size_);
+        }
+        if ((cq_ring_ != MAP_FAILED) && (cq_ring_ != sq_ring_)) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != MAP_FAILED) {
+            munmap(sq_ring_, sq_ring_size_);
+        }
+    }
+
+    struct io_uring_sqe *Uring::next_sqe()
+    {
+        const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sq_local_tail_ - head >= sq_entries_) {
+            return NULL;
+        }
+        struct io_uring_sqe *sqe = sqes_ + (sq_local_tail_ & sq_mask_);
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        sq_local_tail_++;
+        return sqe;
+    }
+
+    int Uring::submit(const unsigned& wait)
+    {
+        __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+        unsigned to_submit = 0;
+        unsigned flags     = (wait > 0)? IORING_ENTER_GETEVENTS : 0;
+        if (sqpoll_) {
+            // the polling thread picks the entries up by itself, unless it has gone idle
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            }
+        } else {
+            to_submit = sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        }
+        if ((to_submit == 0) && (flags == 0)) {
+            return 0;
+        }
+
+        int ret;
+        while (((ret = uring_enter(fd_, to_submit, wait, flags)) < 0) && (errno == EINTR)) { }
+        return (ret < 0)? -1 : 0;
+    }
+
+    struct io_uring_cqe *Uring::peek()
+    {
+        const unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) {
+                // the kernel keeps the completions that did not fit; have them flushed
+                uring_enter(fd_, 0, 0, IORING_ENTER_GETEVENTS);
+            }
+            return NULL;
+        }
+        return cqes_ + (head & cq_mask_);
+    }
+
+    void Uring::consume()
+    {
+        __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+    }
+
+    ks::Result<bool> Uring::provide_buffers(const uint16_t& group, const unsigned& count, const unsigned& size)
+    {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        buf_ring_size_ = ((count * sizeof(struct io_uring_buf) + page - 1) / page) * page;
+        buf_ring_ = static_cast<struct io_uring_buf_ring *>(
+                        mmap(0, buf_ring_size_, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0));
+        if (buf_ring_ == MAP_FAILED) {
+            return ks::Result<bool>::failure("failed to allocate the buffer ring: " + ks::error_message());
+        }
+        buffer_size_ = size;
+        buf_count_   = count;
+        buffers_ = static_cast<char *>(mmap(0, buffer_size_ * buf_count_, PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0));
+        if (buffers_ == MAP_FAILED) {
+            return ks::Result<bool>::failure("failed to allocate the buffers: " + ks::error_message());
+        }
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr    = reinterpret_cast<uint64_t>(buf_ring_);
+        reg.ring_entries = count;
+        reg.bgid         = group;
+        if (uring_register(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            return ks::Result<bool>::failure("failed to register the buffer ring: " + ks::error_message());
+        }
+
+        buf_tail_ = 0;
+        for (unsigned i=0; i<count; i++) {
+            recycle(static_cast<uint16_t>(i));
+        }
+        return ks::Result<bool>::success(true);
+    }
+
+    void Uring::recycle(const uint16_t& id)
+    {
+        // (the `resv` field of the first entry is the tail itself; leave it alone).
+        // the entries start at the head of the ring: `bufs` is off by the empty
+        // struct of __DECLARE_FLEX_ARRAY when the header is compiled as C++
+        struct io_uring_buf *entry = reinterpret_cast<struct io_uring_buf *>(buf_ring_)
+                                     + (buf_tail_ & (buf_count_ - 1));
+        entry->addr = reinterpret_cast<uint64_t>(buffer(id));
+        entry->len  = static_cast<uint32_t>(buffer_size_);
+        entry->bid  = id;
+        buf_tail_++;
+        __atomic_store_n(&(buf_ring_->tail), buf_tail_, __ATOMIC_RELEASE);
+    }
+}
+#endif
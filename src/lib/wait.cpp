@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   wait.cpp -- see wait.h for description
+*/
+#include "wait.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fastevent {
+
+    const uint32_t Waiter::MIN_SPIN;
+    const uint32_t Waiter::MAX_SPIN;
+    const uint64_t Waiter::SLEEP_SLICE_NS;
+
+    ks::Result<Waiter::Strategy> Waiter::parse(const std::string& name)
+    {
+        if (name == "block") {
+            return ks::Result<Strategy>::success(Block);
+        } else if (name == "spin") {
+            return ks::Result<Strategy>::success(Spin);
+        } else if (name == "hybrid") {
+            return ks::Result<Strategy>::success(Hybrid);
+        } else if (name == "futex") {
+            return ks::Result<Strategy>::success(Futex);
+        } else {
+            return ks::Result<Strategy>::failure("unknown wait strategy '" + name + "'"
+                                                 " (must be one of 'block', 'spin', 'hybrid' or 'futex')");
+        }
+    }
+
+    const char *Waiter::name(const Strategy& strategy)
+    {
+        switch (strategy) {
+        case Block:     return "block";
+        case Spin:      return "spin";
+        case Hybrid:    return "hybrid";
+        case Futex:     return "futex";
+        default:        return "unknown";
+        }
+    }
+
+#ifdef __linux__
+    void Waiter::futex_wait()
+    {
+        syscall(SYS_futex, reinterpret_cast<int *>(&sleeping_),
+                FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+    }
+
+    void Waiter::futex_wait_until(const uint64_t& deadline)
+    {
+        // FUTEX_WAIT_BITSET takes an absolute timeout on CLOCK_MONOTONIC
+        struct timespec timeout;
+        timeout.tv_sec  = static_cast<time_t>(deadline / 1000000000ULL);
+        timeout.tv_nsec = static_cast<long>(deadline % 1000000000ULL);
+        syscall(SYS_futex, reinterpret_cast<int *>(&sleeping_),
+                FUTEX_WAIT_BITSET_PRIVATE, 1, &timeout, NULL, FUTEX_BITSET_MATCH_ANY);
+    }
+
+    void Waiter::futex_wake()
+    {
+        syscall(SYS_futex, reinterpret_cast<int *>(&sleeping_),
+                FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+#endif
+}
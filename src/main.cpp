@@ -25,16 +25,51 @@
 #include "dummydriver.h"
 #include "arduinodriver.h"
 #include "service.h"
+#include "rt.h"
+#include <string.h>
+
+#ifndef _WIN32
+#include <signal.h>
+
+/**
+*   the service to be stopped by SIGINT/SIGTERM
+*/
+fastevent::Service *running = 0;
+
+void stop_service(int signum)
+{
+    if (running != 0) {
+        running->stop();
+    }
+}
+#endif
 
 int main(int argc, char* argv[])
 {
-    if (argc < 2) {
-        std::cerr << "***usage: " << argv[0] << " <config file path>" << std::endl;
+    // `--realtime` may precede the config file path
+    bool realtime = false;
+    int  argi     = 1;
+    if ((argc > argi) && (strcmp(argv[argi], "--realtime") == 0)) {
+        realtime = true;
+        argi++;
+    }
+    if (argc <= argi) {
+        std::cerr << "***usage: " << argv[0] << " [--realtime] <config file path>" << std::endl;
         return 1;
     }
-    std::cerr << "config file --> " << argv[1] << std::endl;
+    std::cerr << "config file --> " << argv[argi] << std::endl;
+
+    if (realtime) {
+        // lock the memory before anything is allocated for the pipeline
+        ks::Result<bool> enabled = fastevent::rt::enable_realtime();
+        if (enabled.failed()) {
+            std::cerr << "***failed to enter the real-time mode: " << enabled.what() << "." << std::endl;
+            return 1;
+        }
+        std::cerr << "real-time mode enabled." << std::endl;
+    }
 
-    ks::Result<fastevent::Config> config = fastevent::config::load(argv[1]);
+    ks::Result<fastevent::Config> config = fastevent::config::load(argv[argi]);
     if (config.failed()) {
         std::cerr << "***failed to load config file" << std::endl;
         return 1;
@@ -52,7 +87,23 @@ int main(int argc, char* argv[])
     }
 
     fastevent::Service* service = result.get();
+#ifndef _WIN32
+    running = service;
+    signal(SIGINT,  stop_service);
+    signal(SIGTERM, stop_service);
+    // a local client closing its connection must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+#endif
     service->run();
+#ifndef _WIN32
+    running = 0;
+#endif
     delete service;
+
+    if ((fastevent::rt::hot_allocations() > 0) || (fastevent::rt::hot_stream_writes() > 0)) {
+        std::cerr << "***hot path violations: "
+                  << fastevent::rt::hot_allocations() << " heap allocation(s), "
+                  << fastevent::rt::hot_stream_writes() << " iostream write(s)" << std::endl;
+    }
     return 0;
 }
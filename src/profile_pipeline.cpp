@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   profile_pipeline.cpp -- the code for comparing the round-trip time
+*   of the threaded and the inline pipelines (see "pipeline" in README.md).
+*   the service is run in this process with the given config file, once
+*   in each mode, and is profiled through the (first) UDP port (*NIX only).
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "ks/utils.h"
+#include "ks/thread.h"
+#include "ks/timing.h"
+#include "config.h"
+#include "dummydriver.h"
+#include "arduinodriver.h"
+#include "service.h"
+
+const unsigned DEFAULT_NUMIO = 10000;
+const unsigned NUM_WARMUP    = 100;
+
+/**
+*   runs the service in the background
+*/
+class ServiceThread: public ks::Thread
+{
+public:
+    explicit ServiceThread(fastevent::Service *service): ks::Thread(), service_(service) { }
+    void run() { service_->run(false); }
+private:
+    fastevent::Service *service_;
+};
+
+int print_usage(const char *progname) {
+    std::cerr << "***usage: " << progname
+            << " [-n <num_transactions, defaults to 10000>]"
+            << " <config file path>" << std::endl;
+    return 1;
+}
+
+int open_udp(const uint16_t& port) {
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family      = AF_INET;
+    server.sin_port        = htons(port);
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *)&server, sizeof(server)) != 0) {
+        close(sock);
+        return -1;
+    }
+    struct timeval timeout;
+    timeout.tv_sec  = 1;
+    timeout.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return sock;
+}
+
+/**
+*   runs `num_io` transactions, and returns the number of them that got responses,
+*   with their round-trip times in `rtt`.
+*/
+unsigned run_transactions(const int& sock, const unsigned& num_io, uint64_t *rtt) {
+    ks::nanostamp   nanos;
+    char            msg[2], echo[32];
+    unsigned        done = 0;
+
+    for (unsigned i=0; i<num_io + NUM_WARMUP; i++) {
+        msg[0] = (char)(i % 256);
+        msg[1] = (i % 2)? MASK_EVENT : 0;
+
+        uint64_t start, stop;
+        nanos.get(&start);
+        if (send(sock, msg, 2, 0) != 2) {
+            continue;
+        }
+        // skip the stale echoes (of the transactions that timed out)
+        ssize_t ret;
+        do {
+            ret = recv(sock, echo, sizeof(echo), 0);
+        } while ((ret >= 2) && (echo[0] != msg[0]));
+        if (ret < 2) {
+            continue;
+        }
+        nanos.get(&stop);
+
+        if (i >= NUM_WARMUP) {
+            rtt[done++] = stop - start;
+        }
+    }
+    return done;
+}
+
+/**
+*   runs the service in `mode`, and profiles it. returns the median RTT
+*   in nanoseconds, or 0 if it failed.
+*/
+uint64_t profile(fastevent::Config cfg, const std::string& mode, const unsigned& num_io) {
+    cfg["pipeline"] = fastevent::json::container(mode);
+    ks::Result<fastevent::Service *> result = fastevent::Service::configure(cfg, false);
+    if (result.failed()) {
+        std::cerr << "***failed to set up the service (" << mode << "): " << result.what() << "." << std::endl;
+        return 0;
+    }
+    fastevent::Service *service = result.get();
+    ServiceThread thread(service);
+    thread.start();
+
+    uint16_t port;
+    if (cfg["port"].is<fastevent::json::array>()) {
+        port = static_cast<uint16_t>(cfg["port"].get<fastevent::json::array>()[0].get<double>());
+    } else {
+        port = fastevent::json::get<uint16_t>(cfg, "port");
+    }
+    std::vector<uint64_t> rtt(num_io);
+    unsigned done = 0;
+    int sock = open_udp(port);
+    if (sock < 0) {
+        std::cerr << "***failed to open UDP port " << port << ": " << ks::error_message() << std::endl;
+    } else {
+        std::cerr << "profiling the " << mode << " pipeline..." << std::endl;
+        done = run_transactions(sock, num_io, &(rtt[0]));
+        close(sock);
+    }
+
+    service->stop();
+    thread.join();
+    delete service;
+
+    if (done == 0) {
+        std::cerr << mode << ": no responses" << std::endl;
+        return 0;
+    }
+    for (unsigned i=0; i<done; i++) {
+        std::cout << mode << ',' << rtt[i] << std::endl;
+    }
+    std::sort(rtt.begin(), rtt.begin() + done);
+    std::cerr << mode << ": " << done << "/" << num_io << " responses, RTT (us)"
+              << " median=" << (rtt[done/2] / 1000.0)
+              << ", 99%=" << (rtt[(done*99)/100] / 1000.0)
+              << ", max=" << (rtt[done-1] / 1000.0) << std::endl;
+    return rtt[done/2];
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int num_io = DEFAULT_NUMIO;
+    unsigned int cfgref = 1;
+
+    if (argc < 2) {
+        return print_usage(argv[0]);
+    } else if (strncmp(argv[1], "-n", 2) == 0) {
+        if (argc != 4) {
+            return print_usage(argv[0]);
+
+        } else if (sscanf(argv[2], "%u", &num_io) == std::char_traits<char>::eof()) {
+            std::cerr << "***failed to parse number of transactions: "
+                << argv[2] << std::endl;
+            return print_usage(argv[0]);
+
+        } else {
+            cfgref = 3;
+
+        }
+    }
+    std::cerr << "config file:       " << argv[cfgref] << std::endl;
+    std::cerr << "# of transactions: " << num_io << std::endl;
+
+    ks::Result<fastevent::Config> config = fastevent::config::load(argv[cfgref]);
+    if (config.failed()) {
+        std::cerr << "***failed to load config file" << std::endl;
+        return 1;
+    }
+
+    registerOutputDriver(fastevent::driver::DummyDriver);
+    registerOutputDriver(fastevent::driver::VerboseDummyDriver);
+    registerOutputDriver(fastevent::driver::UnoDriver);
+    registerOutputDriver(fastevent::driver::LeonardoDriver);
+    signal(SIGPIPE, SIG_IGN);
+
+    // (the inline pipeline takes neither the receiver threads nor the shared memory)
+    fastevent::Config cfg = config.get();
+    cfg.erase("receivers");
+    cfg.erase("shm");
+
+    std::cout << "Pipeline,RTT" << std::endl;
+    const char *modes[] = { "threaded", "inline" };
+    uint64_t    medians[2];
+    for (int i=0; i<2; i++) {
+        medians[i] = profile(cfg, modes[i], num_io);
+    }
+    if ((medians[0] == 0) || (medians[1] == 0)) {
+        return 1;
+    }
+    const int faster = (medians[1] < medians[0])? 1 : 0;
+    std::cerr << "the " << modes[faster] << " pipeline responded faster, by "
+              << ((medians[1 - faster] - medians[faster]) / 1000.0) << "us (median)" << std::endl;
+    return 0;
+}
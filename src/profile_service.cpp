@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2018-2019 Keisuke Sehara
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+*   profile_service.cpp -- the code for profiling the round-trip time
+*   of a running FastEventServer, through the UDP loopback, the AF_UNIX
+*   sockets and the shared memory listed in the same config file (*NIX only).
+*   the UDP port is also profiled with the version 2 requests (see protocol.h),
+*   V2_BATCH commands per datagram, and with the scheduled requests, for how
+*   close to their target times (TIMED_AHEAD_NS ahead) the commands are issued.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ks/utils.h"
+#include "ks/timing.h"
+#include "config.h"
+#include "driver.h"
+#include "protocol.h"
+#include "shm.h"
+
+const unsigned DEFAULT_NUMIO = 10000;
+const unsigned NUM_WARMUP    = 100;
+const unsigned V2_BATCH      = 8;
+const uint64_t TIMED_AHEAD_NS = 2000000;
+
+/**
+*   a client-side connection to the server
+*/
+struct Transport
+{
+    std::string         name;
+    int                 sock;
+    struct sockaddr_un  local;      // the bound address of an AF_UNIX SOCK_DGRAM client
+    bool                bound;
+    fastevent::shm::Client *shm;    // instead of `sock`, for the shared memory
+    unsigned            batch;      // the commands per version 2 request (0 for the legacy ones)
+    bool                timed;      // whether or not the requests are scheduled
+};
+
+/**
+*   the monotonic clock of the server (on the same host)
+*/
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+
+int print_usage(const char *progname) {
+    std::cerr << "***usage: " << progname
+            << " [-n <num_transactions, defaults to 10000>]"
+            << " <config file path>" << std::endl;
+    return 1;
+}
+
+void set_timeout(int sock) {
+    struct timeval timeout;
+    timeout.tv_sec  = 1;
+    timeout.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+bool open_udp(const uint16_t& port, const unsigned& batch, const bool& timed, Transport *transport) {
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family      = AF_INET;
+    server.sin_port        = htons(port);
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    transport->name  = timed? "udp-timed" : ((batch > 0)? "udp-v2" : "udp");
+    transport->bound = false;
+    transport->shm   = 0;
+    transport->batch = batch;
+    transport->timed = timed;
+    transport->sock  = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((transport->sock < 0) ||
+        (connect(transport->sock, (struct sockaddr *)&server, sizeof(server)) != 0)) {
+        return false;
+    }
+    set_timeout(transport->sock);
+    return true;
+}
+
+bool open_local(const std::string& path, const bool& seqpacket, Transport *transport) {
+    struct sockaddr_un server;
+    memset(&server, 0, sizeof(server));
+    server.sun_family = AF_UNIX;
+    strncpy(server.sun_path, path.c_str(), sizeof(server.sun_path) - 1);
+
+    transport->name  = seqpacket? "unix-seqpacket" : "unix-dgram";
+    transport->bound = false;
+    transport->shm   = 0;
+    transport->batch = 0;
+    transport->timed = false;
+    transport->sock  = socket(AF_UNIX, seqpacket? SOCK_SEQPACKET : SOCK_DGRAM, 0);
+    if (transport->sock < 0) {
+        return false;
+    }
+    if (!seqpacket) {
+        // the server needs an address to send the responses to
+        memset(&(transport->local), 0, sizeof(transport->local));
+        transport->local.sun_family = AF_UNIX;
+        snprintf(transport->local.sun_path, sizeof(transport->local.sun_path),
+                 "/tmp/profile_service.%d.sock", (int)getpid());
+        unlink(transport->local.sun_path);
+        if (bind(transport->sock, (struct sockaddr *)&(transport->local), sizeof(transport->local)) != 0) {
+            return false;
+        }
+        transport->bound = true;
+    }
+    if (connect(transport->sock, (struct sockaddr *)&server, sizeof(server)) != 0) {
+        return false;
+    }
+    set_timeout(transport->sock);
+    return true;
+}
+
+bool open_shm(const std::string& name, Transport *transport) {
+    transport->name  = "shm";
+    transport->sock  = -1;
+    transport->bound = false;
+    transport->batch = 0;
+    transport->timed = false;
+    transport->shm   = new fastevent::shm::Client();
+    return transport->shm->open(name);
+}
+
+void close_transport(Transport *transport) {
+    if (transport->shm != 0) {
+        delete transport->shm;
+        transport->shm = 0;
+    }
+    if (transport->sock >= 0) {
+        close(transport->sock);
+    }
+    if (transport->bound) {
+        unlink(transport->local.sun_path);
+    }
+}
+
+/**
+*   sends a version 2 request of `transport.batch` commands, numbered from `seq`,
+*   and waits for its ack. returns false if it does not arrive.
+*   a scheduled request is targeted at `target`, and `issued` is set from the ack.
+*/
+bool transact_v2(const Transport& transport, const uint16_t& seq,
+                 const uint64_t& target, uint64_t *issued) {
+    char commands[fastevent::protocol::V2_COMMANDS_MAX];
+    char msg[fastevent::protocol::V2_REQUEST_MAX], ack[32];
+    for (unsigned j=0; j<transport.batch; j++) {
+        commands[j] = ((seq + j) % 2)? MASK_EVENT : 0;
+    }
+    const size_t len = transport.timed?
+        fastevent::protocol::encode_v2_scheduled(msg, seq, target, commands, transport.batch) :
+        fastevent::protocol::encode_v2_request(msg, seq, commands, transport.batch);
+    if (send(transport.sock, msg, len, 0) != static_cast<ssize_t>(len)) {
+        return false;
+    }
+
+    // skip the stale acks (of the requests that timed out)
+    const uint16_t last = static_cast<uint16_t>(seq + transport.batch - 1);
+    while (true) {
+        const ssize_t ret = recv(transport.sock, ack, sizeof(ack), 0);
+        if (ret < 0) {
+            return false;
+        }
+        uint16_t acked;
+        uint8_t  count, flags;
+        if (fastevent::protocol::decode_v2_ack(ack, static_cast<size_t>(ret), &acked, &count, &flags, issued)
+            && (acked == last)) {
+            return true;
+        }
+    }
+}
+
+/**
+*   runs `num_io` transactions, and returns the number of them that got responses.
+*   the timestamps are filled in for each successful transaction
+*   (for the scheduled requests, the target times and the times they were issued).
+*/
+unsigned run_transactions(const Transport& transport, const unsigned& num_io,
+                          uint64_t *sent, uint64_t *received) {
+    ks::nanostamp   nanos;
+    char            msg[2], echo[32];
+    unsigned        done = 0;
+
+    for (unsigned i=0; i<num_io + NUM_WARMUP; i++) {
+        msg[0] = (char)(i % 256);
+        msg[1] = (i % 2)? MASK_EVENT : 0;
+
+        uint64_t start, stop;
+        const uint16_t seq = static_cast<uint16_t>(i * transport.batch);
+        if (transport.timed) {
+            start = monotonic_ns() + TIMED_AHEAD_NS;
+            if (!transact_v2(transport, seq, start, &stop)) {
+                continue;
+            }
+        } else {
+            nanos.get(&start);
+            if (transport.batch > 0) {
+                if (!transact_v2(transport, seq, 0, &stop)) {
+                    continue;
+                }
+            } else if (transport.shm != 0) {
+                if ((!transport.shm->send(msg)) || (!transport.shm->wait(echo))) {
+                    continue;
+                }
+            } else {
+                if (send(transport.sock, msg, 2, 0) != 2) {
+                    continue;
+                }
+                if (recv(transport.sock, echo, sizeof(echo), 0) < 2) {
+                    continue;
+                }
+            }
+            nanos.get(&stop);
+        }
+
+        if (i >= NUM_WARMUP) {
+            sent[done] = start;
+            received[done] = stop;
+            done++;
+        }
+    }
+    return done;
+}
+
+void summarize(const std::string& name, const uint64_t *sent, const uint64_t *received,
+               const unsigned& done, const unsigned& num_io, const unsigned& batch, const bool& timed) {
+    if (done == 0) {
+        std::cerr << name << ": no responses" << std::endl;
+        return;
+    }
+    if (timed) {
+        // how early (negative) or late the commands were issued
+        std::vector<int64_t> offset(done);
+        for (unsigned i=0; i<done; i++) {
+            offset[i] = static_cast<int64_t>(received[i] - sent[i]);
+        }
+        std::sort(offset.begin(), offset.end());
+        std::cerr << name << ": " << done << "/" << num_io << " responses, issued - target (us)"
+                  << " min=" << (offset[0] / 1000.0)
+                  << ", median=" << (offset[done/2] / 1000.0)
+                  << ", 99%=" << (offset[(done*99)/100] / 1000.0)
+                  << ", max=" << (offset[done-1] / 1000.0) << std::endl;
+        return;
+    }
+    std::vector<uint64_t> rtt(done);
+    for (unsigned i=0; i<done; i++) {
+        rtt[i] = received[i] - sent[i];
+    }
+    std::sort(rtt.begin(), rtt.end());
+    std::cerr << name << ": " << done << "/" << num_io << " responses, RTT (us)"
+              << " median=" << (rtt[done/2] / 1000.0)
+              << ", 99%=" << (rtt[(done*99)/100] / 1000.0)
+              << ", max=" << (rtt[done-1] / 1000.0)
+              << ", throughput=" << (done * ((batch > 0)? batch : 1) * 1e9 / (received[done-1] - sent[0]))
+              << " commands/s" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int num_io = DEFAULT_NUMIO;
+    unsigned int cfgref = 1;
+
+    if (argc < 2) {
+        return print_usage(argv[0]);
+    } else if (strncmp(argv[1], "-n", 2) == 0) {
+        if (argc != 4) {
+            return print_usage(argv[0]);
+
+        } else if (sscanf(argv[2], "%u", &num_io) == std::char_traits<char>::eof()) {
+            std::cerr << "***failed to parse number of transactions: "
+                << argv[2] << std::endl;
+            return print_usage(argv[0]);
+
+        } else {
+            cfgref = 3;
+
+        }
+    }
+    std::cerr << "config file:       " << argv[cfgref] << std::endl;
+    std::cerr << "# of transactions: " << num_io << std::endl;
+
+    ks::Result<fastevent::Config> config = fastevent::config::load(argv[cfgref]);
+    if (config.failed()) {
+        std::cerr << "***failed to load config file" << std::endl;
+        return 1;
+    }
+
+    // the transports of the running server, as listed in the config file
+    fastevent::Config cfg = config.get();
+    std::vector<Transport> transports;
+    Transport transport;
+
+    uint16_t port;
+    if (cfg["port"].is<fastevent::json::array>()) {
+        port = static_cast<uint16_t>(cfg["port"].get<fastevent::json::array>()[0].get<double>());
+    } else {
+        port = fastevent::json::get<uint16_t>(cfg, "port");
+    }
+    const unsigned batches[] = { 0, V2_BATCH, 1 };
+    for (int i=0; i<3; i++) {
+        if (open_udp(port, batches[i], (i == 2), &transport)) {
+            transports.push_back(transport);
+        } else {
+            std::cerr << "***failed to open UDP port " << port << ": " << ks::error_message() << std::endl;
+            close_transport(&transport);
+        }
+    }
+
+    if (fastevent::json::has(cfg, "unix")) {
+        fastevent::json::array locals;
+        if (cfg["unix"].is<fastevent::json::array>()) {
+            locals = fastevent::json::get<fastevent::json::array>(cfg, "unix");
+        } else {
+            locals.push_back(cfg["unix"]);
+        }
+        for (fastevent::json::iterator it=locals.begin(); it!=locals.end(); it++) {
+            fastevent::json::dict entry(it->get<fastevent::json::dict>());
+            std::string path(fastevent::json::get<std::string>(entry, "path", ""));
+            bool seqpacket = (fastevent::json::get<std::string>(entry, "type", "dgram") == "seqpacket");
+            if (open_local(path, seqpacket, &transport)) {
+                transports.push_back(transport);
+            } else {
+                std::cerr << "***failed to open " << path << ": " << ks::error_message() << std::endl;
+                close_transport(&transport);
+            }
+        }
+    }
+
+    if (fastevent::json::has(cfg, "shm")) {
+        fastevent::json::dict entry(cfg["shm"].get<fastevent::json::dict>());
+        std::string name(fastevent::json::get<std::string>(entry, "name", "/fastevent"));
+        if (open_shm(name, &transport)) {
+            transports.push_back(transport);
+        } else {
+            std::cerr << "***failed to open " << name << ": " << ks::error_message() << std::endl;
+            close_transport(&transport);
+        }
+    }
+
+    // measure the transports in turn
+    uint64_t *sent = new uint64_t[num_io];
+    uint64_t *received = new uint64_t[num_io];
+
+    std::cout << "Transport,Sent,Received" << std::endl;
+    for (size_t t=0; t<transports.size(); t++) {
+        std::cerr << "profiling " << transports[t].name << "..." << std::endl;
+        unsigned done = run_transactions(transports[t], num_io, sent, received);
+        for (unsigned i=0; i<done; i++) {
+            std::cout << transports[t].name << ',' << sent[i] << ',' << received[i] << std::endl;
+        }
+        summarize(transports[t].name, sent, received, done, num_io, transports[t].batch, transports[t].timed);
+        close_transport(&(transports[t]));
+    }
+
+    delete[] sent;
+    delete[] received;
+    return (transports.size() > 0)? 0 : 1;
+}